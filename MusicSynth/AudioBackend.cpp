@@ -0,0 +1,322 @@
+//--------------------------------------------------------------------------------------------------
+// AudioBackend.cpp
+//
+// PortAudio output for each host API we support, and the null and file sinks.
+//
+//--------------------------------------------------------------------------------------------------
+
+#include "AudioBackend.h"
+#include "PortAudio/include/portaudio.h"
+#include "WavFile.h"
+#include "AudioThreads.h"
+#include "Platform.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+//--------------------------------------------------------------------------------------------------
+class CPortAudioBackend : public CAudioBackend {
+public:
+    CPortAudioBackend (PaHostApiTypeId hostApi, const char* hostApiName)
+        : m_hostApi(hostApi)
+        , m_hostApiName(hostApiName)
+        , m_stream(nullptr)
+        , m_initialized(false)
+        , m_callback(nullptr)
+        , m_numChannels(0)
+        , m_sampleRate(0.0f)
+        , m_outputLatency(0.0) { }
+
+    ~CPortAudioBackend () {
+        Close();
+    }
+
+    virtual bool Open (const SAudioBackendSettings& settings, size_t numChannels, TAudioCallback callback) override {
+        Close();
+        m_callback = callback;
+        m_numChannels = numChannels;
+
+        // initialize port audio
+        PaError err = Pa_Initialize();
+        if (err != paNoError) {
+            printf("Pa_Initialize returned error: %i\n", err);
+            return false;
+        }
+        m_initialized = true;
+
+        // figure out what api index the host api is
+        PaHostApiIndex hostApiIndex = Pa_HostApiTypeIdToHostApiIndex(m_hostApi);
+        if (hostApiIndex < 0) {
+            printf("%s is not available, Pa_HostApiTypeIdToHostApiIndex returned error: %i\n", m_hostApiName, hostApiIndex);
+            return false;
+        }
+
+        // get information about the host api
+        const PaHostApiInfo *hostApiInfo = Pa_GetHostApiInfo(hostApiIndex);
+        if (hostApiInfo == nullptr) {
+            printf("Pa_GetHostApiInfo returned nullptr\n");
+            return false;
+        }
+
+        // make sure there's an output device
+        if (hostApiInfo->defaultOutputDevice == paNoDevice) {
+            printf("No default output device for %s\n", m_hostApiName);
+            return false;
+        }
+
+        // get device info if we can
+        const PaDeviceInfo* deviceInfo = Pa_GetDeviceInfo(hostApiInfo->defaultOutputDevice);
+        if (deviceInfo == nullptr) {
+            printf("Pa_GetDeviceInfo returned nullptr\n");
+            return false;
+        }
+
+        // open the output stream
+        PaStreamParameters outputParameters;
+        outputParameters.device = hostApiInfo->defaultOutputDevice;
+        outputParameters.channelCount = int(numChannels);
+        outputParameters.sampleFormat = paFloat32;
+        outputParameters.suggestedLatency = settings.m_suggestedLatency > 0.0 ? settings.m_suggestedLatency : deviceInfo->defaultLowOutputLatency;
+        outputParameters.hostApiSpecificStreamInfo = nullptr;
+        err = Pa_OpenStream(
+            &m_stream,
+            nullptr,
+            &outputParameters,
+            deviceInfo->defaultSampleRate,
+            (unsigned long)settings.m_framesPerBuffer,
+            0,
+            StreamCallback,
+            this
+        );
+        if (err != paNoError) {
+            printf("Pa_OpenStream returned error: %i\n", err);
+            m_stream = nullptr;
+            return false;
+        }
+
+        // get the stream info for the stream we created
+        const PaStreamInfo* streamInfo = Pa_GetStreamInfo(m_stream);
+        if (streamInfo == nullptr) {
+            printf("Pa_GetStreamInfo returned nullptr\n");
+            return false;
+        }
+        m_sampleRate = (float)streamInfo->sampleRate;
+        m_outputLatency = streamInfo->outputLatency;
+        return true;
+    }
+
+    virtual bool Start () override {
+        PaError err = Pa_StartStream(m_stream);
+        if (err != paNoError) {
+            printf("Pa_StartStream returned error: %i\n", err);
+            return false;
+        }
+        return true;
+    }
+
+    virtual void Close () override {
+        if (m_stream) {
+            PaError err = Pa_StopStream(m_stream);
+            if (err != paNoError)
+                printf("Pa_StopStream returned error: %i\n", err);
+
+            err = Pa_CloseStream(m_stream);
+            if (err != paNoError)
+                printf("Pa_CloseStream returned error: %i\n", err);
+            m_stream = nullptr;
+        }
+
+        if (m_initialized) {
+            Pa_Terminate();
+            m_initialized = false;
+        }
+    }
+
+    virtual float GetSampleRate () const override { return m_sampleRate; }
+    virtual double GetTime () const override { return Pa_GetStreamTime(m_stream); }
+    virtual double GetOutputLatency () const override { return m_outputLatency; }
+
+private:
+    static int StreamCallback (
+        const void *inputBuffer,
+        void *outputBuffer,
+        unsigned long framesPerBuffer,
+        const PaStreamCallbackTimeInfo* timeInfo,
+        PaStreamCallbackFlags statusFlags,
+        void *userData
+    ) {
+        CPortAudioBackend* backend = (CPortAudioBackend*)userData;
+        CAudioThreads::OnAudioCallback();
+        auto start = std::chrono::steady_clock::now();
+        backend->m_callback((float*)outputBuffer, framesPerBuffer, backend->m_numChannels, backend->m_sampleRate, timeInfo->currentTime);
+        std::chrono::duration<double> renderTime = std::chrono::steady_clock::now() - start;
+
+        // count the buffer as an xrun if the host says it underflowed, or if it took longer to render
+        // than it takes to play, which is going to underflow sooner or later
+        if ((statusFlags & paOutputUnderflow) != 0 || renderTime.count() * double(backend->m_sampleRate) > double(framesPerBuffer))
+            ++backend->m_numXruns;
+        return paContinue;
+    }
+
+    PaHostApiTypeId m_hostApi;
+    const char*     m_hostApiName;
+    PaStream*       m_stream;
+    bool            m_initialized;
+    TAudioCallback  m_callback;
+    size_t          m_numChannels;
+    float           m_sampleRate;
+    double          m_outputLatency;
+};
+
+//--------------------------------------------------------------------------------------------------
+// Renders on its own thread, paced against the system clock, optionally writing to a wave file.
+class CNullAudioBackend : public CAudioBackend {
+public:
+    CNullAudioBackend (bool writeFile)
+        : m_writeFile(writeFile)
+        , m_file(nullptr)
+        , m_callback(nullptr)
+        , m_numChannels(0)
+        , m_framesPerBuffer(0)
+        , m_sampleRate(0.0f)
+        , m_quit(false)
+        , m_numSamplesWritten(0) { }
+
+    ~CNullAudioBackend () {
+        Close();
+    }
+
+    virtual bool Open (const SAudioBackendSettings& settings, size_t numChannels, TAudioCallback callback) override {
+        static const float c_sampleRate = 44100.0f;
+        static const size_t c_defaultFramesPerBuffer = 256;
+
+        Close();
+        m_callback = callback;
+        m_numChannels = numChannels;
+        m_sampleRate = c_sampleRate;
+        m_framesPerBuffer = settings.m_framesPerBuffer > 0 ? settings.m_framesPerBuffer : c_defaultFramesPerBuffer;
+
+        if (m_writeFile) {
+            m_file = OpenFile(settings.m_fileName, "w+b");
+            if (!m_file) {
+                printf("ERROR: could not open %s to write audio to\r\n", settings.m_fileName);
+                return false;
+            }
+
+            // write a dummy header for now, it's re-written with the right sizes on close
+            fwrite(&m_waveFileHeader, sizeof(m_waveFileHeader), 1, m_file);
+            m_numSamplesWritten = 0;
+            printf("Writing audio to %s\r\n", settings.m_fileName);
+        }
+        return true;
+    }
+
+    virtual bool Start () override {
+        m_quit = false;
+        m_startTime = std::chrono::steady_clock::now();
+        m_thread = std::thread(&CNullAudioBackend::ThreadMain, this);
+        return true;
+    }
+
+    virtual void Close () override {
+        if (m_thread.joinable()) {
+            m_quit = true;
+            m_thread.join();
+        }
+
+        if (m_file) {
+            fseek(m_file, 0, SEEK_SET);
+            m_waveFileHeader.Fill(int(m_numSamplesWritten), int(m_numChannels), int(m_sampleRate));
+            fwrite(&m_waveFileHeader, sizeof(m_waveFileHeader), 1, m_file);
+            fclose(m_file);
+            m_file = nullptr;
+        }
+    }
+
+    virtual float GetSampleRate () const override { return m_sampleRate; }
+
+    virtual double GetTime () const override {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_startTime;
+        return elapsed.count();
+    }
+
+    // a buffer is rendered as it's due to be played, so the only latency is the buffer itself
+    virtual double GetOutputLatency () const override { return double(m_framesPerBuffer) / double(m_sampleRate); }
+
+private:
+    void ThreadMain () {
+        std::vector<float> buffer(m_framesPerBuffer * m_numChannels);
+        std::vector<int16_t> fileBuffer(m_writeFile ? buffer.size() : 0);
+        CAudioThreads::OnAudioCallback();
+
+        // Buffer N is rendered when the system clock reaches its start time, so the stream time is
+        // exactly the number of frames rendered, whatever the system clock does.
+        size_t frame = 0;
+        while (!m_quit) {
+            double streamTime = double(frame) / double(m_sampleRate);
+            std::this_thread::sleep_until(m_startTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(streamTime)));
+
+            m_callback(buffer.data(), m_framesPerBuffer, m_numChannels, m_sampleRate, streamTime);
+            frame += m_framesPerBuffer;
+
+            // a sound card would have run dry if we finished after the next buffer was due
+            if (GetTime() > double(frame) / double(m_sampleRate))
+                ++m_numXruns;
+
+            if (m_file) {
+                for (size_t i = 0; i < buffer.size(); ++i)
+                    fileBuffer[i] = ConvertFloatToAudioSample(buffer[i]);
+                fwrite(fileBuffer.data(), sizeof(int16_t), fileBuffer.size(), m_file);
+                m_numSamplesWritten += fileBuffer.size();
+            }
+        }
+    }
+
+    bool                                    m_writeFile;
+    FILE*                                   m_file;
+    SWaveFileHeader                         m_waveFileHeader;
+    TAudioCallback                          m_callback;
+    size_t                                  m_numChannels;
+    size_t                                  m_framesPerBuffer;
+    float                                   m_sampleRate;
+    std::thread                             m_thread;
+    std::atomic<bool>                       m_quit;
+    std::chrono::steady_clock::time_point   m_startTime;
+    size_t                                  m_numSamplesWritten;
+};
+
+//--------------------------------------------------------------------------------------------------
+std::unique_ptr<CAudioBackend> CAudioBackend::Create (EAudioBackend backend) {
+    switch (backend) {
+        case EAudioBackend::e_wasapi: return std::make_unique<CPortAudioBackend>(paWASAPI, "WASAPI");
+        case EAudioBackend::e_alsa: return std::make_unique<CPortAudioBackend>(paALSA, "ALSA");
+        case EAudioBackend::e_jack: return std::make_unique<CPortAudioBackend>(paJACK, "JACK");
+        case EAudioBackend::e_null: return std::make_unique<CNullAudioBackend>(false);
+        case EAudioBackend::e_file: return std::make_unique<CNullAudioBackend>(true);
+    }
+    return nullptr;
+}
+
+//--------------------------------------------------------------------------------------------------
+const char* CAudioBackend::BackendToString (EAudioBackend backend) {
+    switch (backend) {
+        case EAudioBackend::e_wasapi: return "wasapi";
+        case EAudioBackend::e_alsa: return "alsa";
+        case EAudioBackend::e_jack: return "jack";
+        case EAudioBackend::e_null: return "null";
+        case EAudioBackend::e_file: return "file";
+    }
+    return "unknown";
+}
+
+//--------------------------------------------------------------------------------------------------
+EAudioBackend CAudioBackend::StringToBackend (const char* name) {
+    for (int i = 0; i < int(EAudioBackend::e_count); ++i) {
+        if (!strcmp(name, BackendToString(EAudioBackend(i))))
+            return EAudioBackend(i);
+    }
+    return EAudioBackend::e_count;
+}
@@ -0,0 +1,84 @@
+//--------------------------------------------------------------------------------------------------
+// AudioBackend.h
+//
+// Audio output, behind an interface so the app can play through different PortAudio host APIs, or
+// through a sink with no sound card at all.  The null and file sinks render on their own thread at
+// real time pace, with a stream time that is exactly the number of frames rendered, and the file
+// sink also writes everything it renders to a wave file.
+//
+//--------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <memory>
+#include <atomic>
+
+//--------------------------------------------------------------------------------------------------
+enum class EAudioBackend {
+    e_wasapi,
+    e_alsa,
+    e_jack,
+    e_null,
+    e_file,
+
+    e_count
+};
+
+//--------------------------------------------------------------------------------------------------
+struct SAudioBackendSettings {
+    SAudioBackendSettings ()
+#ifdef _WIN32
+        : m_backend(EAudioBackend::e_wasapi)
+#else
+        : m_backend(EAudioBackend::e_alsa)
+#endif
+        , m_framesPerBuffer(0)
+        , m_suggestedLatency(0.0)
+        , m_fileName("output.wav") {}
+
+    EAudioBackend   m_backend;
+    size_t          m_framesPerBuffer;  // 0 lets the backend choose, and maybe vary it per buffer
+    double          m_suggestedLatency; // in seconds.  0 uses the device's default low latency.
+    const char*     m_fileName;         // for the file sink
+};
+
+//--------------------------------------------------------------------------------------------------
+// Called on the audio thread for each buffer.  streamTime is the backend's time at the start of the
+// buffer, on the same clock as CAudioBackend::GetTime().
+typedef void (*TAudioCallback) (float *outputBuffer, size_t framesPerBuffer, size_t numChannels, float sampleRate, double streamTime);
+
+//--------------------------------------------------------------------------------------------------
+class CAudioBackend {
+public:
+    CAudioBackend () : m_numXruns(0) { }
+    virtual ~CAudioBackend () { }
+
+    // Host APIs that PortAudio wasn't built with fail in Open()
+    static std::unique_ptr<CAudioBackend> Create (EAudioBackend backend);
+
+    static const char* BackendToString (EAudioBackend backend);
+    // returns EAudioBackend::e_count if the name isn't recognized
+    static EAudioBackend StringToBackend (const char* name);
+
+    // Opens the output, printing what went wrong if it can't.  The callback isn't called until
+    // Start().
+    virtual bool Open (const SAudioBackendSettings& settings, size_t numChannels, TAudioCallback callback) = 0;
+    virtual bool Start () = 0;
+
+    // stops the output if it's running, and closes it
+    virtual void Close () = 0;
+
+    virtual float GetSampleRate () const = 0;
+
+    // any thread.  The current stream time, in seconds.
+    virtual double GetTime () const = 0;
+
+    // The output latency the backend actually got, in seconds, which can differ from the one asked
+    // for.  Valid after Open().
+    virtual double GetOutputLatency () const = 0;
+
+    // any thread.  How many buffers have underflowed, or taken longer to render than they last.
+    size_t GetNumXruns () const { return m_numXruns; }
+
+protected:
+    std::atomic<size_t> m_numXruns;
+};
@@ -7,12 +7,59 @@
 #pragma once
 
 #include <memory>
+#include <xmmintrin.h>
 #include "AudioUtils.h"
+#include "EngineMemory.h"
 
 // effects available
 struct SDelayEffect;
 struct SMultiTapReverbEffect;
 struct SFlangeEffect;
+struct SBiQuad;
+struct SStateVariableFilter;
+struct SHalfBandFilter;
+struct SWaveShaperEffect;
+struct SLimiterEffect;
+struct SCompressorEffect;
+
+//--------------------------------------------------------------------------------------------------
+// Lets an effect go to sleep once it has nothing left to output, so it doesn't spend time ringing
+// out silence.  The effect passes in every sample it writes into its buffers, and once a whole
+// tail's worth of them have been silent, everything left in the buffers is too.  While it's asleep
+// and the input is silent too, the effect can skip its processing and output zero.
+//
+struct STailTracker {
+
+    STailTracker ()
+        : m_tailLength(0)
+        , m_silentLength(0) {}
+
+    // how many silent samples in a row it takes to flush the effect's buffers
+    void SetTailLength (size_t tailLength) {
+        m_tailLength = tailLength;
+        Reset();
+    }
+
+    // call when the effect's buffers are cleared, which leaves nothing to ring out
+    void Reset () {
+        m_silentLength = m_tailLength;
+    }
+
+    void AddSample (float sample) {
+        if (!IsSilentSample(sample))
+            m_silentLength = 0;
+        else if (m_silentLength < m_tailLength)
+            ++m_silentLength;
+    }
+
+    bool IsAsleep () const { return m_silentLength >= m_tailLength; }
+
+    // true if the effect has nothing to add to this input sample
+    bool CanSkip (float input) const { return IsAsleep() && IsSilentSample(input); }
+
+    size_t  m_tailLength;
+    size_t  m_silentLength;
+};
 
 //--------------------------------------------------------------------------------------------------
 struct SDelayEffect {
@@ -23,27 +70,30 @@ struct SDelayEffect {
         , m_feedback(1.0f)
         , m_sampleIndex(0) {}
 
-    void SetEffectParams (float delayTime, float sampleRate, size_t numChannels, float feedback) {
+    void SetEffectParams (float delayTime, float sampleRate, float feedback) {
 
-        size_t numSamples = size_t(delayTime * sampleRate) * numChannels;
+        size_t numSamples = size_t(delayTime * sampleRate);
 
-        delete[] m_delayBuffer;
+        CEngineMemory::Free(m_delayBuffer);
 
         if (numSamples == 0) {
             m_delayBuffer = nullptr;
             return;
         }
 
-        m_delayBuffer = new float[numSamples];
+        m_delayBuffer = CEngineMemory::Allocate<float>(numSamples);
         memset(m_delayBuffer, 0, sizeof(float)*numSamples);
 
         m_delayBufferSize = numSamples;
         m_feedback = feedback;
         m_sampleIndex = 0;
+        m_tail.SetTailLength(numSamples);
     }
 
+    bool IsAsleep () const { return m_tail.IsAsleep(); }
+
     float AddSample (float sample) {
-        if (!m_delayBuffer)
+        if (!m_delayBuffer || m_tail.CanSkip(sample))
             return 0.0f;
 
         // cache off our value to return
@@ -52,6 +102,7 @@ struct SDelayEffect {
         // apply feedback in the delay buffer, for whatever is currently in there.
         // also mix in our new sample.
         m_delayBuffer[m_sampleIndex] = m_delayBuffer[m_sampleIndex] * m_feedback + sample;
+        m_tail.AddSample(m_delayBuffer[m_sampleIndex]);
 
         // move the index to the next location
         m_sampleIndex = (m_sampleIndex + 1) % m_delayBufferSize;
@@ -61,23 +112,24 @@ struct SDelayEffect {
     }
 
     ~SDelayEffect() {
-        delete[] m_delayBuffer;
+        CEngineMemory::Free(m_delayBuffer);
     }
 
-    float*  m_delayBuffer;
-    size_t  m_delayBufferSize;
-    float   m_feedback;
-    size_t  m_sampleIndex;
+    float*          m_delayBuffer;
+    size_t          m_delayBufferSize;
+    float           m_feedback;
+    size_t          m_sampleIndex;
+    STailTracker    m_tail;
 };
 
 //--------------------------------------------------------------------------------------------------
 struct SPingPongDelayEffect {
 public:
-    void SetEffectParams(float delayTime, float sampleRate, size_t numChannels, float feedback) {
+    void SetEffectParams(float delayTime, float sampleRate, float feedback) {
         m_lastOutRight = 0.0f;
         m_feedback = feedback;
-        m_delayLeft.SetEffectParams(delayTime, sampleRate, numChannels, 0.0f);
-        m_delayRight.SetEffectParams(delayTime, sampleRate, numChannels, 0.0f);
+        m_delayLeft.SetEffectParams(delayTime, sampleRate, 0.0f);
+        m_delayRight.SetEffectParams(delayTime, sampleRate, 0.0f);
     }
 
     void AddSample (float sample, float& outLeft, float& outRight) {
@@ -86,6 +138,9 @@ public:
         m_lastOutRight = outRight * m_feedback;
     }
 
+    // the echoes go around through the input, so once both delays are asleep there are none left
+    bool IsAsleep () const { return m_delayLeft.IsAsleep() && m_delayRight.IsAsleep() && IsSilentSample(m_lastOutRight); }
+
 private:
     SDelayEffect m_delayLeft;
     SDelayEffect m_delayRight;
@@ -106,31 +161,41 @@ struct SMultiTapReverbEffect {
         , m_bufferSize(0)
         , m_sampleIndex(0) {}
 
-    void SetEffectParams (float sampleRate, size_t numChannels) {
+    // The taps are this many times further apart than the times below.  That's how the reverb has
+    // always sounded, from when its buffer was sized for interleaved stereo.
+    static const size_t c_timeScale = 2;
 
-        m_numChannels = numChannels;
-        m_bufferSize = size_t(0.662f * sampleRate) * m_numChannels;
+    void SetEffectParams (float sampleRate) {
+
+        m_bufferSize = size_t(0.662f * sampleRate) * c_timeScale;
             
-        delete[] m_buffer;
-        m_buffer = new float[m_bufferSize];
+        CEngineMemory::Free(m_buffer);
+        m_buffer = CEngineMemory::Allocate<float>(m_bufferSize);
 
-        m_taps[0] = { size_t(0.079f * sampleRate * m_numChannels), 0.0562f };
-        m_taps[1] = { size_t(0.130f * sampleRate * m_numChannels), 0.0707f };
-        m_taps[2] = { size_t(0.230f * sampleRate * m_numChannels), 0.1778f };
-        m_taps[3] = { size_t(0.340f * sampleRate * m_numChannels), 0.0707f };
-        m_taps[4] = { size_t(0.470f * sampleRate * m_numChannels), 0.1412f };
-        m_taps[5] = { size_t(0.532f * sampleRate * m_numChannels), 0.0891f };
-        m_taps[6] = { size_t(0.662f * sampleRate * m_numChannels), 0.2238f };
+        m_taps[0] = { size_t(0.079f * sampleRate * c_timeScale), 0.0562f };
+        m_taps[1] = { size_t(0.130f * sampleRate * c_timeScale), 0.0707f };
+        m_taps[2] = { size_t(0.230f * sampleRate * c_timeScale), 0.1778f };
+        m_taps[3] = { size_t(0.340f * sampleRate * c_timeScale), 0.0707f };
+        m_taps[4] = { size_t(0.470f * sampleRate * c_timeScale), 0.1412f };
+        m_taps[5] = { size_t(0.532f * sampleRate * c_timeScale), 0.0891f };
+        m_taps[6] = { size_t(0.662f * sampleRate * c_timeScale), 0.2238f };
 
+        m_tail.SetTailLength(m_bufferSize);
         ClearBuffer();
     }
 
     void ClearBuffer (void) {
         memset(m_buffer, 0, sizeof(float)*m_bufferSize);
         m_sampleIndex = 0;
+        m_tail.Reset();
     }
 
+    bool IsAsleep () const { return m_tail.IsAsleep(); }
+
     float AddSample (float sample) {
+        if (m_tail.CanSkip(sample))
+            return 0.0f;
+
         // gather all the taps
         float ret = 0.0f;
         for (int i = 0; i < 7; ++i) {
@@ -143,20 +208,21 @@ struct SMultiTapReverbEffect {
 
         // put the sample into the buffer, with feedback
         m_buffer[m_sampleIndex] = sample + ret * 0.5f;
+        m_tail.AddSample(m_buffer[m_sampleIndex]);
 
         // return the sum of the taps
         return ret + sample;
     }
 
     ~SMultiTapReverbEffect() {
-        delete[] m_buffer;
+        CEngineMemory::Free(m_buffer);
     }
 
-    float*      m_buffer;
-    size_t      m_numChannels;
-    size_t      m_bufferSize;
-    size_t      m_sampleIndex;
-    STap        m_taps[7];
+    float*          m_buffer;
+    size_t          m_bufferSize;
+    size_t          m_sampleIndex;
+    STap            m_taps[7];
+    STailTracker    m_tail;
 };
 
 //--------------------------------------------------------------------------------------------------
@@ -170,46 +236,48 @@ struct SFlangeEffect {
     SFlangeEffect()
         : m_buffer(nullptr)
         , m_bufferSize(0)
-        , m_sampleIndex(0)
-        , m_phase(0.0f)
-        , m_phaseAdvance(0.0f) {}
+        , m_sampleIndex(0) {}
 
-    void SetEffectParams (float sampleRate, size_t numChannels, float frequency, float amplitudeSeconds) {
+    void SetEffectParams (float sampleRate, float frequency, float amplitudeSeconds) {
 
-        m_phase = 0.0f;
-        m_phaseAdvance = frequency / sampleRate;
+        m_phase = SPhaseAccumulator(frequency, sampleRate);
 
-        m_numChannels = numChannels;
-        m_bufferSize = size_t(amplitudeSeconds * sampleRate) * m_numChannels;
+        m_bufferSize = size_t(amplitudeSeconds * sampleRate);
             
-        delete[] m_buffer;
-        m_buffer = new float[m_bufferSize];
+        CEngineMemory::Free(m_buffer);
+        m_buffer = CEngineMemory::Allocate<float>(m_bufferSize);
 
+        m_tail.SetTailLength(m_bufferSize);
         ClearBuffer();
     }
 
     void ClearBuffer (void) {
         memset(m_buffer, 0, sizeof(float)*m_bufferSize);
         m_sampleIndex = 0;
-        m_phase = 0.0f;
+        m_phase.m_phase = 0;
+        m_tail.Reset();
     }
 
+    bool IsAsleep () const { return m_tail.IsAsleep(); }
+
     float AddSample (float sample) {
+        if (m_tail.CanSkip(sample))
+            return 0.0f;
 
-        // get the tap, linearly interpolating between samples as appropriate.
-        // Our channel data is interleaved, so samples for the same channel are spaced apart by m_numChannels.
-        float tapOffsetFloat = (SineWave(m_phase) * 0.5f + 0.5f) * float((m_bufferSize / m_numChannels) - 1);
+        // get the tap, interpolating between samples as appropriate
+        float tapOffsetFloat = (SineWave(m_phase) * 0.5f + 0.5f) * float(m_bufferSize - 1);
         float percent = std::fmodf(tapOffsetFloat, 1.0f);
-        size_t tapOffset = size_t(tapOffsetFloat) * m_numChannels;
-        float tap0 = m_buffer[(m_sampleIndex + tapOffset + m_bufferSize - m_numChannels) % m_bufferSize];
+        size_t tapOffset = size_t(tapOffsetFloat);
+        float tap0 = m_buffer[(m_sampleIndex + tapOffset + m_bufferSize - 1) % m_bufferSize];
         float tap1 = m_buffer[(m_sampleIndex + tapOffset) % m_bufferSize];
-        float tap2 = m_buffer[(m_sampleIndex + tapOffset + m_numChannels) % m_bufferSize];
-        float tap3 = m_buffer[(m_sampleIndex + tapOffset + m_numChannels + m_numChannels) % m_bufferSize];
+        float tap2 = m_buffer[(m_sampleIndex + tapOffset + 1) % m_bufferSize];
+        float tap3 = m_buffer[(m_sampleIndex + tapOffset + 2) % m_bufferSize];
         //float tap = Lerp(tap1, tap2, percent);
         float tap = CubicHermite(tap0, tap1, tap2, tap3, percent);
 
         // put the sample into the buffer
         m_buffer[m_sampleIndex] = sample;
+        m_tail.AddSample(sample);
 
         // move the index to the next location
         m_sampleIndex = (m_sampleIndex + 1) % m_bufferSize;
@@ -220,19 +288,23 @@ struct SFlangeEffect {
 
     void AdvancePhase () {
         // advance the phase
-        m_phase = std::fmodf(m_phase + m_phaseAdvance, 1.0f);
+        m_phase.Advance();
+    }
+
+    // for skipping over a block while asleep, so the sweep carries on where it would have been
+    void AdvancePhase (size_t numSamples) {
+        m_phase.Advance(m_phase.m_increment * uint32_t(numSamples));
     }
 
     ~SFlangeEffect() {
-        delete[] m_buffer;
+        CEngineMemory::Free(m_buffer);
     }
 
-    float*      m_buffer;
-    size_t      m_numChannels;
-    size_t      m_bufferSize;
-    size_t      m_sampleIndex;
-    float       m_phase;
-    float       m_phaseAdvance;
+    float*              m_buffer;
+    size_t              m_bufferSize;
+    size_t              m_sampleIndex;
+    SPhaseAccumulator   m_phase;
+    STailTracker        m_tail;
 };
 
 //--------------------------------------------------------------------------------------------------
@@ -254,20 +326,60 @@ struct SBiQuad {
         e_highShelf
     };
 
+    struct SCoefficients {
+        float m_a0;
+        float m_a1;
+        float m_a2;
+        float m_b1;
+        float m_b2;
+    };
+
     SBiQuad() {
-        m_a0 = m_a1 = m_a2 = 0.0f;
-        m_b1 = m_b2 = 0.0f;
+        m_coefficients = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+        m_coefficientsStep = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+        m_coefficientsTarget = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+        m_rampSamplesLeft = 0;
         m_xn1 = m_xn2 = 0.0f;
         m_yn1 = m_yn2 = 0.0f;
     }
 
-    // adpated from http://www.earlevel.com/main/2011/01/02/biquad-formulas/
     void SetEffectParams (EType type, float cutoffFrequency, float sampleRate, float Q, float peakGain) {
 
         // initialize our input and output parameters
         //m_xn1 = m_xn2 = 0.0f;
         //m_yn1 = m_yn2 = 0.0f;
         // DONT do the above, so we can change the params in real time
+        SetCoefficients(CalculateCoefficients(type, cutoffFrequency, sampleRate, Q, peakGain));
+    }
+
+    void SetCoefficients (const SCoefficients& coefficients) {
+        m_coefficients = coefficients;
+        m_rampSamplesLeft = 0;
+    }
+
+    // Linearly moves the coefficients to the target over numSamples samples.  For modulated filters,
+    // calculate the target once per control block (every 16-64 samples) instead of calling
+    // SetEffectParams every sample, which costs a tanf, a powf and a switch each time.
+    void RampToCoefficients (const SCoefficients& target, size_t numSamples) {
+        if (numSamples == 0) {
+            SetCoefficients(target);
+            return;
+        }
+
+        float stepScale = 1.0f / float(numSamples);
+        m_coefficientsStep.m_a0 = (target.m_a0 - m_coefficients.m_a0) * stepScale;
+        m_coefficientsStep.m_a1 = (target.m_a1 - m_coefficients.m_a1) * stepScale;
+        m_coefficientsStep.m_a2 = (target.m_a2 - m_coefficients.m_a2) * stepScale;
+        m_coefficientsStep.m_b1 = (target.m_b1 - m_coefficients.m_b1) * stepScale;
+        m_coefficientsStep.m_b2 = (target.m_b2 - m_coefficients.m_b2) * stepScale;
+        m_coefficientsTarget = target;
+        m_rampSamplesLeft = numSamples;
+    }
+
+    // adpated from http://www.earlevel.com/main/2011/01/02/biquad-formulas/
+    static SCoefficients CalculateCoefficients (EType type, float cutoffFrequency, float sampleRate, float Q, float peakGain) {
+
+        SCoefficients c = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
 
         // calculate biquad coefficients
         float V = std::powf(10.0f, std::fabs(peakGain) / 20.0f);
@@ -275,105 +387,108 @@ struct SBiQuad {
         switch (type) {
             case EType::e_lowPass: {
                 float norm = 1 / (1 + K / Q + K * K);
-                m_a0 = K * K * norm;
-                m_a1 = 2.0f * m_a0;
-                m_a2 = m_a0;
-                m_b1 = 2.0f * (K * K - 1) * norm;
-                m_b2 = (1.0f - K / Q + K * K) * norm;
+                c.m_a0 = K * K * norm;
+                c.m_a1 = 2.0f * c.m_a0;
+                c.m_a2 = c.m_a0;
+                c.m_b1 = 2.0f * (K * K - 1) * norm;
+                c.m_b2 = (1.0f - K / Q + K * K) * norm;
                 break;
             }
             case EType::e_highPass: {
                 float norm = 1.0f / (1.0f + K / Q + K * K);
-                m_a0 = 1.0f * norm;
-                m_a1 = -2.0f * m_a0;
-                m_a2 = m_a0;
-                m_b1 = 2.0f * (K * K - 1.0f) * norm;
-                m_b2 = (1.0f - K / Q + K * K) * norm;
+                c.m_a0 = 1.0f * norm;
+                c.m_a1 = -2.0f * c.m_a0;
+                c.m_a2 = c.m_a0;
+                c.m_b1 = 2.0f * (K * K - 1.0f) * norm;
+                c.m_b2 = (1.0f - K / Q + K * K) * norm;
                 break;
             }        
             case EType::e_bandPass: {
                 float norm = 1.0f / (1.0f + K / Q + K * K);
-                m_a0 = K / Q * norm;
-                m_a1 = 0.0f;
-                m_a2 = -m_a0;
-                m_b1 = 2.0f * (K * K - 1.0f) * norm;
-                m_b2 = (1.0f - K / Q + K * K) * norm;
+                c.m_a0 = K / Q * norm;
+                c.m_a1 = 0.0f;
+                c.m_a2 = -c.m_a0;
+                c.m_b1 = 2.0f * (K * K - 1.0f) * norm;
+                c.m_b2 = (1.0f - K / Q + K * K) * norm;
                 break;
             }
             case EType::e_notch: {
                 float norm = 1 / (1 + K / Q + K * K);
-                m_a0 = (1 + K * K) * norm;
-                m_a1 = 2 * (K * K - 1) * norm;
-                m_a2 = m_a0;
-                m_b1 = m_a1;
-                m_b2 = (1 - K / Q + K * K) * norm;
+                c.m_a0 = (1 + K * K) * norm;
+                c.m_a1 = 2 * (K * K - 1) * norm;
+                c.m_a2 = c.m_a0;
+                c.m_b1 = c.m_a1;
+                c.m_b2 = (1 - K / Q + K * K) * norm;
                 break;
             }
             case EType::e_peak: {
                 if (peakGain >= 0.0f) {    // boost
                     float norm = 1.0f / (1.0f + 1.0f / Q * K + K * K);
-                    m_a0 = (1.0f + V / Q * K + K * K) * norm;
-                    m_a1 = 2.0f * (K * K - 1) * norm;
-                    m_a2 = (1.0f - V / Q * K + K * K) * norm;
-                    m_b1 = m_a1;
-                    m_b2 = (1.0f - 1.0f / Q * K + K * K) * norm;
+                    c.m_a0 = (1.0f + V / Q * K + K * K) * norm;
+                    c.m_a1 = 2.0f * (K * K - 1) * norm;
+                    c.m_a2 = (1.0f - V / Q * K + K * K) * norm;
+                    c.m_b1 = c.m_a1;
+                    c.m_b2 = (1.0f - 1.0f / Q * K + K * K) * norm;
                 }
                 else {    // cut
                     float norm = 1.0f / (1.0f + V / Q * K + K * K);
-                    m_a0 = (1.0f + 1.0f / Q * K + K * K) * norm;
-                    m_a1 = 2.0f * (K * K - 1) * norm;
-                    m_a2 = (1.0f - 1.0f / Q * K + K * K) * norm;
-                    m_b1 = m_a1;
-                    m_b2 = (1.0f - V / Q * K + K * K) * norm;
+                    c.m_a0 = (1.0f + 1.0f / Q * K + K * K) * norm;
+                    c.m_a1 = 2.0f * (K * K - 1) * norm;
+                    c.m_a2 = (1.0f - 1.0f / Q * K + K * K) * norm;
+                    c.m_b1 = c.m_a1;
+                    c.m_b2 = (1.0f - V / Q * K + K * K) * norm;
                 }
                 break;
             }
             case EType::e_lowShelf: {
                 if (peakGain >= 0.0f) {    // boost
                     float norm = 1.0f / (1.0f + std::sqrtf(2.0f) * K + K * K);
-                    m_a0 = (1.0f + std::sqrtf(2.0f * V) * K + V * K * K) * norm;
-                    m_a1 = 2.0f * (V * K * K - 1.0f) * norm;
-                    m_a2 = (1.0f - std::sqrtf(2.0f * V) * K + V * K * K) * norm;
-                    m_b1 = 2.0f * (K * K - 1.0f) * norm;
-                    m_b2 = (1.0f - std::sqrtf(2.0f) * K + K * K) * norm;
+                    c.m_a0 = (1.0f + std::sqrtf(2.0f * V) * K + V * K * K) * norm;
+                    c.m_a1 = 2.0f * (V * K * K - 1.0f) * norm;
+                    c.m_a2 = (1.0f - std::sqrtf(2.0f * V) * K + V * K * K) * norm;
+                    c.m_b1 = 2.0f * (K * K - 1.0f) * norm;
+                    c.m_b2 = (1.0f - std::sqrtf(2.0f) * K + K * K) * norm;
                 }
                 else {    // cut
                     float norm = 1.0f / (1.0f + std::sqrtf(2 * V) * K + V * K * K);
-                    m_a0 = (1.0f + std::sqrtf(2.0f) * K + K * K) * norm;
-                    m_a1 = 2.0f * (K * K - 1.0f) * norm;
-                    m_a2 = (1.0f - std::sqrtf(2.0f) * K + K * K) * norm;
-                    m_b1 = 2.0f * (V * K * K - 1.0f) * norm;
-                    m_b2 = (1.0f - std::sqrtf(2 * V) * K + V * K * K) * norm;
+                    c.m_a0 = (1.0f + std::sqrtf(2.0f) * K + K * K) * norm;
+                    c.m_a1 = 2.0f * (K * K - 1.0f) * norm;
+                    c.m_a2 = (1.0f - std::sqrtf(2.0f) * K + K * K) * norm;
+                    c.m_b1 = 2.0f * (V * K * K - 1.0f) * norm;
+                    c.m_b2 = (1.0f - std::sqrtf(2 * V) * K + V * K * K) * norm;
                 }
                 break;
             }
             case EType::e_highShelf: {
                 if (peakGain >= 0.0f) {    // boost
                     float norm = 1.0f / (1.0f + std::sqrtf(2.0f) * K + K * K);
-                    m_a0 = (V + std::sqrtf(2 * V) * K + K * K) * norm;
-                    m_a1 = 2.0f * (K * K - V) * norm;
-                    m_a2 = (V - std::sqrtf(2 * V) * K + K * K) * norm;
-                    m_b1 = 2.0f * (K * K - 1.0f) * norm;
-                    m_b2 = (1.0f - std::sqrtf(2.0f) * K + K * K) * norm;
+                    c.m_a0 = (V + std::sqrtf(2 * V) * K + K * K) * norm;
+                    c.m_a1 = 2.0f * (K * K - V) * norm;
+                    c.m_a2 = (V - std::sqrtf(2 * V) * K + K * K) * norm;
+                    c.m_b1 = 2.0f * (K * K - 1.0f) * norm;
+                    c.m_b2 = (1.0f - std::sqrtf(2.0f) * K + K * K) * norm;
                 }
                 else {    // cut
                     float norm = 1.0f / (V + std::sqrtf(2.0f * V) * K + K * K);
-                    m_a0 = (1.0f + std::sqrtf(2.0f) * K + K * K) * norm;
-                    m_a1 = 2.0f * (K * K - 1) * norm;
-                    m_a2 = (1.0f - std::sqrtf(2.0f) * K + K * K) * norm;
-                    m_b1 = 2.0f * (K * K - V) * norm;
-                    m_b2 = (V - std::sqrtf(2.0f * V) * K + K * K) * norm;
+                    c.m_a0 = (1.0f + std::sqrtf(2.0f) * K + K * K) * norm;
+                    c.m_a1 = 2.0f * (K * K - 1) * norm;
+                    c.m_a2 = (1.0f - std::sqrtf(2.0f) * K + K * K) * norm;
+                    c.m_b1 = 2.0f * (K * K - V) * norm;
+                    c.m_b2 = (V - std::sqrtf(2.0f * V) * K + K * K) * norm;
                 }
                 break;
             }
         }
+
+        return c;
     }
 
     float AddSample (float x) {
 
         // calculate the output value
         // y[n] = a0*x[n] + a1*x[n - 1] + a2*x[n - 2]  b1*y[n - 1]  b2*y[n - 2]
-        float y = m_a0*x + m_a1 * m_xn1 + m_a2*m_xn2 - m_b1*m_yn1 - m_b2*m_yn2;
+        const SCoefficients& c = m_coefficients;
+        float y = c.m_a0*x + c.m_a1 * m_xn1 + c.m_a2*m_xn2 - c.m_b1*m_yn1 - c.m_b2*m_yn2;
 
         // shift down previous input and output samples
         m_yn2 = m_yn1;
@@ -381,17 +496,29 @@ struct SBiQuad {
         m_xn2 = m_xn1;
         m_xn1 = x;
 
+        // move the coefficients along if we are ramping to new ones
+        if (m_rampSamplesLeft > 0) {
+            m_coefficients.m_a0 += m_coefficientsStep.m_a0;
+            m_coefficients.m_a1 += m_coefficientsStep.m_a1;
+            m_coefficients.m_a2 += m_coefficientsStep.m_a2;
+            m_coefficients.m_b1 += m_coefficientsStep.m_b1;
+            m_coefficients.m_b2 += m_coefficientsStep.m_b2;
+
+            // land exactly on the target at the end so error doesn't accumulate across ramps
+            if (--m_rampSamplesLeft == 0)
+                m_coefficients = m_coefficientsTarget;
+        }
+
         // return the output value
         return y;
     }
 
 private:
-    // biquad coefficients
-    float m_a0;
-    float m_a1;
-    float m_a2;
-    float m_b1;
-    float m_b2;
+    // biquad coefficients, and how they change per sample while ramping
+    SCoefficients   m_coefficients;
+    SCoefficients   m_coefficientsStep;
+    SCoefficients   m_coefficientsTarget;
+    size_t          m_rampSamplesLeft;
 
     // previous input samples
     float m_xn1;
@@ -401,3 +528,623 @@ private:
     float m_yn1;
     float m_yn2;
 };
+
+//--------------------------------------------------------------------------------------------------
+// Topology preserving (trapezoidal integrator) state variable filter, as described by Vadim Zavalishin
+// in "The Art of VA Filter Design" and Andrew Simper's "Solving the continuous SVF equations using
+// trapezoidal integration and equivalent currents".
+//
+// Unlike SBiQuad, this stays stable and doesn't zipper when the cutoff is swept quickly, since the
+// state is stored as integrator values instead of past inputs and outputs.  Changing the cutoff is
+// cheap (FastTan and a divide), so it's fine to do per sample, per voice.  Low pass, band pass,
+// high pass and notch outputs are all available at once.
+//
+struct SStateVariableFilter {
+
+    struct SOutput {
+        float m_lowPass;
+        float m_bandPass;
+        float m_highPass;
+        float m_notch;
+    };
+
+    SStateVariableFilter()
+        : m_k(1.0f)
+        , m_a1(0.0f)
+        , m_a2(0.0f)
+        , m_a3(0.0f)
+        , m_ic1eq(0.0f)
+        , m_ic2eq(0.0f) {}
+
+    void SetEffectParams (float cutoffFrequency, float sampleRate, float Q) {
+        m_k = 1.0f / Q;
+        SetCutoff(cutoffFrequency, sampleRate);
+    }
+
+    // doesn't touch the filter state, so can be called every sample to modulate the cutoff
+    void SetCutoff (float cutoffFrequency, float sampleRate) {
+        // keep the cutoff below nyquist, where tan() blows up
+        float maxCutoff = sampleRate * 0.45f;
+        if (cutoffFrequency > maxCutoff)
+            cutoffFrequency = maxCutoff;
+
+        float g = FastTan(c_pi * cutoffFrequency / sampleRate);
+        m_a1 = 1.0f / (1.0f + g * (g + m_k));
+        m_a2 = g * m_a1;
+        m_a3 = g * m_a2;
+    }
+
+    void ClearBuffer (void) {
+        m_ic1eq = 0.0f;
+        m_ic2eq = 0.0f;
+    }
+
+    SOutput AddSample (float sample) {
+
+        // solve for the band pass (v1) and low pass (v2) outputs
+        float v3 = sample - m_ic2eq;
+        float v1 = m_a1 * m_ic1eq + m_a2 * v3;
+        float v2 = m_ic2eq + m_a2 * m_ic1eq + m_a3 * v3;
+
+        // update the integrator states
+        m_ic1eq = 2.0f * v1 - m_ic1eq;
+        m_ic2eq = 2.0f * v2 - m_ic2eq;
+
+        // derive the other outputs from those
+        SOutput ret;
+        ret.m_lowPass = v2;
+        ret.m_bandPass = v1;
+        ret.m_highPass = sample - m_k * v1 - v2;
+        ret.m_notch = ret.m_lowPass + ret.m_highPass;
+        return ret;
+    }
+
+private:
+    // 1/Q
+    float m_k;
+
+    // coefficients derived from the cutoff
+    float m_a1;
+    float m_a2;
+    float m_a3;
+
+    // integrator states
+    float m_ic1eq;
+    float m_ic2eq;
+};
+
+//--------------------------------------------------------------------------------------------------
+// Polyphase half band FIR filter, for changing the sample rate by a factor of 2.
+// Every other tap of a half band filter is zero except the center tap which is 0.5, so only half of
+// the taps need to be evaluated, and those are done 4 at a time with SSE.
+//
+struct SHalfBandFilter {
+
+    // number of non zero taps, not counting the center tap.  Must be a multiple of 4 for SSE.
+    static const size_t c_numTaps = 16;
+
+    SHalfBandFilter() {
+
+        // Windowed sinc design.  The full filter is 2*c_numTaps-1 taps long, centered on the 0.5 tap,
+        // and we only keep the odd offsets from the center, since the even ones are all zero.
+        // The taps are stored oldest sample first, so they line up with the history window.
+        const float c_filterLength = float(2 * c_numTaps - 1);
+        float sum = 0.0f;
+        for (size_t i = 0; i < c_numTaps; ++i) {
+            float offset = float(2 * i) - c_filterLength * 0.5f + 0.5f;
+            float sinc = std::sinf(c_pi * offset * 0.5f) / (c_pi * offset);
+            float window = 0.42f + 0.5f * std::cosf(2.0f * c_pi * offset / (c_filterLength + 1.0f)) + 0.08f * std::cosf(4.0f * c_pi * offset / (c_filterLength + 1.0f));
+            m_taps[i] = sinc * window;
+            sum += m_taps[i];
+        }
+
+        // normalize so the side taps sum to 0.5, and the filter has unity gain at DC
+        for (size_t i = 0; i < c_numTaps; ++i)
+            m_taps[i] *= 0.5f / sum;
+
+        ClearBuffer();
+    }
+
+    void ClearBuffer (void) {
+        memset(m_history, 0, sizeof(m_history));
+        memset(m_centerHistory, 0, sizeof(m_centerHistory));
+        m_index = 0;
+    }
+
+    // one sample in, two samples out at twice the sample rate
+    void Upsample (float sample, float* out) {
+        m_index = (m_index + 1) % c_numTaps;
+        PushHistory(m_history, sample);
+
+        // zero stuffing doubles the number of samples, so it halves the volume.  The factor of 2
+        // on the side taps and the center tap of 0.5 being 1.0 makes up for that.
+        // the center tap lines up with the input sample half a filter length back
+        out[0] = 2.0f * DotProduct(&m_history[m_index + 1]);
+        out[1] = m_history[m_index + c_numTaps - (c_numTaps / 2 - 1)];
+    }
+
+    // two samples in at twice the sample rate, one sample out
+    float Downsample (const float* in) {
+        m_index = (m_index + 1) % c_numTaps;
+        PushHistory(m_history, in[0]);
+        PushHistory(m_centerHistory, in[1]);
+
+        // the center tap lines up with the odd sample half a filter length back
+        return DotProduct(&m_history[m_index + 1]) + 0.5f * m_centerHistory[m_index + c_numTaps - c_numTaps / 2];
+    }
+
+private:
+    // The history is written twice, c_numTaps apart, so that the last c_numTaps samples are always
+    // contiguous in memory, oldest first from m_index + 1, and can be read without wrapping.
+    void PushHistory (float* history, float sample) {
+        history[m_index] = sample;
+        history[m_index + c_numTaps] = sample;
+    }
+
+    float DotProduct (const float* history) const {
+        __m128 sum = _mm_setzero_ps();
+        for (size_t i = 0; i < c_numTaps; i += 4)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(&history[i]), _mm_loadu_ps(&m_taps[i])));
+
+        // add the 4 lanes together
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+        return _mm_cvtss_f32(sum);
+    }
+
+    float   m_taps[c_numTaps];
+    float   m_history[c_numTaps * 2];
+    float   m_centerHistory[c_numTaps * 2];
+    size_t  m_index;
+};
+
+//--------------------------------------------------------------------------------------------------
+// Distortion that runs at 1x, 2x, 4x or 8x the sample rate, so that the harmonics created by the
+// shaping don't alias back down into the audible range as badly.  Each factor of 2 is a half band
+// filter stage on the way up, and another on the way down.
+//
+struct SWaveShaperEffect {
+
+    enum class EShape {
+        e_hardClip,
+        e_tanh,
+        e_cubicSoftClip,
+        e_asymmetric,
+
+        e_count
+    };
+
+    static const size_t c_maxStages = 3;
+
+    SWaveShaperEffect()
+        : m_shape(EShape::e_hardClip)
+        , m_numStages(0) {}
+
+    // oversampling must be 1, 2, 4 or 8
+    void SetEffectParams (EShape shape, size_t oversampling) {
+        m_shape = shape;
+        m_numStages = 0;
+        while ((size_t(1) << m_numStages) < oversampling && m_numStages < c_maxStages)
+            ++m_numStages;
+
+        // a sample goes through an up and a down filter at each stage, and each stage's filters are
+        // half as long (in input samples) as the one before, so this covers all of them
+        m_tail.SetTailLength(m_numStages > 0 ? 4 * SHalfBandFilter::c_numTaps : 0);
+        ClearBuffer();
+    }
+
+    void ClearBuffer (void) {
+        for (size_t i = 0; i < c_maxStages; ++i) {
+            m_upsamplers[i].ClearBuffer();
+            m_downsamplers[i].ClearBuffer();
+        }
+        m_tail.Reset();
+    }
+
+    bool IsAsleep () const { return m_tail.IsAsleep(); }
+
+    float AddSample (float sample) {
+        // every shape maps silence to silence
+        if (m_tail.CanSkip(sample))
+            return 0.0f;
+        m_tail.AddSample(sample);
+
+        // upsample, shape and downsample through however many stages we have
+        return ProcessStage(sample, 0);
+    }
+
+    static const char* ShapeToString (EShape shape) {
+        switch (shape) {
+            case EShape::e_hardClip: return "Hard Clip";
+            case EShape::e_tanh: return "Tanh";
+            case EShape::e_cubicSoftClip: return "Cubic Soft Clip";
+            case EShape::e_asymmetric: return "Asymmetric";
+        }
+        return "???";
+    }
+
+private:
+    float ProcessStage (float sample, size_t stage) {
+        if (stage >= m_numStages)
+            return Shape(sample);
+
+        float upsampled[2];
+        m_upsamplers[stage].Upsample(sample, upsampled);
+        upsampled[0] = ProcessStage(upsampled[0], stage + 1);
+        upsampled[1] = ProcessStage(upsampled[1], stage + 1);
+        return m_downsamplers[stage].Downsample(upsampled);
+    }
+
+    float Shape (float sample) const {
+        switch (m_shape) {
+            case EShape::e_hardClip: {
+                if (sample > 1.0f)
+                    return 1.0f;
+                else if (sample < -1.0f)
+                    return -1.0f;
+                return sample;
+            }
+            case EShape::e_tanh: {
+                return std::tanh(sample);
+            }
+            case EShape::e_cubicSoftClip: {
+                if (sample > 1.0f)
+                    return 1.0f;
+                else if (sample < -1.0f)
+                    return -1.0f;
+                return 1.5f * sample - 0.5f * sample * sample * sample;
+            }
+            case EShape::e_asymmetric: {
+                // biasing the tanh curve makes the positive and negative halves clip differently,
+                // which adds even harmonics.  Subtract the bias back out so silence stays silent.
+                const float c_bias = 0.3f;
+                return std::tanh(sample + c_bias) - std::tanh(c_bias);
+            }
+        }
+        return sample;
+    }
+
+    EShape          m_shape;
+    size_t          m_numStages;
+    SHalfBandFilter m_upsamplers[c_maxStages];
+    SHalfBandFilter m_downsamplers[c_maxStages];
+    STailTracker    m_tail;
+};
+
+//--------------------------------------------------------------------------------------------------
+// Look ahead brickwall limiter.  Works a frame at a time across the planar channel buffers, so that
+// all channels get the same gain and the stereo image doesn't shift.
+//
+// The audio is delayed by the look ahead time, so that the gain can already be turned down by the
+// time a peak comes out.  The loudest peak over the window is tracked with a monotonic deque, which
+// makes the cost per sample the same no matter how long the look ahead is.  Peaks between samples
+// (true peaks) are estimated by interpolating between the last few samples.
+//
+struct SLimiterEffect {
+
+    // the true peak estimate looks at the last 4 samples, and finds peaks between the middle two
+    static const size_t c_truePeakLatency = 2;
+
+    SLimiterEffect()
+        : m_delayBuffer(nullptr)
+        , m_peakHistory(nullptr)
+        , m_holdValues(nullptr)
+        , m_holdTimes(nullptr)
+        , m_boxBuffer(nullptr)
+        , m_numChannels(0)
+        , m_sampleRate(0.0f)
+        , m_maxLookAhead(0)
+        , m_lookAhead(0)
+        , m_delay(0)
+        , m_holdLength(0)
+        , m_ceiling(1.0f)
+        , m_releaseCoefficient(0.0f) {}
+
+    // Allocates the buffers for the longest look ahead, and starts out using it.  SetLookAhead can
+    // then change it without allocating.
+    void SetEffectParams (float sampleRate, size_t numChannels, float maxLookAheadSeconds, float releaseSeconds, float ceilingdB) {
+
+        m_numChannels = numChannels;
+        m_sampleRate = sampleRate;
+        m_maxLookAhead = LookAheadSamples(maxLookAheadSeconds);
+
+        m_ceiling = dBToAmplitude(ceilingdB);
+        m_releaseCoefficient = std::expf(-1.0f / (releaseSeconds * sampleRate));
+
+        // the delay and the hold window are at most this long
+        size_t maxDelay = m_maxLookAhead + c_truePeakLatency;
+        CEngineMemory::Free(m_delayBuffer);
+        CEngineMemory::Free(m_peakHistory);
+        CEngineMemory::Free(m_holdValues);
+        CEngineMemory::Free(m_holdTimes);
+        CEngineMemory::Free(m_boxBuffer);
+        m_delayBuffer = CEngineMemory::Allocate<float>(maxDelay * m_numChannels);
+        m_peakHistory = CEngineMemory::Allocate<float>((c_truePeakLatency + 1) * m_numChannels);
+        m_holdValues = CEngineMemory::Allocate<float>(maxDelay + 1);
+        m_holdTimes = CEngineMemory::Allocate<size_t>(maxDelay + 1);
+        m_boxBuffer = CEngineMemory::Allocate<float>(m_maxLookAhead);
+
+        SetLookAhead(maxLookAheadSeconds);
+    }
+
+    // Changes the look ahead, up to the one given to SetEffectParams, and clears the limiter out.
+    // Doesn't allocate, so it's safe on the audio thread.
+    void SetLookAhead (float lookAheadSeconds) {
+        m_lookAhead = LookAheadSamples(lookAheadSeconds);
+        if (m_lookAhead > m_maxLookAhead)
+            m_lookAhead = m_maxLookAhead;
+
+        // we need to hold a peak for as long as the samples that caused it are in the delay buffer
+        m_delay = m_lookAhead + c_truePeakLatency;
+        m_holdLength = m_delay + 1;
+
+        // the delay line has to flush, and then the gain smoothing has to fill back up with 1s
+        m_tail.SetTailLength(m_delay + m_lookAhead);
+        ClearBuffer();
+    }
+
+    void ClearBuffer (void) {
+        memset(m_delayBuffer, 0, sizeof(float)*m_delay*m_numChannels);
+        memset(m_peakHistory, 0, sizeof(float)*(c_truePeakLatency + 1)*m_numChannels);
+        for (size_t i = 0; i < m_lookAhead; ++i)
+            m_boxBuffer[i] = 1.0f;
+        m_boxSum = double(m_lookAhead);
+        m_boxIndex = 0;
+        m_delayIndex = 0;
+        m_holdStart = 0;
+        m_holdCount = 0;
+        m_time = 0;
+        m_releaseGain = 1.0f;
+        m_tail.Reset();
+    }
+
+    bool IsAsleep () const { return m_tail.IsAsleep(); }
+
+    // latency added to the audio, in frames
+    size_t GetLatency () const { return m_delay; }
+
+    // processes one frame in place: sample number frame, in each of m_numChannels planar buffers
+    void AddFrame (float* const* channels, size_t frame) {
+
+        // nothing in, nothing left in the delay line, and the gain is all the way back up
+        if (m_tail.IsAsleep()) {
+            bool silent = true;
+            for (size_t channel = 0; channel < m_numChannels; ++channel)
+                silent = silent && IsSilentSample(channels[channel][frame]);
+            if (silent) {
+                for (size_t channel = 0; channel < m_numChannels; ++channel)
+                    channels[channel][frame] = 0.0f;
+                return;
+            }
+        }
+
+        // find the loudest (true) peak across all channels for this frame
+        float peak = 0.0f;
+        for (size_t channel = 0; channel < m_numChannels; ++channel) {
+            float channelPeak = TruePeak(&m_peakHistory[channel * (c_truePeakLatency + 1)], channels[channel][frame]);
+            if (channelPeak > peak)
+                peak = channelPeak;
+        }
+
+        // while the gain is still recovering, the limiter isn't done, even if the input is silent
+        m_tail.AddSample(m_releaseGain < 1.0f ? 1.0f : peak);
+
+        // find the loudest peak in the window, and the gain needed to bring it down to the ceiling
+        float windowPeak = PushHold(peak);
+        float targetGain = windowPeak > m_ceiling ? m_ceiling / windowPeak : 1.0f;
+
+        // turn the gain down right away, but release it back up slowly
+        if (targetGain < m_releaseGain)
+            m_releaseGain = targetGain;
+        else
+            m_releaseGain = targetGain + (m_releaseGain - targetGain) * m_releaseCoefficient;
+
+        // smooth the gain with a box filter as long as the look ahead, so that the gain ramps down
+        // over the look ahead time, and is fully down by the time the peak comes out.
+        m_boxSum += double(m_releaseGain) - double(m_boxBuffer[m_boxIndex]);
+        m_boxBuffer[m_boxIndex] = m_releaseGain;
+        m_boxIndex = (m_boxIndex + 1) % m_lookAhead;
+        float gain = float(m_boxSum / double(m_lookAhead));
+
+        // swap the new frame into the delay buffer, and output the delayed frame with the gain applied
+        float* delayed = &m_delayBuffer[m_delayIndex * m_numChannels];
+        for (size_t channel = 0; channel < m_numChannels; ++channel) {
+            float out = delayed[channel] * gain;
+            delayed[channel] = channels[channel][frame];
+            channels[channel][frame] = out;
+        }
+        m_delayIndex = (m_delayIndex + 1) % m_delay;
+        ++m_time;
+    }
+
+    ~SLimiterEffect() {
+        CEngineMemory::Free(m_delayBuffer);
+        CEngineMemory::Free(m_peakHistory);
+        CEngineMemory::Free(m_holdValues);
+        CEngineMemory::Free(m_holdTimes);
+        CEngineMemory::Free(m_boxBuffer);
+    }
+
+private:
+    size_t LookAheadSamples (float lookAheadSeconds) const {
+        size_t lookAhead = size_t(lookAheadSeconds * m_sampleRate);
+        return lookAhead < 1 ? 1 : lookAhead;
+    }
+
+    float TruePeak (float* history, float sample) {
+
+        // estimate the peaks between the middle two samples of the last four
+        float peak = std::fabs(sample);
+        for (int i = 1; i < 4; ++i) {
+            float value = std::fabs(CubicHermite(history[0], history[1], history[2], sample, float(i) * 0.25f));
+            if (value > peak)
+                peak = value;
+        }
+
+        // shift the history down
+        history[0] = history[1];
+        history[1] = history[2];
+        history[2] = sample;
+        return peak;
+    }
+
+    // Adds a peak to the monotonic deque and returns the largest peak of the last m_holdLength.
+    // Values are kept in decreasing order, so anything smaller than the new value can never be the
+    // max again and gets dropped off the back.  Each value goes in and out once, so this is O(1).
+    float PushHold (float peak) {
+
+        // drop smaller values off the back
+        while (m_holdCount > 0 && m_holdValues[(m_holdStart + m_holdCount - 1) % m_holdLength] <= peak)
+            --m_holdCount;
+
+        // add the new value to the back
+        size_t back = (m_holdStart + m_holdCount) % m_holdLength;
+        m_holdValues[back] = peak;
+        m_holdTimes[back] = m_time;
+        ++m_holdCount;
+
+        // drop values that have left the window off the front
+        while (m_holdTimes[m_holdStart] + m_holdLength <= m_time) {
+            m_holdStart = (m_holdStart + 1) % m_holdLength;
+            --m_holdCount;
+        }
+
+        return m_holdValues[m_holdStart];
+    }
+
+    float*  m_delayBuffer;
+    float*  m_peakHistory;
+    float*  m_holdValues;
+    size_t* m_holdTimes;
+    float*  m_boxBuffer;
+
+    size_t  m_numChannels;
+    float   m_sampleRate;
+    size_t  m_maxLookAhead;
+    size_t  m_lookAhead;
+    size_t  m_delay;
+    size_t  m_holdLength;
+    float   m_ceiling;
+    float   m_releaseCoefficient;
+
+    double  m_boxSum;
+    size_t  m_boxIndex;
+    size_t  m_delayIndex;
+    size_t  m_holdStart;
+    size_t  m_holdCount;
+    size_t  m_time;
+    float   m_releaseGain;
+
+    STailTracker    m_tail;
+};
+
+//--------------------------------------------------------------------------------------------------
+// Compressor with a sidechain (key) input.  The level of the key signal decides how much the main
+// signal gets turned down, so passing the signal itself as the key makes a regular compressor, and
+// passing a bus of drums as the key makes the music duck out of the way of the drums.
+// Any number of sources can be mixed into the key bus, it costs the same.
+//
+struct SCompressorEffect {
+
+    enum class EDetector {
+        e_peak,
+        e_rms
+    };
+
+    SCompressorEffect()
+        : m_detector(EDetector::e_peak)
+        , m_threshold(0.0f)
+        , m_ratio(1.0f)
+        , m_knee(0.0f)
+        , m_makeup(0.0f)
+        , m_attackCoefficient(0.0f)
+        , m_releaseCoefficient(0.0f)
+        , m_rmsCoefficient(0.0f)
+        , m_meanSquare(0.0f)
+        , m_gainReduction(0.0f) {}
+
+    void SetEffectParams (float sampleRate, EDetector detector, float thresholddB, float ratio, float kneedB, float attackSeconds, float releaseSeconds, float makeupdB) {
+        m_detector = detector;
+        m_threshold = thresholddB;
+        m_ratio = ratio;
+        m_knee = kneedB;
+        m_makeup = makeupdB;
+        m_attackCoefficient = std::expf(-1.0f / (attackSeconds * sampleRate));
+        m_releaseCoefficient = std::expf(-1.0f / (releaseSeconds * sampleRate));
+
+        // rms is averaged over 10ms
+        m_rmsCoefficient = std::expf(-1.0f / (0.01f * sampleRate));
+
+        ClearBuffer();
+    }
+
+    void ClearBuffer (void) {
+        m_meanSquare = 0.0f;
+        m_gainReduction = 0.0f;
+    }
+
+    // Compresses buffer in place, based on the level of key.  Both are mono and numSamples long.
+    void ProcessBuffer (float* buffer, const float* key, size_t numSamples) {
+        for (size_t i = 0; i < numSamples; ++i) {
+
+            // detect the level of the key signal
+            float level = 0.0f;
+            switch (m_detector) {
+                case EDetector::e_peak: {
+                    level = std::fabs(key[i]);
+                    break;
+                }
+                case EDetector::e_rms: {
+                    m_meanSquare = key[i] * key[i] + (m_meanSquare - key[i] * key[i]) * m_rmsCoefficient;
+                    level = std::sqrtf(m_meanSquare);
+                    break;
+                }
+            }
+
+            // figure out how much gain reduction we want, and move towards it at the attack or
+            // release speed
+            float targetGainReduction = GainReduction(AmplitudeTodB(level + 1e-9f));
+            if (targetGainReduction < m_gainReduction)
+                m_gainReduction = targetGainReduction + (m_gainReduction - targetGainReduction) * m_attackCoefficient;
+            else
+                m_gainReduction = targetGainReduction + (m_gainReduction - targetGainReduction) * m_releaseCoefficient;
+
+            buffer[i] *= dBToAmplitude(m_gainReduction + m_makeup);
+        }
+    }
+
+    // how much the signal is currently being turned down, in dB
+    float GetGainReductiondB () const { return m_gainReduction; }
+
+private:
+    // static gain curve with a soft knee, returns a value <= 0 in dB
+    float GainReduction (float leveldB) const {
+        float over = leveldB - m_threshold;
+        float slope = 1.0f / m_ratio - 1.0f;
+
+        // below the knee, nothing happens
+        if (2.0f * over < -m_knee)
+            return 0.0f;
+
+        // inside the knee, ease into the ratio with a quadratic
+        if (m_knee > 0.0f && 2.0f * std::fabs(over) <= m_knee) {
+            float kneeOver = over + m_knee * 0.5f;
+            return slope * kneeOver * kneeOver / (2.0f * m_knee);
+        }
+
+        // above the knee, apply the full ratio
+        return slope * over;
+    }
+
+    EDetector   m_detector;
+    float       m_threshold;
+    float       m_ratio;
+    float       m_knee;
+    float       m_makeup;
+    float       m_attackCoefficient;
+    float       m_releaseCoefficient;
+    float       m_rmsCoefficient;
+
+    float       m_meanSquare;
+    float       m_gainReduction;
+};
@@ -0,0 +1,280 @@
+//--------------------------------------------------------------------------------------------------
+// AudioGraph.cpp
+//
+// A graph of audio nodes (sources, effects, buses and the master output) connected by sends.
+//
+//--------------------------------------------------------------------------------------------------
+
+#include "AudioGraph.h"
+#include <algorithm>
+#include <string.h>
+
+//--------------------------------------------------------------------------------------------------
+CAudioGraph::CAudioGraph () {
+    // node 0 is always the master output
+    AddNode(ENodeType::e_master, nullptr);
+}
+
+//--------------------------------------------------------------------------------------------------
+CAudioGraph::TNodeId CAudioGraph::AddNode (ENodeType type, const TAudioNodeProcess& process) {
+    SNode node;
+    node.m_type = type;
+    node.m_process = process;
+    m_nodes.push_back(node);
+    return m_nodes.size() - 1;
+}
+
+//--------------------------------------------------------------------------------------------------
+void CAudioGraph::Connect (TNodeId from, TNodeId to, float gain) {
+    SConnection connection;
+    connection.m_from = from;
+    connection.m_to = to;
+    connection.m_gain = gain;
+    m_connections.push_back(connection);
+}
+
+//--------------------------------------------------------------------------------------------------
+CCompiledAudioGraph* CAudioGraph::Compile (size_t maxFramesPerBuffer) const {
+
+    const size_t numNodes = m_nodes.size();
+
+    // count how many inputs each node is waiting on
+    std::vector<size_t> numPendingInputs(numNodes, 0);
+    for (const SConnection& connection : m_connections)
+        ++numPendingInputs[connection.m_to];
+
+    // Kahn's algorithm: repeatedly take a node that has all of its inputs ready
+    std::vector<TNodeId> order;
+    order.reserve(numNodes);
+    for (TNodeId node = 0; node < numNodes; ++node) {
+        if (numPendingInputs[node] == 0)
+            order.push_back(node);
+    }
+    for (size_t index = 0; index < order.size(); ++index) {
+        for (const SConnection& connection : m_connections) {
+            if (connection.m_from == order[index] && --numPendingInputs[connection.m_to] == 0)
+                order.push_back(connection.m_to);
+        }
+    }
+
+    // if not every node made it into the order, there's a cycle
+    if (order.size() != numNodes)
+        return nullptr;
+
+    // Group the nodes into levels, where a node's level is one more than its deepest input.  Nodes
+    // in the same level don't depend on each other, so they can run at the same time.
+    std::vector<size_t> level(numNodes, 0);
+    for (TNodeId node : order) {
+        for (const SConnection& connection : m_connections) {
+            if (connection.m_from == node)
+                level[connection.m_to] = std::max(level[connection.m_to], level[node] + 1);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&level](TNodeId a, TNodeId b) { return level[a] < level[b]; });
+
+    // figure out the last step that reads from each node's buffer, so the buffer can be re-used after
+    std::vector<size_t> orderPosition(numNodes);
+    for (size_t index = 0; index < numNodes; ++index)
+        orderPosition[order[index]] = index;
+    std::vector<size_t> lastRead(numNodes);
+    for (TNodeId node = 0; node < numNodes; ++node)
+        lastRead[node] = orderPosition[node];
+    for (const SConnection& connection : m_connections)
+        lastRead[connection.m_from] = std::max(lastRead[connection.m_from], orderPosition[connection.m_to]);
+
+    // build the steps, assigning buffers as we go
+    CCompiledAudioGraph* graph = new CCompiledAudioGraph;
+    graph->m_maxFramesPerBuffer = maxFramesPerBuffer;
+    graph->m_masterBuffer = 0;
+    std::vector<size_t> nodeBuffer(numNodes);
+    std::vector<size_t> freeBuffers;
+    std::vector<size_t> freedThisLevel;
+    size_t numBuffers = 0;
+    size_t levelStart = 0;
+    for (size_t index = 0; index < numNodes; ++index) {
+        TNodeId node = order[index];
+
+        // Buffers freed in a level only become free at the start of the next one.  Otherwise a node
+        // could write to a buffer that another node in the same level is still reading from.
+        if (index > 0 && level[node] != level[order[index - 1]]) {
+            freeBuffers.insert(freeBuffers.end(), freedThisLevel.begin(), freedThisLevel.end());
+            freedThisLevel.clear();
+            levelStart = index;
+        }
+
+        // grab a free buffer, or make a new one if there are none
+        if (!freeBuffers.empty()) {
+            nodeBuffer[node] = freeBuffers.back();
+            freeBuffers.pop_back();
+        }
+        else {
+            nodeBuffer[node] = numBuffers++;
+        }
+
+        CCompiledAudioGraph::SStep step;
+        step.m_buffer = nodeBuffer[node];
+        step.m_firstInput = graph->m_inputs.size();
+        step.m_numInputs = 0;
+        step.m_process = m_nodes[node].m_process;
+
+        // gather up the inputs, and free any buffers this is the last reader of.  The output buffer
+        // was already taken above, so it never aliases an input.
+        for (const SConnection& connection : m_connections) {
+            if (connection.m_to != node)
+                continue;
+
+            CCompiledAudioGraph::SInput input;
+            input.m_buffer = nodeBuffer[connection.m_from];
+            input.m_gain = connection.m_gain;
+            graph->m_inputs.push_back(input);
+            ++step.m_numInputs;
+
+            if (lastRead[connection.m_from] == index && std::find(freedThisLevel.begin(), freedThisLevel.end(), input.m_buffer) == freedThisLevel.end())
+                freedThisLevel.push_back(input.m_buffer);
+        }
+
+        // nodes that nothing reads from can give their buffer right back, except the master
+        if (node != GetMaster() && lastRead[node] == index)
+            freedThisLevel.push_back(nodeBuffer[node]);
+
+        if (node == GetMaster())
+            graph->m_masterBuffer = nodeBuffer[node];
+
+        graph->m_steps.push_back(step);
+        graph->m_stepWaitFor.push_back(levelStart);
+    }
+
+    graph->m_buffers.resize(numBuffers * maxFramesPerBuffer, 0.0f);
+    graph->m_bufferSilent.resize(numBuffers, 1);
+    return graph;
+}
+
+//--------------------------------------------------------------------------------------------------
+void CCompiledAudioGraph::RunStep (size_t index, size_t numFrames, float sampleRate) {
+    const SStep& step = m_steps[index];
+
+    // mix the inputs into this node's buffer, skipping the silent ones
+    float* buffer = &m_buffers[step.m_buffer * m_maxFramesPerBuffer];
+    memset(buffer, 0, sizeof(float) * numFrames);
+    bool silent = true;
+    for (size_t inputIndex = 0; inputIndex < step.m_numInputs; ++inputIndex) {
+        const SInput& input = m_inputs[step.m_firstInput + inputIndex];
+        if (m_bufferSilent[input.m_buffer])
+            continue;
+        const float* inputBuffer = &m_buffers[input.m_buffer * m_maxFramesPerBuffer];
+        for (size_t sample = 0; sample < numFrames; ++sample)
+            buffer[sample] += inputBuffer[sample] * input.m_gain;
+        silent = false;
+    }
+
+    // let the node do its thing
+    if (step.m_process)
+        silent = step.m_process(buffer, numFrames, sampleRate, silent);
+    m_bufferSilent[step.m_buffer] = silent;
+}
+
+//--------------------------------------------------------------------------------------------------
+bool CCompiledAudioGraph::GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, float sampleRate, CAudioWorkerPool* workerPool) {
+
+    struct SContext {
+        CCompiledAudioGraph*    m_graph;
+        size_t                  m_numFrames;
+        float                   m_sampleRate;
+    };
+
+    // process in chunks no larger than our buffers
+    bool silent = true;
+    while (framesPerBuffer > 0) {
+        size_t numFrames = std::min(framesPerBuffer, m_maxFramesPerBuffer);
+
+        if (workerPool && workerPool->GetNumWorkers() > 0) {
+            // fan each level out to the workers, which all finish before the master output is read
+            SContext context = { this, numFrames, sampleRate };
+            SAudioWorkerJob job;
+            job.m_function = [] (void* context, size_t index) {
+                SContext& c = *(SContext*)context;
+                c.m_graph->RunStep(index, c.m_numFrames, c.m_sampleRate);
+            };
+            job.m_context = &context;
+            job.m_count = m_steps.size();
+            job.m_waitFor = m_stepWaitFor.data();
+            workerPool->Run(job);
+        }
+        else {
+            for (size_t index = 0; index < m_steps.size(); ++index)
+                RunStep(index, numFrames, sampleRate);
+        }
+
+        // copy the master output to the output
+        const float* master = &m_buffers[m_masterBuffer * m_maxFramesPerBuffer];
+        memcpy(outputBuffer, master, sizeof(float) * numFrames);
+        silent = silent && m_bufferSilent[m_masterBuffer];
+
+        outputBuffer += numFrames;
+        framesPerBuffer -= numFrames;
+    }
+    return silent;
+}
+
+// a plain pointer, so it's already null when players are constructed during static construction
+CAudioGraphPlayer* CAudioGraphPlayer::s_firstPlayer = nullptr;
+
+//--------------------------------------------------------------------------------------------------
+CAudioGraphPlayer::CAudioGraphPlayer ()
+    : m_pending(nullptr)
+    , m_retired(nullptr)
+    , m_current(nullptr)
+    , m_workerPool(nullptr)
+    , m_nextPlayer(s_firstPlayer) {
+    s_firstPlayer = this;
+}
+
+//--------------------------------------------------------------------------------------------------
+CAudioGraphPlayer::~CAudioGraphPlayer () {
+    CAudioGraphPlayer** link = &s_firstPlayer;
+    while (*link != this)
+        link = &(*link)->m_nextPlayer;
+    *link = m_nextPlayer;
+
+    delete m_pending.exchange(nullptr);
+    delete m_retired.exchange(nullptr);
+    delete m_current;
+}
+
+//--------------------------------------------------------------------------------------------------
+void CAudioGraphPlayer::SetGraph (CCompiledAudioGraph* graph) {
+    CollectGarbage();
+
+    // if the audio thread never picked up the last pending graph, it's safe to delete it here
+    delete m_pending.exchange(graph);
+}
+
+//--------------------------------------------------------------------------------------------------
+void CAudioGraphPlayer::CollectGarbage () {
+    delete m_retired.exchange(nullptr);
+}
+
+//--------------------------------------------------------------------------------------------------
+void CAudioGraphPlayer::CollectAllGarbage () {
+    for (CAudioGraphPlayer* player = s_firstPlayer; player != nullptr; player = player->m_nextPlayer)
+        player->CollectGarbage();
+}
+
+//--------------------------------------------------------------------------------------------------
+bool CAudioGraphPlayer::GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, float sampleRate) {
+
+    // Swap in a new graph if there is one.  Only do it when the main thread has freed the last graph
+    // we swapped out, since there's only room to hand back one at a time.
+    if (m_retired.load() == nullptr) {
+        CCompiledAudioGraph* pending = m_pending.exchange(nullptr);
+        if (pending) {
+            m_retired.store(m_current);
+            m_current = pending;
+        }
+    }
+
+    if (!m_current)
+        return false;
+
+    return !m_current->GenerateAudioSamples(outputBuffer, framesPerBuffer, sampleRate, m_workerPool);
+}
@@ -0,0 +1,142 @@
+//--------------------------------------------------------------------------------------------------
+// AudioGraph.h
+//
+// A graph of audio nodes (sources, effects, buses and the master output) connected by sends.
+// The graph is built and compiled on the main thread into a flat list of steps in dependency order,
+// with all of the buffers allocated up front.  The audio thread just runs the steps in order, and
+// new graphs are swapped in without locking.  Given a worker pool, steps that don't depend on each
+// other (like separate voice groups or effect branches) are run on multiple cores.
+//
+//--------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <atomic>
+#include "AudioWorkerPool.h"
+
+// Processes a node's mono buffer in place.  Inputs have already been mixed into the buffer, so
+// sources add to it, and effects modify it.  silent is true if all of the inputs were silent, which
+// leaves the buffer all zeros.  Returns whether the buffer is silent afterwards, so nodes that only
+// have silence coming in, and nothing left to ring out, can skip their work.
+typedef std::function<bool(float *buffer, size_t framesPerBuffer, float sampleRate, bool silent)> TAudioNodeProcess;
+
+class CCompiledAudioGraph;
+
+//--------------------------------------------------------------------------------------------------
+class CAudioGraph {
+public:
+    typedef size_t TNodeId;
+
+    enum class ENodeType {
+        e_master,
+        e_source,
+        e_effect,
+        e_bus
+    };
+
+    CAudioGraph ();
+
+    TNodeId AddSource (const TAudioNodeProcess& process) { return AddNode(ENodeType::e_source, process); }
+    TNodeId AddEffect (const TAudioNodeProcess& process) { return AddNode(ENodeType::e_effect, process); }
+    TNodeId AddBus () { return AddNode(ENodeType::e_bus, nullptr); }
+    TNodeId GetMaster () const { return 0; }
+
+    // mixes the output of one node into the input of another.  A gain other than 1 makes it a send.
+    void Connect (TNodeId from, TNodeId to, float gain = 1.0f);
+
+    // Sorts the nodes into levels so every node runs after its inputs, and assigns buffers, re-using
+    // them once nothing else reads from them.  Returns nullptr if the graph has a cycle.
+    // Buffers larger than maxFramesPerBuffer are processed in multiple passes.
+    CCompiledAudioGraph* Compile (size_t maxFramesPerBuffer) const;
+
+private:
+    TNodeId AddNode (ENodeType type, const TAudioNodeProcess& process);
+
+    struct SNode {
+        ENodeType           m_type;
+        TAudioNodeProcess   m_process;
+    };
+
+    struct SConnection {
+        TNodeId m_from;
+        TNodeId m_to;
+        float   m_gain;
+    };
+
+    std::vector<SNode>          m_nodes;
+    std::vector<SConnection>    m_connections;
+};
+
+//--------------------------------------------------------------------------------------------------
+class CCompiledAudioGraph {
+public:
+    // Renders the graph and copies the master output to the mono output buffer.  If a worker pool is
+    // given, the nodes in each level are split across its threads.  Returns whether the output is
+    // silent.
+    bool GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, float sampleRate, CAudioWorkerPool* workerPool = nullptr);
+
+private:
+    friend class CAudioGraph;
+
+    void RunStep (size_t index, size_t numFrames, float sampleRate);
+
+    struct SInput {
+        size_t  m_buffer;
+        float   m_gain;
+    };
+
+    struct SStep {
+        size_t              m_buffer;
+        size_t              m_firstInput;
+        size_t              m_numInputs;
+        TAudioNodeProcess   m_process;
+    };
+
+    std::vector<SStep>  m_steps;
+    std::vector<size_t> m_stepWaitFor;  // for each step, the index of the first step in its level
+    std::vector<SInput> m_inputs;
+    std::vector<float>  m_buffers;
+    std::vector<char>   m_bufferSilent; // for each buffer, whether the step that last wrote it was silent
+    size_t              m_maxFramesPerBuffer;
+    size_t              m_masterBuffer;
+};
+
+//--------------------------------------------------------------------------------------------------
+// Hands compiled graphs from the main thread to the audio thread, and old ones back again to be
+// deleted, so the audio thread never allocates, frees or waits on a lock.
+class CAudioGraphPlayer {
+public:
+    CAudioGraphPlayer ();
+
+    // only call when the audio thread is no longer calling GenerateAudioSamples
+    ~CAudioGraphPlayer ();
+
+    // Main thread.  Takes ownership of the graph, which starts playing at the next audio callback.
+    void SetGraph (CCompiledAudioGraph* graph);
+
+    // Main thread, before the audio thread starts.  Runs graphs on this pool, if not null.
+    void SetWorkerPool (CAudioWorkerPool* workerPool) { m_workerPool = workerPool; }
+
+    // Main thread.  Frees the graph the audio thread has swapped out, if there is one.
+    void CollectGarbage ();
+
+    // Main thread.  CollectGarbage() on every player, so swapped out graphs don't stay around until
+    // the next time a graph is set.  Called by CDemoMgr::Update().
+    static void CollectAllGarbage ();
+
+    // Audio thread.  Returns false if the output is silent.  If there is no graph yet, that leaves the
+    // buffer alone.
+    bool GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, float sampleRate);
+
+private:
+    std::atomic<CCompiledAudioGraph*>   m_pending;  // written by main thread, taken by audio thread
+    std::atomic<CCompiledAudioGraph*>   m_retired;  // written by audio thread, taken by main thread
+    CCompiledAudioGraph*                m_current;  // only touched by the audio thread
+    CAudioWorkerPool*                   m_workerPool;
+
+    // every player that exists, for CollectAllGarbage().  Players are made and destroyed on the main
+    // thread, or during static construction and destruction.
+    CAudioGraphPlayer*                  m_nextPlayer;
+    static CAudioGraphPlayer*           s_firstPlayer;
+};
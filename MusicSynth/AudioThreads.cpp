@@ -0,0 +1,166 @@
+//--------------------------------------------------------------------------------------------------
+// AudioThreads.cpp
+//
+// Scheduling for the audio thread and the audio workers
+//
+//--------------------------------------------------------------------------------------------------
+
+#include "AudioThreads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <Windows.h> // for thread affinity and priority
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#endif
+
+int                             CAudioThreads::s_priority = 0;
+bool                            CAudioThreads::s_roundRobin = false;
+std::vector<size_t>             CAudioThreads::s_cores;
+std::thread::id                 CAudioThreads::s_audioThreadId;
+CAudioThreads::SThreadResult    CAudioThreads::s_results[c_maxThreads];
+std::atomic<bool>               CAudioThreads::s_resultReady[c_maxThreads];
+
+//--------------------------------------------------------------------------------------------------
+bool CAudioThreads::SetCores (const char* coreList) {
+    size_t numCores = std::thread::hardware_concurrency();
+    std::vector<size_t> cores;
+    const char* next = coreList;
+    while (true) {
+        char* end;
+        long core = strtol(next, &end, 10);
+        if (end == next || core < 0 || (numCores > 0 && size_t(core) >= numCores) || size_t(core) >= sizeof(size_t) * 8) {
+            printf("Cores must be a comma separated list of numbers from 0 to %i\n", int(numCores) - 1);
+            return false;
+        }
+        cores.push_back(size_t(core));
+        if (*end == '\0')
+            break;
+        if (*end != ',') {
+            printf("Cores must be a comma separated list of numbers from 0 to %i\n", int(numCores) - 1);
+            return false;
+        }
+        next = end + 1;
+    }
+    s_cores = cores;
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+void CAudioThreads::OnWorkerStart (size_t workerIndex, size_t defaultCore) {
+    size_t numWorkerCores = GetNumWorkerCores();
+    size_t core = numWorkerCores > 0 ? s_cores[1 + workerIndex % numWorkerCores] : defaultCore;
+    SetupThread(1 + workerIndex, int(core));
+}
+
+//--------------------------------------------------------------------------------------------------
+void CAudioThreads::SetupThread (size_t index, int core) {
+    SThreadResult result;
+    result.m_core = -1;
+    result.m_schedError = 0;
+    result.m_coreError = 0;
+
+#ifdef _WIN32
+    // the workers were always time critical, the audio thread only is if asked for
+    HANDLE thread = GetCurrentThread();
+    if (index > 0 || s_priority > 0) {
+        if (!SetThreadPriority(thread, THREAD_PRIORITY_TIME_CRITICAL))
+            result.m_schedError = int(GetLastError());
+    }
+    result.m_policy = 0;
+    result.m_priority = GetThreadPriority(thread);
+
+    if (core >= 0) {
+        if (SetThreadAffinityMask(thread, DWORD_PTR(1) << core))
+            result.m_core = core;
+        else
+            result.m_coreError = int(GetLastError());
+    }
+#else
+    pthread_t thread = pthread_self();
+    if (s_priority > 0) {
+        int policy = s_roundRobin ? SCHED_RR : SCHED_FIFO;
+        sched_param param;
+        param.sched_priority = s_priority;
+        if (param.sched_priority > sched_get_priority_max(policy))
+            param.sched_priority = sched_get_priority_max(policy);
+        int error = pthread_setschedparam(thread, policy, &param);
+
+        // without CAP_SYS_NICE, a thread can still go as high as the rtprio limit, if there is one
+        rlimit limit;
+        if (error == EPERM && getrlimit(RLIMIT_RTPRIO, &limit) == 0 && limit.rlim_cur > 0) {
+            if (rlim_t(param.sched_priority) > limit.rlim_cur)
+                param.sched_priority = int(limit.rlim_cur);
+            if (pthread_setschedparam(thread, policy, &param) == 0)
+                error = 0;
+        }
+        result.m_schedError = error;
+    }
+
+    // report what the thread really got, which is the normal scheduling if the above failed
+    sched_param param;
+    if (pthread_getschedparam(thread, &result.m_policy, &param) == 0) {
+        result.m_priority = param.sched_priority;
+    }
+    else {
+        result.m_policy = SCHED_OTHER;
+        result.m_priority = 0;
+    }
+
+    if (core >= 0) {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(core, &cpuSet);
+        int error = pthread_setaffinity_np(thread, sizeof(cpuSet), &cpuSet);
+        if (error == 0)
+            result.m_core = core;
+        else
+            result.m_coreError = error;
+    }
+#endif
+
+    if (index < c_maxThreads) {
+        s_results[index] = result;
+        s_resultReady[index].store(true, std::memory_order_release);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+void CAudioThreads::Update () {
+    for (size_t index = 0; index < c_maxThreads; ++index) {
+        if (!s_resultReady[index].load(std::memory_order_acquire))
+            continue;
+        s_resultReady[index] = false;
+        const SThreadResult& result = s_results[index];
+
+        if (index == 0)
+            printf("Audio thread: ");
+        else
+            printf("Audio worker %i: ", int(index - 1));
+
+#ifdef _WIN32
+        printf("priority %i", result.m_priority);
+        if (result.m_schedError != 0)
+            printf(" (could not make it time critical, error %i)", result.m_schedError);
+#else
+        const char* policyName = result.m_policy == SCHED_FIFO ? "SCHED_FIFO" : result.m_policy == SCHED_RR ? "SCHED_RR" : "SCHED_OTHER";
+        printf("%s priority %i", policyName, result.m_priority);
+        if (result.m_schedError != 0)
+            printf(" (could not get real time priority %i: %s)", s_priority, strerror(result.m_schedError));
+        else if (s_priority > 0 && result.m_priority < s_priority)
+            printf(" (asked for %i, limited by rtprio)", s_priority);
+#endif
+
+        if (result.m_core >= 0)
+            printf(", core %i\r\n", result.m_core);
+        else if (result.m_coreError != 0)
+            printf(", not pinned (error %i)\r\n", result.m_coreError);
+        else
+            printf(", not pinned\r\n");
+    }
+}
@@ -0,0 +1,72 @@
+//--------------------------------------------------------------------------------------------------
+// AudioThreads.h
+//
+// Scheduling for the audio thread and the audio workers.  Each thread sets itself up when it starts:
+// it's pinned to a core, and on Linux it can be moved to a real time scheduling class (SCHED_FIFO or
+// SCHED_RR) so that other processes sharing the machine can't push the audio past its deadline.
+// Real time scheduling needs CAP_SYS_NICE or an rtprio limit; without them the thread asks for as
+// high a priority as it's allowed, and otherwise carries on with normal scheduling.
+//
+// Threads don't print from inside the audio callback.  What each thread got is reported from the
+// main thread by Update().
+//
+//--------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------
+class CAudioThreads {
+public:
+    // Call before the audio and worker threads start.  priority is 1 to 99, the same as chrt.  0
+    // leaves the scheduling alone.  On Windows the threads are always time critical.
+    static void SetRealtime (int priority, bool roundRobin) { s_priority = priority; s_roundRobin = roundRobin; }
+
+    // Call before the audio and worker threads start.  A comma separated list of cores.  The audio
+    // thread is pinned to the first, and the workers share the rest.  Returns false if it's not a
+    // list of cores this machine has.
+    static bool SetCores (const char* coreList);
+
+    // How many cores are set aside for the workers, or 0 if no cores were given.
+    static size_t GetNumWorkerCores () { return s_cores.size() > 1 ? s_cores.size() - 1 : 0; }
+
+    // Audio thread.  Call at the start of every audio callback.  Sets up the thread the first time
+    // it's called on it, which is cheap to check after that.
+    static void OnAudioCallback () {
+        if (s_audioThreadId != std::this_thread::get_id()) {
+            s_audioThreadId = std::this_thread::get_id();
+            SetupThread(0, s_cores.empty() ? -1 : int(s_cores[0]));
+        }
+    }
+
+    // Worker thread.  Call when the worker starts.  defaultCore is where it goes if no cores were
+    // given.
+    static void OnWorkerStart (size_t workerIndex, size_t defaultCore);
+
+    // Main thread.  Prints what each thread got, once it has set itself up.
+    static void Update ();
+
+private:
+    // index 0 is the audio thread, then the workers
+    static const size_t c_maxThreads = 16;
+
+    struct SThreadResult {
+        int     m_policy;       // the scheduling class the thread ended up in
+        int     m_priority;     // and its priority
+        int     m_core;         // -1 if not pinned
+        int     m_schedError;   // errno from asking for real time scheduling, or 0
+        int     m_coreError;    // errno from pinning, or 0
+    };
+
+    static void SetupThread (size_t index, int core);
+
+    static int                  s_priority;
+    static bool                 s_roundRobin;
+    static std::vector<size_t>  s_cores;
+    static std::thread::id      s_audioThreadId;
+    static SThreadResult        s_results[c_maxThreads];
+    static std::atomic<bool>    s_resultReady[c_maxThreads];
+};
@@ -8,9 +8,18 @@
 
 #include <cmath>
 #include <stdlib.h>
+#include <stdint.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
 
 static const float c_pi = 3.14159265359f;
 
+// Anything quieter than this (-100 dB) counts as silence, so effects can stop ringing out
+static const float c_silenceThreshold = 0.00001f;
+
+// A voice whose envelope has faded below this (-80 dB) on its way out can't be heard, and is culled
+static const float c_envelopeCullThreshold = 0.0001f;
+
 //--------------------------------------------------------------------------------------------------
 // Oscillators
 //   Pass a phase from 0 to 1.  Not a true angle, it's a percentage.
@@ -89,15 +98,204 @@ inline float TriangleWaveBandLimited (float phase, int nNumHarmonics) {
 }
 
 //--------------------------------------------------------------------------------------------------
-inline float Noise ()
-{
-    // get a random float [0, 1]
-    float value = ((float)rand()) / ((float)RAND_MAX);
+// Phase accumulator
+//   The phase of an oscillator as a 32 bit fixed point fraction of a cycle.  It wraps around for free
+//   when it overflows, and stays exact however long a note plays, unlike a float phase or one worked
+//   out from the note's age.  The increment is worked out once when the frequency is set, so moving
+//   to the next sample is just an add.
+//--------------------------------------------------------------------------------------------------
+struct SPhaseAccumulator {
+    SPhaseAccumulator ()
+        : m_phase(0)
+        , m_increment(0) {}
+
+    SPhaseAccumulator (float frequency, float sampleRate)
+        : m_phase(0)
+        , m_increment(FrequencyToIncrement(frequency, sampleRate)) {}
+
+    void SetFrequency (float frequency, float sampleRate) {
+        m_increment = FrequencyToIncrement(frequency, sampleRate);
+    }
+
+    void Advance () {
+        m_phase += m_increment;
+    }
+
+    // for oscillators whose frequency changes every sample, like with FM
+    void Advance (uint32_t increment) {
+        m_phase += increment;
+    }
+
+    // for oscillators bent away from the frequency that was set, like with vibrato or a pitch drop.
+    // The frequency is multiplied by frequencyScale for this sample only.
+    void AdvanceScaled (float frequencyScale) {
+        m_phase += uint32_t(int64_t(double(m_increment) * double(frequencyScale)));
+    }
+
+    // phase from 0 to 1, for the oscillators above
+    float GetPhase () const {
+        return ToFloat(m_phase);
+    }
+
+    // the phase of a harmonic, which wraps around for free too
+    uint32_t GetHarmonic (uint32_t harmonic) const {
+        return m_phase * harmonic;
+    }
+
+    static float ToFloat (uint32_t phase) {
+        // the top 24 bits, so it never rounds up to 1
+        return float(phase >> 8) * (1.0f / 16777216.0f);
+    }
+
+    static uint32_t FrequencyToIncrement (float frequency, float sampleRate) {
+        // negative frequencies, which FM can make, run the phase backwards
+        return uint32_t(int64_t(std::floor(double(frequency) / double(sampleRate) * 4294967296.0 + 0.5)));
+    }
+
+    uint32_t    m_phase;
+    uint32_t    m_increment;
+};
+
+//--------------------------------------------------------------------------------------------------
+// Sine wave from a fixed point phase.  The top bits of the phase index straight into a table, and the
+// bits below them interpolate between entries.  Error is around 0.000001, well under what 16 or 24
+// bit output can hold.
+static const uint32_t c_sineTableBits = 11;
+static const uint32_t c_sineTableSize = 1 << c_sineTableBits;
+
+inline const float* GetSineTable () {
+    struct SSineTable {
+        SSineTable () {
+            // one extra entry on the end so interpolation never has to wrap
+            for (uint32_t index = 0; index <= c_sineTableSize; ++index)
+                m_values[index] = float(std::sin(double(index) / double(c_sineTableSize) * 2.0 * 3.14159265358979323846));
+        }
+        float m_values[c_sineTableSize + 1];
+    };
+    static const SSineTable s_table;
+    return s_table.m_values;
+}
+
+inline float SineWaveFixed (uint32_t phase) {
+    const float* table = GetSineTable();
+    uint32_t index = phase >> (32 - c_sineTableBits);
+    float fraction = float((phase >> (16 - c_sineTableBits)) & 0xFFFF) * (1.0f / 65536.0f);
+    return table[index] + (table[index + 1] - table[index]) * fraction;
+}
 
-    // return that number mapped to [-1, 1]
-    return  (value * 2.0f) - 1.0f;
+inline float SineWave (const SPhaseAccumulator& phase) {
+    return SineWaveFixed(phase.m_phase);
 }
 
+//--------------------------------------------------------------------------------------------------
+// Noise
+//   Each voice owns its own generator, so there's no shared state between threads, and the same seed
+//   gives the same noise on every platform.  It's four xorshift32 generators that take turns, which
+//   lets GenerateBlock() step all four at once with SSE2 and still give exactly the same samples as
+//   calling GetSample() one at a time.  White noise is from -1 to 1, and pink and brown are scaled to
+//   peak at about the same.
+//--------------------------------------------------------------------------------------------------
+struct SNoise {
+    enum class EColor {
+        e_white,    // flat spectrum
+        e_pink,     // -3 dB per octave
+        e_brown     // -6 dB per octave
+    };
+
+    SNoise (uint32_t seed = 0, EColor color = EColor::e_white) {
+        Seed(seed);
+        m_color = color;
+    }
+
+    void Seed (uint32_t seed) {
+        // scramble the seed for each generator so that nearby seeds give unrelated noise.  xorshift
+        // gets stuck on 0, so that's never a starting state.
+        for (uint32_t index = 0; index < 4; ++index) {
+            uint32_t state = seed * 4 + index + 0x9E3779B9;
+            state = (state ^ (state >> 16)) * 0x85EBCA6B;
+            state = (state ^ (state >> 13)) * 0xC2B2AE35;
+            state ^= state >> 16;
+            m_state[index] = state ? state : 0x9E3779B9;
+        }
+        m_next = 0;
+        m_pink[0] = m_pink[1] = m_pink[2] = 0.0f;
+        m_brown = 0.0f;
+    }
+
+    float GetSample () {
+        uint32_t& state = m_state[m_next];
+        m_next = (m_next + 1) & 3;
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        // the top 24 bits, which a float holds exactly
+        float white = float(int32_t(state) >> 8) * c_scale;
+        return Color(white);
+    }
+
+    void GenerateBlock (float* out, size_t count) {
+        size_t index = 0;
+
+        // get back in step with the first generator before going four at a time
+        for (; index < count && m_next != 0; ++index)
+            out[index] = GetSample();
+
+        size_t blockStart = index;
+        if (index + 4 <= count) {
+            __m128i state = _mm_loadu_si128((const __m128i*)m_state);
+            __m128 scale = _mm_set1_ps(c_scale);
+            for (; index + 4 <= count; index += 4) {
+                state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+                state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+                state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+                _mm_storeu_ps(&out[index], _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(state, 8)), scale));
+            }
+            _mm_storeu_si128((__m128i*)m_state, state);
+        }
+
+        // pink and brown noise filter the white noise, which has to be done one sample at a time
+        if (m_color != EColor::e_white) {
+            for (size_t filterIndex = blockStart; filterIndex < index; ++filterIndex)
+                out[filterIndex] = Color(out[filterIndex]);
+        }
+
+        for (; index < count; ++index)
+            out[index] = GetSample();
+    }
+
+    EColor m_color;
+
+private:
+    static constexpr float c_scale = 1.0f / 8388608.0f;
+    static constexpr float c_pinkScale = 0.15f;
+    static constexpr float c_brownScale = 3.5f;
+
+    float Color (float white) {
+        switch (m_color) {
+            case EColor::e_white: return white;
+            case EColor::e_pink: {
+                // Paul Kellet's economy pink noise filter, accurate to within 0.5 dB above 10 Hz
+                m_pink[0] = 0.99765f * m_pink[0] + white * 0.0990460f;
+                m_pink[1] = 0.96300f * m_pink[1] + white * 0.2965164f;
+                m_pink[2] = 0.57000f * m_pink[2] + white * 1.0526913f;
+                return (m_pink[0] + m_pink[1] + m_pink[2] + white * 0.1848f) * c_pinkScale;
+            }
+            case EColor::e_brown: {
+                // leaky integrator, so it wanders without drifting off
+                m_brown = (m_brown + white * 0.02f) / 1.02f;
+                return m_brown * c_brownScale;
+            }
+        }
+        return white;
+    }
+
+    uint32_t    m_state[4];
+    uint32_t    m_next;
+    float       m_pink[3];
+    float       m_brown;
+};
+
 //--------------------------------------------------------------------------------------------------
 inline float NoteToFrequency (float fOctave, float fNote)
 /*
@@ -126,6 +324,30 @@ notes go like so...
     return (float)(440 * pow(2.0, ((double)((fOctave - 4) * 12 + fNote)) / 12.0));
 }
 
+//--------------------------------------------------------------------------------------------------
+// MIDI note 69 is A4, same as NoteToFrequency(4, 0)
+inline float MIDINoteToFrequency (int note)
+{
+    return (float)(440 * pow(2.0, ((double)(note - 69)) / 12.0));
+}
+
+//--------------------------------------------------------------------------------------------------
+// MIDI velocity is 0 to 127.  Squaring it gives a more even feeling loudness curve than linear.
+inline float MIDIVelocityToAmplitude (int velocity)
+{
+    float amplitude = float(velocity) / 127.0f;
+    return amplitude * amplitude;
+}
+
+//--------------------------------------------------------------------------------------------------
+inline float FastTan (float x)
+{
+    // [5/4] Pade approximation of tan(x).  Relative error stays under 0.003% across [0, pi/2 * 0.9],
+    // which covers filter cutoffs up to 0.45 * sampleRate, and it costs a handful of multiplies and a divide.
+    float x2 = x * x;
+    return x * (945.0f - 105.0f * x2 + x2 * x2) / (945.0f - 420.0f * x2 + 15.0f * x2 * x2);
+}
+
 //--------------------------------------------------------------------------------------------------
 inline float Lerp (float a, float b, float t) {
     return (b - a)*t + a;
@@ -348,4 +570,30 @@ inline float ScaleBiPolarValue(float value, float min, float max)
     // for instance, turns a sine wave lfo into the specified range
     float percent = (value + 1.0f) * 0.5f;
     return min + percent * (max - min);
-}
\ No newline at end of file
+}
+
+//--------------------------------------------------------------------------------------------------
+inline bool IsSilentSample (float sample)
+{
+    return sample <= c_silenceThreshold && sample >= -c_silenceThreshold;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Turns on flush to zero and denormals are zero for as long as it's in scope, then puts back what
+// was there.  Feedback in reverbs, delays and filters decays towards zero after the input stops, and
+// the tiny (denormal) floats on the way there are many times slower on x86.  With these on they are
+// treated as zero instead, which is far too quiet to hear.
+struct SDenormalGuard {
+    static const unsigned int c_flushToZero = 0x8000;       // MXCSR FTZ
+    static const unsigned int c_denormalsAreZero = 0x0040;  // MXCSR DAZ
+
+    SDenormalGuard () : m_oldCsr(_mm_getcsr()) {
+        _mm_setcsr(m_oldCsr | c_flushToZero | c_denormalsAreZero);
+    }
+
+    ~SDenormalGuard () {
+        _mm_setcsr(m_oldCsr);
+    }
+
+    unsigned int m_oldCsr;
+};
\ No newline at end of file
@@ -0,0 +1,199 @@
+//--------------------------------------------------------------------------------------------------
+// AudioWorkerPool.cpp
+//
+// A pool of worker threads that help the audio thread get through a list of work items.
+//
+//--------------------------------------------------------------------------------------------------
+
+#include "AudioWorkerPool.h"
+#include "AudioThreads.h"
+#include "AudioUtils.h"
+#include <xmmintrin.h>
+
+#ifdef _WIN32
+#include <Windows.h> // for the wake semaphore
+#else
+#include <semaphore.h>
+#include <errno.h>
+#endif
+
+// how many times an idle worker spins waiting for the next job before going to sleep
+static const size_t c_idleSpinCount = 4096;
+
+//--------------------------------------------------------------------------------------------------
+static void* CreateWakeSemaphore () {
+#ifdef _WIN32
+    return CreateSemaphore(nullptr, 0, MAXLONG, nullptr);
+#else
+    sem_t* semaphore = new sem_t;
+    sem_init(semaphore, 0, 0);
+    return semaphore;
+#endif
+}
+
+//--------------------------------------------------------------------------------------------------
+static void DestroyWakeSemaphore (void* semaphore) {
+#ifdef _WIN32
+    CloseHandle(semaphore);
+#else
+    sem_destroy((sem_t*)semaphore);
+    delete (sem_t*)semaphore;
+#endif
+}
+
+//--------------------------------------------------------------------------------------------------
+static void PostWakeSemaphore (void* semaphore, size_t count) {
+#ifdef _WIN32
+    ReleaseSemaphore(semaphore, LONG(count), nullptr);
+#else
+    for (size_t i = 0; i < count; ++i)
+        sem_post((sem_t*)semaphore);
+#endif
+}
+
+//--------------------------------------------------------------------------------------------------
+static void WaitWakeSemaphore (void* semaphore) {
+#ifdef _WIN32
+    WaitForSingleObject(semaphore, INFINITE);
+#else
+    // try again if a signal interrupted the wait
+    while (sem_wait((sem_t*)semaphore) != 0 && errno == EINTR) {}
+#endif
+}
+
+//--------------------------------------------------------------------------------------------------
+CAudioWorkerPool::CAudioWorkerPool () {
+    m_quit = false;
+    m_generation = 0;
+    m_activeWorkers = 0;
+    m_sleepingWorkers = 0;
+    m_wakeSemaphore = CreateWakeSemaphore();
+    for (SJobSlot& slot : m_slots) {
+        slot.m_job.m_function = nullptr;
+        slot.m_job.m_context = nullptr;
+        slot.m_job.m_count = 0;
+        slot.m_job.m_waitFor = nullptr;
+        slot.m_next = 0;
+        slot.m_done = 0;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+CAudioWorkerPool::~CAudioWorkerPool () {
+    Stop();
+    DestroyWakeSemaphore(m_wakeSemaphore);
+}
+
+//--------------------------------------------------------------------------------------------------
+void CAudioWorkerPool::Start (size_t numWorkers, size_t firstCore) {
+    Stop();
+    m_quit = false;
+    for (size_t i = 0; i < numWorkers; ++i)
+        m_threads.push_back(std::thread(&CAudioWorkerPool::WorkerMain, this, i, firstCore + i));
+}
+
+//--------------------------------------------------------------------------------------------------
+void CAudioWorkerPool::Stop () {
+    m_quit = true;
+    PostWakeSemaphore(m_wakeSemaphore, m_threads.size());
+    for (std::thread& thread : m_threads)
+        thread.join();
+    m_threads.clear();
+}
+
+//--------------------------------------------------------------------------------------------------
+void CAudioWorkerPool::Run (const SAudioWorkerJob& job) {
+
+    // wait for any worker that is still finishing up with the slot we are about to re-use
+    while (m_activeWorkers.load() != 0)
+        _mm_pause();
+
+    // fill out the job, then let the workers know it's there
+    size_t generation = m_generation.load() + 1;
+    SJobSlot& slot = m_slots[generation % 2];
+    slot.m_job = job;
+    slot.m_next = 0;
+    slot.m_done = 0;
+    m_generation.store(generation);
+
+    // wake up any workers that went to sleep waiting for a job
+    size_t sleepingWorkers = m_sleepingWorkers.exchange(0);
+    if (sleepingWorkers > 0)
+        PostWakeSemaphore(m_wakeSemaphore, sleepingWorkers);
+
+    // help out, then wait for any items the workers are still on
+    Work(slot);
+    while (slot.m_done.load() < job.m_count)
+        _mm_pause();
+}
+
+//--------------------------------------------------------------------------------------------------
+void CAudioWorkerPool::WorkerMain (size_t workerIndex, size_t core) {
+    CAudioThreads::OnWorkerStart(workerIndex, core);
+    SDenormalGuard denormalGuard;
+
+    size_t lastGeneration = m_generation.load();
+    size_t idleSpins = 0;
+    while (!m_quit.load()) {
+
+        // wait for a new job, spinning for a little while in case another one comes right away
+        size_t generation = m_generation.load();
+        if (generation == lastGeneration) {
+            if (++idleSpins < c_idleSpinCount) {
+                _mm_pause();
+                continue;
+            }
+            idleSpins = 0;
+
+            // Say we are going to sleep, then check for a job once more.  Run() publishes the job
+            // before it looks at who is asleep, so either it sees us and wakes us, or we see the job.
+            // If we see the job but Run() already counted us, its wake up is on the way and the
+            // next sleep takes it straight away.
+            ++m_sleepingWorkers;
+            if (m_generation.load() != lastGeneration && UnmarkSleeping())
+                continue;
+            WaitWakeSemaphore(m_wakeSemaphore);
+            continue;
+        }
+
+        // Say we are working, then make sure the job didn't change underneath us.  If it did, go
+        // around again and pick up the newer one.
+        ++m_activeWorkers;
+        if (m_generation.load() == generation) {
+            lastGeneration = generation;
+            Work(m_slots[generation % 2]);
+        }
+        --m_activeWorkers;
+        idleSpins = 0;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+bool CAudioWorkerPool::UnmarkSleeping () {
+    size_t sleepingWorkers = m_sleepingWorkers.load();
+    while (sleepingWorkers > 0) {
+        if (m_sleepingWorkers.compare_exchange_weak(sleepingWorkers, sleepingWorkers - 1))
+            return true;
+    }
+    return false;
+}
+
+//--------------------------------------------------------------------------------------------------
+void CAudioWorkerPool::Work (SJobSlot& slot) {
+
+    // Everyone takes the next item off the same list, so whoever is free takes the next piece of work
+    // and nobody sits idle while there is work left that can be started.
+    while (true) {
+        size_t index = slot.m_next.fetch_add(1);
+        if (index >= slot.m_job.m_count)
+            return;
+
+        // spin until the items this one depends on are finished.  Those all come earlier in the list,
+        // so someone has already taken them and is working on them.
+        while (slot.m_done.load() < slot.m_job.m_waitFor[index])
+            _mm_pause();
+
+        slot.m_job.m_function(slot.m_job.m_context, index);
+        ++slot.m_done;
+    }
+}
@@ -0,0 +1,71 @@
+//--------------------------------------------------------------------------------------------------
+// AudioWorkerPool.h
+//
+// A pool of worker threads that help the audio thread get through a list of work items, where
+// items can depend on earlier items being finished.  After a job, workers spin for a little while so
+// they can start on the next one immediately, which matters when the whole job has to finish within
+// one buffer.  If no job comes, they sleep until Run() wakes them, so an idle pool doesn't hold on
+// to its cores.
+//
+//--------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+
+//--------------------------------------------------------------------------------------------------
+struct SAudioWorkerJob {
+    // called once for each index in [0, m_count)
+    void            (*m_function)(void *context, size_t index);
+    void*           m_context;
+    size_t          m_count;
+
+    // m_waitFor[index] is how many items (from the start of the list) must be finished before that
+    // item can start.  Items with the same value can run at the same time.
+    const size_t*   m_waitFor;
+};
+
+//--------------------------------------------------------------------------------------------------
+class CAudioWorkerPool {
+public:
+    CAudioWorkerPool ();
+    ~CAudioWorkerPool ();
+
+    // Main thread.  Starts the workers, pinning worker N to core firstCore + N, or to the cores given
+    // to CAudioThreads, and raising their priority where the platform allows it.
+    void Start (size_t numWorkers, size_t firstCore);
+    void Stop ();
+
+    size_t GetNumWorkers () const { return m_threads.size(); }
+
+    // Audio thread.  Works on the job along with the workers, and returns when every item is done.
+    // With no workers, this just runs the items in order.
+    void Run (const SAudioWorkerJob& job);
+
+private:
+    // Jobs alternate between two slots, so a worker that shows up late for the last job can't
+    // collide with the next one being set up.
+    struct SJobSlot {
+        SAudioWorkerJob         m_job;
+        std::atomic<size_t>     m_next;
+        std::atomic<size_t>     m_done;
+    };
+
+    void WorkerMain (size_t workerIndex, size_t core);
+
+    // takes back a worker saying it's going to sleep.  False if Run() already counted it to wake.
+    bool UnmarkSleeping ();
+    void Work (SJobSlot& slot);
+
+    std::vector<std::thread>    m_threads;
+    std::atomic<bool>           m_quit;
+    std::atomic<size_t>         m_generation;
+    std::atomic<size_t>         m_activeWorkers;
+    SJobSlot                    m_slots[2];
+
+    // Workers that are asleep, or about to be, and the semaphore they sleep on.  Posting a semaphore
+    // doesn't take a lock, so the audio thread can wake them.  A Windows semaphore or a POSIX sem_t.
+    std::atomic<size_t>         m_sleepingWorkers;
+    void*                       m_wakeSemaphore;
+};
@@ -14,16 +14,19 @@ namespace DemoAdditive {
     struct SNote {
         SNote(float frequency)
             : m_frequency(frequency)
+            , m_velocity(1.0f)
             , m_age(0)
             , m_dead(false)
             , m_releaseAge(0)
-            , m_phase(0.0f) {}
+            , m_phase(frequency, CDemoMgr::GetSampleRate()) {}
 
         float       m_frequency;
+        float       m_velocity;
         size_t      m_age;
         bool        m_dead;
         size_t      m_releaseAge;
-        float       m_phase;
+
+        SPhaseAccumulator   m_phase;
     };
 
     std::vector<SNote>  g_notes;
@@ -62,26 +65,30 @@ namespace DemoAdditive {
                 c_decayTime*0.10f, 0.5f,
                 c_decayTime, 0.0f
             );
-            float phase = std::fmodf(note.m_phase * float(index) , 1.0f);
-            //ret += SineWave(phase) * envelope;
-            ret += SawWaveBandLimited(phase, 5) * envelope;
+            uint32_t phase = note.m_phase.GetHarmonic(uint32_t(index));
+            //ret += SineWaveFixed(phase) * envelope;
+            ret += SawWaveBandLimited(SPhaseAccumulator::ToFloat(phase), 5) * envelope;
         }
 
         // advance phase
-        note.m_phase = std::fmodf(note.m_phase + note.m_frequency / sampleRate, 1.0f);
+        note.m_phase.Advance();
 
         // return the value
         return ret;
     }
 
     //--------------------------------------------------------------------------------------------------
-    void GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
+    size_t GenerateAudioSamples (float **outputChannels, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
 
         // get a lock on our notes vector
         std::lock_guard<std::mutex> guard(g_notesMutex);
 
+        // nothing is playing, so let the demo manager know this buffer is silent
+        if (g_notes.empty())
+            return 0;
+
         // for every sample in our output buffer
-        for (size_t sample = 0; sample < framesPerBuffer; ++sample, outputBuffer += numChannels) {
+        for (size_t sample = 0; sample < framesPerBuffer; ++sample) {
             
             // add up all notes to get the final value.
             float value = 0.0f;
@@ -89,13 +96,12 @@ namespace DemoAdditive {
                 g_notes.begin(),
                 g_notes.end(),
                 [&value, sampleRate](SNote& note) {
-                    value += GenerateNoteSample(note, sampleRate);
+                    value += GenerateNoteSample(note, sampleRate) * note.m_velocity;
                 }
             );
 
-            // copy the value to all audio channels
-            for (size_t channel = 0; channel < numChannels; ++channel)
-                outputBuffer[channel] = value;
+            // write the value to the mono output
+            outputChannels[0][sample] = value;
         }
 
         // remove notes that have died
@@ -107,8 +113,22 @@ namespace DemoAdditive {
             }
         );
 
-        if (iter != g_notes.end())
-            g_notes.erase(iter);
+        g_notes.erase(iter, g_notes.end());
+
+        return 1;
+    }
+
+    //--------------------------------------------------------------------------------------------------
+    void OnNote (float frequency, float velocity, bool pressed) {
+
+        // nothing to do on note release
+        if (!pressed)
+            return;
+
+        // get a lock on our notes vector and add the new note
+        std::lock_guard<std::mutex> guard(g_notesMutex);
+        g_notes.push_back(SNote(frequency));
+        g_notes.back().m_velocity = velocity;
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -171,9 +191,7 @@ namespace DemoAdditive {
             }
         }
 
-        // get a lock on our notes vector and add the new note
-        std::lock_guard<std::mutex> guard(g_notesMutex);
-        g_notes.push_back(SNote(frequency));
+        CDemoMgr::QueueKeyNote(frequency, pressed);
     }
 
     //--------------------------------------------------------------------------------------------------
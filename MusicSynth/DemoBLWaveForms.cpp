@@ -30,18 +30,23 @@ namespace DemoBLWaveForms {
     struct SNote {
         SNote(float frequency, EWaveForm waveForm)
             : m_frequency(frequency)
+            , m_velocity(1.0f)
             , m_waveForm(waveForm)
             , m_age(0)
             , m_dead(false)
             , m_wantsKeyRelease(false)
-            , m_releaseAge(0) {}
+            , m_releaseAge(0)
+            , m_phase(frequency, CDemoMgr::GetSampleRate()) {}
 
         float       m_frequency;
+        float       m_velocity;
         EWaveForm   m_waveForm;
         size_t      m_age;
         bool        m_dead;
         bool        m_wantsKeyRelease;
         size_t      m_releaseAge;
+
+        SPhaseAccumulator   m_phase;
     };
 
     std::vector<SNote>  g_notes;
@@ -93,8 +98,8 @@ namespace DemoBLWaveForms {
                 c_envelopeTime, 0.0f
             );
 
-            // kill the note when the release is done
-            if (secondsInRelease > c_envelopeTime)
+            // kill the note when the release is done, or once it has faded below hearing
+            if (secondsInRelease > c_envelopeTime || envelope < c_envelopeCullThreshold)
                 note.m_dead = true;
         }
 
@@ -112,28 +117,31 @@ namespace DemoBLWaveForms {
         // decrease note volume a bit, because the volume adjustments don't seem to be quite enough
         float envelope = GenerateEnvelope(note, ageInSeconds, sampleRate) * 0.8f;
 
-        // generate the audio sample value for the current time.
-        // Note that it is ok that we are basing audio samples on age instead of phase, because the
-        // frequency never changes and we envelope the front and back to avoid popping.
-        float phase = std::fmodf(ageInSeconds * note.m_frequency, 1.0f);
+        // generate the audio sample value for the current phase, and advance the phase by 1 sample
+        SPhaseAccumulator phase = note.m_phase;
+        note.m_phase.Advance();
         switch (note.m_waveForm) {
             case e_waveSine:    return SineWave(phase) * envelope;
-            case e_waveSaw:     return SawWaveBandLimited(phase, 10) * envelope;
-            case e_waveSquare:  return SquareWaveBandLimited(phase, 10) * envelope;
-            case e_waveTriangle:return TriangleWaveBandLimited(phase, 10) * envelope;
+            case e_waveSaw:     return SawWaveBandLimited(phase.GetPhase(), 10) * envelope;
+            case e_waveSquare:  return SquareWaveBandLimited(phase.GetPhase(), 10) * envelope;
+            case e_waveTriangle:return TriangleWaveBandLimited(phase.GetPhase(), 10) * envelope;
         }
 
         return 0.0f;
     }
 
     //--------------------------------------------------------------------------------------------------
-    void GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
+    size_t GenerateAudioSamples (float **outputChannels, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
 
         // get a lock on our notes vector
         std::lock_guard<std::mutex> guard(g_notesMutex);
 
+        // nothing is playing, so let the demo manager know this buffer is silent
+        if (g_notes.empty())
+            return 0;
+
         // for every sample in our output buffer
-        for (size_t sample = 0; sample < framesPerBuffer; ++sample, outputBuffer += numChannels) {
+        for (size_t sample = 0; sample < framesPerBuffer; ++sample) {
             
             // add up all notes to get the final value.
             float value = 0.0f;
@@ -141,13 +149,12 @@ namespace DemoBLWaveForms {
                 g_notes.begin(),
                 g_notes.end(),
                 [&value, sampleRate](SNote& note) {
-                    value += GenerateNoteSample(note, sampleRate);
+                    value += GenerateNoteSample(note, sampleRate) * note.m_velocity;
                 }
             );
 
-            // copy the value to all audio channels
-            for (size_t channel = 0; channel < numChannels; ++channel)
-                outputBuffer[channel] = value;
+            // write the value to the mono output
+            outputChannels[0][sample] = value;
         }
 
         // remove notes that have died
@@ -159,8 +166,9 @@ namespace DemoBLWaveForms {
             }
         );
 
-        if (iter != g_notes.end())
-            g_notes.erase(iter);
+        g_notes.erase(iter, g_notes.end());
+
+        return 1;
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -186,6 +194,21 @@ namespace DemoBLWaveForms {
         printf("Instrument: %s\r\n", WaveFormToString(g_currentWaveForm));
     }
 
+    //--------------------------------------------------------------------------------------------------
+    void OnNote (float frequency, float velocity, bool pressed) {
+
+        // if releasing a note, we need to find and kill the flute note of the same frequency
+        if (!pressed) {
+            StopNote(frequency);
+            return;
+        }
+
+        // get a lock on our notes vector and add the new note
+        std::lock_guard<std::mutex> guard(g_notesMutex);
+        g_notes.push_back(SNote(frequency, g_currentWaveForm));
+        g_notes.back().m_velocity = velocity;
+    }
+
     //--------------------------------------------------------------------------------------------------
     void OnKey (char key, bool pressed) {
 
@@ -254,16 +277,7 @@ namespace DemoBLWaveForms {
             }
         }
 
-
-        // if releasing a note, we need to find and kill the flute note of the same frequency
-        if (!pressed) {
-            StopNote(frequency);
-            return;
-        }
-
-        // get a lock on our notes vector and add the new note
-        std::lock_guard<std::mutex> guard(g_notesMutex);
-        g_notes.push_back(SNote(frequency, g_currentWaveForm));
+        CDemoMgr::QueueKeyNote(frequency, pressed);
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -19,19 +19,21 @@ namespace DemoClipping {
     };
 
     EVoiceState g_voiceState = e_stopped;
+    TSampleId   g_sampleVoice = c_invalidSampleId;
 
     //--------------------------------------------------------------------------------------------------
-    void OnInit() { }
+    void OnInit() {
+        g_sampleVoice = CSampleRegistry::Find("legend2");
+    }
 
     //--------------------------------------------------------------------------------------------------
     void OnExit() { }
 
     //--------------------------------------------------------------------------------------------------
-    float SampleAudioSample(size_t age, SWavFile& sample, float sampleRate) {
+    float SampleAudioSample(size_t age, const SWavFile* sample, float sampleRate) {
 
-        // handle the note dieing when it is done
-        size_t sampleIndex = age*sample.m_numChannels;
-        if (sampleIndex >= sample.m_numSamples) {
+        // handle the note dieing when it is done, or if the sample isn't loaded
+        if (!sample || age >= sample->GetNumFrames()) {
             g_voiceState = e_stopped;
             return 0.0f;
         }
@@ -42,20 +44,20 @@ namespace DemoClipping {
             ageInSeconds,
             0.0f, 0.0f,
             0.1f, 1.0f,
-            sample.m_lengthSeconds - 0.1f, 1.0f,
-            sample.m_lengthSeconds, 0.0f
+            sample->m_lengthSeconds - 0.1f, 1.0f,
+            sample->m_lengthSeconds, 0.0f
         );
 
         // return the sample value multiplied by the envelope
-        return sample.m_samples[sampleIndex] * envelope;
+        return sample->GetSample(age, 0) * envelope;
     }
 
     //--------------------------------------------------------------------------------------------------
-    void GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
-        static float phase = 0.0f;
+    size_t GenerateAudioSamples (float **outputChannels, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
+        static SPhaseAccumulator phase;
 
         // handle the voice starting
-        static size_t voiceStarted = 0;
+        static TSampleClock voiceStarted = 0;
         EVoiceState voiceState = g_voiceState;
         if (voiceState == e_wantStart) {
             g_voiceState = e_started;
@@ -64,25 +66,36 @@ namespace DemoClipping {
         }
 
         // calculate how much our phase should change each sample
-        float phaseAdvance = g_frequency / sampleRate;
+        phase.SetFrequency(g_frequency, sampleRate);
+        const SWavFile* voice = voiceState == e_started ? CSampleRegistry::Get(g_sampleVoice) : nullptr;
 
-        for (size_t sample = 0; sample < framesPerBuffer; ++sample, outputBuffer += numChannels) {
+        for (size_t sample = 0; sample < framesPerBuffer; ++sample) {
 
             // get the sine wave amplitude for this phase (angle)
             float value = SineWave(phase) * g_volumeAmplifier;
 
             // sample the voice if we should
             if (voiceState == e_started)
-                value += SampleAudioSample(CDemoMgr::GetSampleClock() - voiceStarted + sample, g_sample_legend2, sampleRate) * g_volumeAmplifier;
+                value += SampleAudioSample(size_t(CDemoMgr::GetSampleClock() - voiceStarted) + sample, voice, sampleRate) * g_volumeAmplifier;
 
-            // advance the phase, making sure to stay within 0 and 1
-            phase += phaseAdvance;
-            phase = std::fmod(phase, 1.0f);
+            // advance the phase, which wraps around from 1 to 0 by itself
+            phase.Advance();
 
-            // copy the value to all audio channels
-            for (size_t channel = 0; channel < numChannels; ++channel)
-                outputBuffer[channel] = value;
+            // write the value to the mono output
+            outputChannels[0][sample] = value;
         }
+
+        return 1;
+    }
+
+    //--------------------------------------------------------------------------------------------------
+    void OnNote (float frequency, float velocity, bool pressed) {
+
+        // play the new frequency, and go silent when the note playing is released
+        if (pressed)
+            g_frequency = frequency;
+        else if (frequency == g_frequency)
+            g_frequency = 0.0f;
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -170,6 +183,7 @@ namespace DemoClipping {
 
     //--------------------------------------------------------------------------------------------------
     void OnEnterDemo () {
+        CSampleRegistry::Prefetch(g_sampleVoice);
         g_frequency = 0.0f;
         g_volumeAmplifier = 1.0f;
         g_voiceState = e_stopped;
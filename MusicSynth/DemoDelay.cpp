@@ -51,27 +51,37 @@ namespace DemoDelay {
     struct SNote {
         SNote(float frequency, EWaveForm waveForm)
             : m_frequency(frequency)
+            , m_velocity(1.0f)
             , m_waveForm(waveForm)
             , m_age(0)
             , m_dead(false)
             , m_wantsKeyRelease(false)
-            , m_releaseAge(0) {}
+            , m_releaseAge(0)
+            , m_phase(frequency, CDemoMgr::GetSampleRate()) {}
 
         float       m_frequency;
+        float       m_velocity;
         EWaveForm   m_waveForm;
         size_t      m_age;
         bool        m_dead;
         bool        m_wantsKeyRelease;
         size_t      m_releaseAge;
+
+        SPhaseAccumulator   m_phase;
     };
 
     std::vector<SNote>  g_notes;
     std::mutex          g_notesMutex;
     EWaveForm           g_currentWaveForm;
     EDelay              g_currentDelay;
+    TSampleId           g_sampleCymbal;
+    TSampleId           g_sampleVoice;
 
     //--------------------------------------------------------------------------------------------------
-    void OnInit() { }
+    void OnInit() {
+        g_sampleCymbal = CSampleRegistry::Find("cymbal");
+        g_sampleVoice = CSampleRegistry::Find("legend1");
+    }
 
     //--------------------------------------------------------------------------------------------------
     void OnExit() { }
@@ -115,8 +125,8 @@ namespace DemoDelay {
                 c_envelopeTime, 0.0f
             );
 
-            // kill the note when the release is done
-            if (secondsInRelease > c_envelopeTime)
+            // kill the note when the release is done, or once it has faded below hearing
+            if (secondsInRelease > c_envelopeTime || envelope < c_envelopeCullThreshold)
                 note.m_dead = true;
         }
 
@@ -124,11 +134,10 @@ namespace DemoDelay {
     }
 
     //--------------------------------------------------------------------------------------------------
-    inline float SampleAudioSample(SNote& note, SWavFile& sample, float ageInSeconds) {
+    inline float SampleAudioSample(SNote& note, const SWavFile* sample, float ageInSeconds) {
 
-        // handle the note dieing when it is done
-        size_t sampleIndex = note.m_age*sample.m_numChannels;
-        if (sampleIndex >= sample.m_numSamples) {
+        // handle the note dieing when it is done, or if the sample isn't loaded
+        if (!sample || note.m_age >= sample->GetNumFrames()) {
             note.m_dead = true;
             return 0.0f;
         }
@@ -138,12 +147,12 @@ namespace DemoDelay {
             ageInSeconds,
             0.0f, 0.0f,
             0.1f, 1.0f,
-            sample.m_lengthSeconds - 0.1f, 1.0f,
-            sample.m_lengthSeconds, 0.0f
+            sample->m_lengthSeconds - 0.1f, 1.0f,
+            sample->m_lengthSeconds, 0.0f
             );
 
         // return the sample value multiplied by the envelope
-        return sample.m_samples[sampleIndex] * envelope;
+        return sample->GetSample(note.m_age, 0) * envelope;
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -156,24 +165,23 @@ namespace DemoDelay {
         // decrease note volume a bit, because the volume adjustments don't seem to be quite enough
         float envelope = GenerateEnvelope(note, ageInSeconds, sampleRate) * 0.8f;
 
-        // generate the audio sample value for the current time.
-        // Note that it is ok that we are basing audio samples on age instead of phase, because the
-        // frequency never changes and we envelope the front and back to avoid popping.
-        float phase = std::fmodf(ageInSeconds * note.m_frequency, 1.0f);
+        // generate the audio sample value for the current phase, and advance the phase by 1 sample
+        SPhaseAccumulator phase = note.m_phase;
+        note.m_phase.Advance();
         switch (note.m_waveForm) {
             case e_waveSine:        return SineWave(phase) * envelope;
-            case e_waveSaw:         return SawWaveBandLimited(phase, 10) * envelope;
-            case e_waveSquare:      return SquareWaveBandLimited(phase, 10) * envelope;
-            case e_waveTriangle:    return TriangleWaveBandLimited(phase, 10) * envelope;
-            case e_sampleCymbals:   return SampleAudioSample(note, g_sample_cymbal, ageInSeconds);
-            case e_sampleVoice:     return SampleAudioSample(note, g_sample_legend1, ageInSeconds);
+            case e_waveSaw:         return SawWaveBandLimited(phase.GetPhase(), 10) * envelope;
+            case e_waveSquare:      return SquareWaveBandLimited(phase.GetPhase(), 10) * envelope;
+            case e_waveTriangle:    return TriangleWaveBandLimited(phase.GetPhase(), 10) * envelope;
+            case e_sampleCymbals:   return SampleAudioSample(note, CSampleRegistry::Get(g_sampleCymbal), ageInSeconds);
+            case e_sampleVoice:     return SampleAudioSample(note, CSampleRegistry::Get(g_sampleVoice), ageInSeconds);
         }
 
         return 0.0f;
     }
 
     //--------------------------------------------------------------------------------------------------
-    void GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
+    size_t GenerateAudioSamples (float **outputChannels, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
 
         // re-create our delay buffer if the delay settings have changed
         static SDelayEffect delayEffect;
@@ -181,21 +189,24 @@ namespace DemoDelay {
         EDelay currentDelay = g_currentDelay;
         if (currentDelay != lastDelay) {
             lastDelay = currentDelay;
+
+            // Each delay is twice the one it's listed as.  That's how long they have always sounded,
+            // from when the delay buffer was sized for interleaved stereo.
             switch (currentDelay) {
                 case e_delayNone: {
-                    delayEffect.SetEffectParams(0.0f, sampleRate, numChannels, 0.0f);
+                    delayEffect.SetEffectParams(0.0f, sampleRate, 0.0f);
                     break;
                 }
                 case e_delay1: {
-                    delayEffect.SetEffectParams(0.25f, sampleRate, numChannels, 0.35f);
+                    delayEffect.SetEffectParams(0.5f, sampleRate, 0.35f);
                     break;
                 }
                 case e_delay2: {
-                    delayEffect.SetEffectParams(0.66f, sampleRate, numChannels, 0.4f);
+                    delayEffect.SetEffectParams(1.32f, sampleRate, 0.4f);
                     break;
                 }
                 case e_delay3: {
-                    delayEffect.SetEffectParams(1.0f, sampleRate, numChannels, 0.33f);
+                    delayEffect.SetEffectParams(2.0f, sampleRate, 0.33f);
                     break;
                 }
             }
@@ -204,8 +215,12 @@ namespace DemoDelay {
         // get a lock on our notes vector
         std::lock_guard<std::mutex> guard(g_notesMutex);
 
+        // once nothing is playing and the echoes have died away, the buffer is silent
+        if (g_notes.empty() && delayEffect.IsAsleep())
+            return 0;
+
         // for every sample in our output buffer
-        for (size_t sample = 0; sample < framesPerBuffer; ++sample, outputBuffer += numChannels) {
+        for (size_t sample = 0; sample < framesPerBuffer; ++sample) {
             
             // add up all notes to get the final value.
             float value = 0.0f;
@@ -213,7 +228,7 @@ namespace DemoDelay {
                 g_notes.begin(),
                 g_notes.end(),
                 [&value, sampleRate](SNote& note) {
-                    value += GenerateNoteSample(note, sampleRate);
+                    value += GenerateNoteSample(note, sampleRate) * note.m_velocity;
                 }
             );
 
@@ -221,9 +236,8 @@ namespace DemoDelay {
             float echo = delayEffect.AddSample(value);
             value += echo;
 
-            // copy the value to all audio channels
-            for (size_t channel = 0; channel < numChannels; ++channel)
-                outputBuffer[channel] = value;
+            // write the value to the mono output
+            outputChannels[0][sample] = value;
         }
 
         // remove notes that have died
@@ -235,8 +249,9 @@ namespace DemoDelay {
             }
         );
 
-        if (iter != g_notes.end())
-            g_notes.erase(iter);
+        g_notes.erase(iter, g_notes.end());
+
+        return 1;
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -262,6 +277,21 @@ namespace DemoDelay {
         printf("Instrument: %s  Delay: %s\r\n", WaveFormToString(g_currentWaveForm), DelayToString(g_currentDelay));
     }
 
+    //--------------------------------------------------------------------------------------------------
+    void OnNote (float frequency, float velocity, bool pressed) {
+
+        // if releasing a note, we need to find and kill the flute note of the same frequency
+        if (!pressed) {
+            StopNote(frequency);
+            return;
+        }
+
+        // get a lock on our notes vector and add the new note
+        std::lock_guard<std::mutex> guard(g_notesMutex);
+        g_notes.push_back(SNote(frequency, g_currentWaveForm));
+        g_notes.back().m_velocity = velocity;
+    }
+
     //--------------------------------------------------------------------------------------------------
     void OnKey (char key, bool pressed) {
 
@@ -344,19 +374,13 @@ namespace DemoDelay {
             }
         }
 
-        // if releasing a note, we need to find and kill the flute note of the same frequency
-        if (!pressed) {
-            StopNote(frequency);
-            return;
-        }
-
-        // get a lock on our notes vector and add the new note
-        std::lock_guard<std::mutex> guard(g_notesMutex);
-        g_notes.push_back(SNote(frequency, g_currentWaveForm));
+        CDemoMgr::QueueKeyNote(frequency, pressed);
     }
 
     //--------------------------------------------------------------------------------------------------
     void OnEnterDemo () {
+        CSampleRegistry::Prefetch(g_sampleCymbal);
+        CSampleRegistry::Prefetch(g_sampleVoice);
         g_currentWaveForm = e_waveSine;
         g_currentDelay = e_delayNone;
         printf("Letter keys to play notes.\r\nleft shift / control is super low frequency.\r\n");
@@ -35,25 +35,31 @@ namespace DemoDrum {
     }
 
     struct SNote {
-        SNote(float frequency, EMode mode)
+        SNote(float frequency, EMode mode, uint32_t noiseSeed)
             : m_frequency(frequency)
+            , m_velocity(1.0f)
             , m_mode(mode)
             , m_age(0)
             , m_dead(false)
             , m_releaseAge(0)
-            , m_phase(0.0f) {}
+            , m_phase(frequency, CDemoMgr::GetSampleRate())
+            , m_noise(noiseSeed) {}
 
         float       m_frequency;
+        float       m_velocity;
         EMode       m_mode;
         size_t      m_age;
         bool        m_dead;
         size_t      m_releaseAge;
-        float       m_phase;
+
+        SPhaseAccumulator   m_phase;
+        SNoise              m_noise;
     };
 
     std::vector<SNote>  g_notes;
     std::mutex          g_notesMutex;
     EMode               g_currentMode;
+    uint32_t            g_nextNoiseSeed = 0;   // every note gets different noise, the same every run
 
     //--------------------------------------------------------------------------------------------------
     void OnInit() { }
@@ -137,7 +143,7 @@ namespace DemoDrum {
         }
 
         // return noise shaped by the envelope, taken down in amplitude, so it isn't so loud.
-        return Noise() * envelope * 0.25f;
+        return note.m_noise.GetSample() * envelope * 0.25f;
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -158,27 +164,27 @@ namespace DemoDrum {
         }
 
         // make frequency decay over time if we should
-        float frequency = note.m_frequency;
+        float frequencyScale = 1.0f;
         if (note.m_mode >= e_modeSineEnvelopeDecay && ageInSeconds > 0.020f) {
             float percent = (ageInSeconds - 0.020f) / 0.175f;
-            frequency = Lerp(frequency, frequency*0.2f, percent);
+            frequencyScale = Lerp(1.0f, 0.2f, percent);
         }
 
         // advance phase
-        note.m_phase = std::fmodf(note.m_phase + frequency / sampleRate, 1.0f);
+        note.m_phase.AdvanceScaled(frequencyScale);
 
         // generate the sine value for the current time.
         return SineWave(note.m_phase) * envelope;
     }
 
     //--------------------------------------------------------------------------------------------------
-    void GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
+    size_t GenerateAudioSamples (float **outputChannels, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
 
         // initialize our effects
         static SMultiTapReverbEffect reverbEffect;
         static bool effectsInitialized = false;
         if (!effectsInitialized) {
-            reverbEffect.SetEffectParams(sampleRate, numChannels);
+            reverbEffect.SetEffectParams(sampleRate);
             effectsInitialized = true;
         }
 
@@ -193,8 +199,12 @@ namespace DemoDrum {
         // get a lock on our notes vector
         std::lock_guard<std::mutex> guard(g_notesMutex);
 
+        // once nothing is playing and the reverb tail has died away, the buffer is silent
+        if (g_notes.empty() && (!isReverbOn || reverbEffect.IsAsleep()))
+            return 0;
+
         // for every sample in our output buffer
-        for (size_t sample = 0; sample < framesPerBuffer; ++sample, outputBuffer += numChannels) {
+        for (size_t sample = 0; sample < framesPerBuffer; ++sample) {
             
             // add up all notes to get the final value.
             float value = 0.0f;
@@ -202,7 +212,7 @@ namespace DemoDrum {
                 g_notes.begin(),
                 g_notes.end(),
                 [&value, sampleRate](SNote& note) {
-                    value += GenerateNoteSample(note, sampleRate);
+                    value += GenerateNoteSample(note, sampleRate) * note.m_velocity;
                 }
             );
 
@@ -210,9 +220,8 @@ namespace DemoDrum {
             if (isReverbOn)
                 value = reverbEffect.AddSample(value);
 
-            // copy the value to all audio channels
-            for (size_t channel = 0; channel < numChannels; ++channel)
-                outputBuffer[channel] = value;
+            // write the value to the mono output
+            outputChannels[0][sample] = value;
         }
 
         // remove notes that have died
@@ -224,8 +233,9 @@ namespace DemoDrum {
             }
         );
 
-        if (iter != g_notes.end())
-            g_notes.erase(iter);
+        g_notes.erase(iter, g_notes.end());
+
+        return 1;
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -233,6 +243,19 @@ namespace DemoDrum {
         printf("Mode: %s\r\n", ModeToString(g_currentMode));
     }
 
+    //--------------------------------------------------------------------------------------------------
+    void OnNote (float frequency, float velocity, bool pressed) {
+
+        // nothing to do on note release
+        if (!pressed)
+            return;
+
+        // get a lock on our notes vector and add the new note
+        std::lock_guard<std::mutex> guard(g_notesMutex);
+        g_notes.push_back(SNote(frequency, g_currentMode, g_nextNoiseSeed++));
+        g_notes.back().m_velocity = velocity;
+    }
+
     //--------------------------------------------------------------------------------------------------
     void OnKey (char key, bool pressed) {
 
@@ -250,7 +273,7 @@ namespace DemoDrum {
         // space bar = cymbals
         if (key == ' ') {
             std::lock_guard<std::mutex> guard(g_notesMutex);
-            g_notes.push_back(SNote(0.0f, e_modeCymbal));
+            g_notes.push_back(SNote(0.0f, e_modeCymbal, g_nextNoiseSeed++));
             return;
         }
 
@@ -307,9 +330,7 @@ namespace DemoDrum {
             }
         }
 
-        // get a lock on our notes vector and add the new note
-        std::lock_guard<std::mutex> guard(g_notesMutex);
-        g_notes.push_back(SNote(frequency, g_currentMode));
+        CDemoMgr::QueueKeyNote(frequency, pressed);
     }
 
     //--------------------------------------------------------------------------------------------------
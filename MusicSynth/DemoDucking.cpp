@@ -8,6 +8,7 @@
 #include "DemoMgr.h"
 #include "AudioEffects.h"
 #include "Samples.h"
+#include "Sequencer.h"
 #include <algorithm>
 
 namespace DemoDucking {
@@ -39,30 +40,60 @@ namespace DemoDucking {
     std::mutex          g_notesMutex;
 
     bool                g_musicOn;
+    bool                g_haveMusic;
+
+    // Copies of the music only overlap while one finishes and the next starts, so this many is
+    // plenty, and the list of them never has to grow on the audio thread.
+    static const size_t         c_maxMusicNoteStarts = 4;
+
+    // The music loop is a single step sequence as long as the music, so it restarts the music each
+    // time around.  These are when each playing copy of the music started, and are only touched by
+    // the audio thread once set up.
+    CStepSequencer              g_music;
+    std::vector<TSampleClock>   g_musicNoteStarts;
+
+    // mono buffers for the samples, the music, and the key signal that ducks the music
+    std::vector<float>          g_samplesBus;
+    std::vector<float>          g_musicBus;
+    std::vector<float>          g_duckingKeyBus;
+
+    // the sample played for each ESample
+    TSampleId                   g_sampleIds[e_music + 1];
 
     //--------------------------------------------------------------------------------------------------
-    void OnInit() { }
+    void OnInit() {
+        g_sampleIds[e_drum1] = CSampleRegistry::Find("clap");
+        g_sampleIds[e_drum2] = CSampleRegistry::Find("kick");
+        g_sampleIds[e_drum3] = CSampleRegistry::Find("ting");
+        g_sampleIds[e_music] = CSampleRegistry::Find("pvd");
+
+        SSequencerTrack track;
+        track.m_steps.push_back(SSequencerStep(1.0f));
+        g_music.AddTrack(track);
+        g_musicNoteStarts.reserve(c_maxMusicNoteStarts);
+
+        // size the buses up front, so the audio thread doesn't allocate them
+        g_samplesBus.resize(CDemoMgr::c_planarReserveFrames);
+        g_musicBus.resize(CDemoMgr::c_planarReserveFrames);
+        g_duckingKeyBus.resize(CDemoMgr::c_planarReserveFrames);
+    }
 
     //--------------------------------------------------------------------------------------------------
     void OnExit() { }
 
     //--------------------------------------------------------------------------------------------------
-    SWavFile& GetWavFile(ESample sample) {
-        switch (sample) {
-            case e_drum1:   return g_sample_clap;
-            case e_drum2:   return g_sample_kick;
-            case e_music:   return g_sample_pvd;
-            default:        return g_sample_ting;
-        }
+    // Audio thread.  nullptr if the sample isn't loaded.
+    const SWavFile* GetWavFile(ESample sample) {
+        return CSampleRegistry::Get(g_sampleIds[sample]);
     }
 
     //--------------------------------------------------------------------------------------------------
     float GenerateMusicSample (size_t sample, float sampleRate) {
-        SWavFile& music = GetWavFile(e_music);
+        const SWavFile* music = GetWavFile(e_music);
 
-        // make the song loop by using modulus on the sample we were asked for
-        size_t numSamples = (music.m_numSamples / music.m_numChannels);
-        sample = sample % numSamples;
+        // the music is silent before it starts and after it's done, and if it isn't loaded
+        if (!music || sample >= music->GetNumFrames())
+            return 0.0f;
 
         // calculate and apply an envelope to the start and end of the sound
         const float c_envelopeTime = 0.005f;
@@ -71,45 +102,73 @@ namespace DemoDucking {
             ageInSeconds,
             0.0f, 0.0f,
             c_envelopeTime, 1.0f,
-            music.m_lengthSeconds - c_envelopeTime, 1.0f,
-            music.m_lengthSeconds, 0.0f
+            music->m_lengthSeconds - c_envelopeTime, 1.0f,
+            music->m_lengthSeconds, 0.0f
         );
 
         // return the current sample, multiplied by the envelope
-        size_t sampleIndex = sample*music.m_numChannels;
-        return music.m_samples[sampleIndex] * envelope;
+        return music->GetSample(sample, 0) * envelope;
     }
 
     //--------------------------------------------------------------------------------------------------
-    void GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
+    size_t GenerateAudioSamples (float **outputChannels, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
+
+        // the ducker turns the music down based on the level of the samples that want to duck it
+        static SCompressorEffect ducker;
+        static bool duckerInitialized = false;
+        if (!duckerInitialized) {
+            ducker.SetEffectParams(sampleRate, SCompressorEffect::EDetector::e_rms, -24.0f, 3.0f, 6.0f, 0.01f, 0.15f, 0.0f);
+            duckerInitialized = true;
+        }
 
         // handle starting or stopping music
         static bool musicWasOn = false;
-        static size_t musicStarted = 0;
         bool musicIsOn = g_musicOn;
         if (musicIsOn != musicWasOn) {
-            musicStarted = CDemoMgr::GetSampleClock();
             musicWasOn = musicIsOn;
+            if (musicIsOn) {
+                g_music.Start(CDemoMgr::GetSampleClock());
+            }
+            else {
+                g_music.Stop();
+                g_musicNoteStarts.clear();
+            }
         }
 
+        // start the music again if it loops around in this buffer
+        g_music.ScheduleBlock(CDemoMgr::GetSampleClock(), framesPerBuffer, sampleRate,
+            [] (const SSequencerEvent& event) {
+                if (g_musicNoteStarts.size() < c_maxMusicNoteStarts)
+                    g_musicNoteStarts.push_back(event.m_sampleClock);
+            }
+        );
+
+        // the buses are sized by OnInit(), so this only allocates if the buffer is bigger than that
+        if (g_samplesBus.size() < framesPerBuffer) {
+            g_samplesBus.resize(framesPerBuffer);
+            g_musicBus.resize(framesPerBuffer);
+            g_duckingKeyBus.resize(framesPerBuffer);
+        }
+        std::fill(g_samplesBus.begin(), g_samplesBus.begin() + framesPerBuffer, 0.0f);
+        std::fill(g_duckingKeyBus.begin(), g_duckingKeyBus.begin() + framesPerBuffer, 0.0f);
+
         // get a lock on our notes vector
         std::lock_guard<std::mutex> guard(g_notesMutex);
 
-        // for every sample in our output buffer
-        for (size_t sample = 0; sample < framesPerBuffer; ++sample, outputBuffer += numChannels) {
-            
-            // add up all samples to get the final value.
-            float value = 0.0f;
-            float duckingEnvelopeMax = 0.0f;
-            std::for_each(
-                g_notes.begin(),
-                g_notes.end(),
-                [&value, &duckingEnvelopeMax, numChannels, sampleRate](SNote& note) {
-
-                    SWavFile& wavFile = GetWavFile(note.m_sample);
-
-                    size_t sampleIndex = note.m_age*numChannels;
-                    if (sampleIndex >= wavFile.m_numSamples) {
+        // no samples or music are playing, so let the demo manager know this buffer is silent
+        if (g_notes.empty() && g_musicNoteStarts.empty())
+            return 0;
+
+        // render each sample note into the samples bus, and the ducking key bus if it ducks
+        std::for_each(
+            g_notes.begin(),
+            g_notes.end(),
+            [framesPerBuffer, sampleRate](SNote& note) {
+
+                const SWavFile* wavFile = GetWavFile(note.m_sample);
+
+                for (size_t sample = 0; sample < framesPerBuffer; ++sample) {
+                    if (!wavFile || note.m_age >= wavFile->GetNumFrames()) {
                         note.m_dead = true;
                         return;
                     }
@@ -120,41 +179,55 @@ namespace DemoDucking {
                         ageInSeconds,
                         0.0f, 0.0f,
                         0.1f, 1.0f,
-                        wavFile.m_lengthSeconds - 0.1f, 1.0f,
-                        wavFile.m_lengthSeconds, 0.0f
+                        wavFile->m_lengthSeconds - 0.1f, 1.0f,
+                        wavFile->m_lengthSeconds, 0.0f
                     );
+                    float value = wavFile->GetSample(note.m_age, 0) * envelope;
 
-                    float duckingEnvelope = Envelope4Pt(
-                        ageInSeconds,
-                        0.00f, 0.0f,
-                        0.10f, 1.0f,
-                        0.15f, 1.0f,
-                        0.20f, 0.0f
-                    );
-
-                    if (note.m_duck && duckingEnvelope > duckingEnvelopeMax)
-                        duckingEnvelopeMax = duckingEnvelope;
+                    if (note.m_duck)
+                        g_duckingKeyBus[sample] += value;
 
                     if (!note.m_muteSample)
-                        value += wavFile.m_samples[sampleIndex] * envelope;
+                        g_samplesBus[sample] += value;
                     ++note.m_age;
                 }
-            );
-
-            // don't completely duck the background music, so decrease our ducking envelope a bit
-            duckingEnvelopeMax *= dBToAmplitude(-3.0f);
+            }
+        );
 
-            // get our music sample, apply ducking, and add it to our other sample
-            float duckingEnvelope = (1.0f - duckingEnvelopeMax);
-            if (musicIsOn) {
-                float musicSample = GenerateMusicSample(CDemoMgr::GetSampleClock() + sample - musicStarted, sampleRate);
-                musicSample *= duckingEnvelope;
-                value += musicSample;
+        // render the music, and duck it based on the key bus
+        if (musicIsOn) {
+            std::fill(g_musicBus.begin(), g_musicBus.begin() + framesPerBuffer, 0.0f);
+            for (TSampleClock musicStarted : g_musicNoteStarts) {
+                for (size_t sample = 0; sample < framesPerBuffer; ++sample) {
+                    TSampleClock sampleClock = CDemoMgr::GetSampleClock() + sample;
+                    if (sampleClock >= musicStarted)
+                        g_musicBus[sample] += GenerateMusicSample(size_t(sampleClock - musicStarted), sampleRate);
+                }
             }
+            ducker.ProcessBuffer(&g_musicBus[0], &g_duckingKeyBus[0], framesPerBuffer);
+
+            // forget about music that has finished playing
+            const SWavFile* music = GetWavFile(e_music);
+            size_t musicLength = music ? music->GetNumFrames() : 0;
+            TSampleClock bufferEndClock = CDemoMgr::GetSampleClock() + framesPerBuffer;
+            g_musicNoteStarts.erase(
+                std::remove_if(
+                    g_musicNoteStarts.begin(),
+                    g_musicNoteStarts.end(),
+                    [musicLength, bufferEndClock] (TSampleClock musicStarted) {
+                        return musicStarted + musicLength <= bufferEndClock;
+                    }
+                ),
+                g_musicNoteStarts.end()
+            );
+        }
 
-            // copy the value to all audio channels
-            for (size_t channel = 0; channel < numChannels; ++channel)
-                outputBuffer[channel] = value;
+        // mix the buses into the mono output
+        for (size_t sample = 0; sample < framesPerBuffer; ++sample) {
+            float value = g_samplesBus[sample];
+            if (musicIsOn)
+                value += g_musicBus[sample];
+            outputChannels[0][sample] = value;
         }
 
         // remove notes that have died
@@ -166,8 +239,9 @@ namespace DemoDucking {
             }
         );
 
-        if (iter != g_notes.end())
-            g_notes.erase(iter);
+        g_notes.erase(iter, g_notes.end());
+
+        return 1;
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -175,6 +249,18 @@ namespace DemoDucking {
         printf("Music: %s\r\n", g_musicOn ? "On" : "Off");
     }
 
+    //--------------------------------------------------------------------------------------------------
+    void OnNote (float frequency, float velocity, bool pressed) {
+
+        // only listen to note on events
+        if (!pressed)
+            return;
+
+        // there's no pitch to the drums, so play the drum that ducks the music
+        std::lock_guard<std::mutex> guard(g_notesMutex);
+        g_notes.push_back(SNote(e_drum2, true, false));
+    }
+
     //--------------------------------------------------------------------------------------------------
     void OnKey (char key, bool pressed) {
 
@@ -182,8 +268,12 @@ namespace DemoDucking {
         if (!pressed)
             return;
 
-        // pressing 1 toggles music
+        // pressing 1 toggles music, if there is any
         if (key == '1') {
+            if (!g_haveMusic) {
+                printf("No music, pvd.wav is missing from the samples folder.\r\n");
+                return;
+            }
             g_musicOn = !g_musicOn;
             ReportParams();
             return;
@@ -220,6 +310,14 @@ namespace DemoDucking {
     void OnEnterDemo () {
         g_musicOn = false;
 
+        // load the samples, and loop the music as often as it is long
+        for (TSampleId sampleId : g_sampleIds)
+            CSampleRegistry::Prefetch(sampleId);
+        const SWavFile* music = CSampleRegistry::Prefetch(g_sampleIds[e_music]);
+        g_haveMusic = music && music->GetNumFrames() > 0;
+        if (g_haveMusic)
+            g_music.SetStepLength(music->m_lengthSeconds);
+
         printf("1 = toggle music\r\n");
         printf("QWE = drum samples\r\n");
         printf("ASD = drum samples with ducking\r\n");
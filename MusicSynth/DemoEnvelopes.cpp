@@ -30,6 +30,7 @@ namespace DemoEnvelopes {
     struct SNote {
         SNote(float frequency, EEnvelope envelope)
             : m_frequency(frequency)
+            , m_velocity(1.0f)
             , m_envelope(envelope)
             , m_age(0)
             , m_dead(false)
@@ -37,6 +38,7 @@ namespace DemoEnvelopes {
             , m_releaseAge(0) {}
 
         float       m_frequency;
+        float       m_velocity;
         EEnvelope   m_envelope;
         size_t      m_age;
         bool        m_dead;
@@ -187,8 +189,8 @@ namespace DemoEnvelopes {
                 c_releaseTime, 0.0f
             );
 
-            // kill the note when the release is done
-            if (secondsInRelease > c_releaseTime)
+            // kill the note when the release is done, or once it has faded below hearing
+            if (secondsInRelease > c_releaseTime || envelope < c_envelopeCullThreshold)
                 note.m_dead = true;
         }
 
@@ -219,13 +221,17 @@ namespace DemoEnvelopes {
     }
 
     //--------------------------------------------------------------------------------------------------
-    void GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
+    size_t GenerateAudioSamples (float **outputChannels, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
 
         // get a lock on our notes vector
         std::lock_guard<std::mutex> guard(g_notesMutex);
 
+        // nothing is playing, so let the demo manager know this buffer is silent
+        if (g_notes.empty())
+            return 0;
+
         // for every sample in our output buffer
-        for (size_t sample = 0; sample < framesPerBuffer; ++sample, outputBuffer += numChannels) {
+        for (size_t sample = 0; sample < framesPerBuffer; ++sample) {
             
             // add up all notes to get the final value.
             float value = 0.0f;
@@ -233,13 +239,12 @@ namespace DemoEnvelopes {
                 g_notes.begin(),
                 g_notes.end(),
                 [&value, sampleRate](SNote& note) {
-                    value += GenerateNoteSample(note, sampleRate);
+                    value += GenerateNoteSample(note, sampleRate) * note.m_velocity;
                 }
             );
 
-            // copy the value to all audio channels
-            for (size_t channel = 0; channel < numChannels; ++channel)
-                outputBuffer[channel] = value;
+            // write the value to the mono output
+            outputChannels[0][sample] = value;
         }
 
         // remove notes that have died
@@ -251,8 +256,9 @@ namespace DemoEnvelopes {
             }
         );
 
-        if (iter != g_notes.end())
-            g_notes.erase(iter);
+        g_notes.erase(iter, g_notes.end());
+
+        return 1;
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -279,6 +285,24 @@ namespace DemoEnvelopes {
         printf("Envelope: %s\r\n", EnvelopeToString(g_currentEnvelope));
     }
 
+    //--------------------------------------------------------------------------------------------------
+    void OnNote (float frequency, float velocity, bool pressed) {
+
+        // if releasing a note, we want to do nothing in most modes.
+        // in flute mode, we need to find and kill the flute note of the same frequency
+        if (!pressed) {
+            if (g_currentEnvelope == e_envelopeFlute) {
+                StopFluteNote(frequency);
+            }
+            return;
+        }
+
+        // get a lock on our notes vector and add the new note
+        std::lock_guard<std::mutex> guard(g_notesMutex);
+        g_notes.push_back(SNote(frequency, g_currentEnvelope));
+        g_notes.back().m_velocity = velocity;
+    }
+
     //--------------------------------------------------------------------------------------------------
     void OnKey (char key, bool pressed) {
 
@@ -346,19 +370,7 @@ namespace DemoEnvelopes {
             }
         }
 
-
-        // if releasing a note, we want to do nothing in most modes.
-        // in flute mode, we need to find and kill the flute note of the same frequency
-        if (!pressed) {
-            if (g_currentEnvelope == e_envelopeFlute) {
-                StopFluteNote(frequency);
-            }
-            return;
-        }
-
-        // get a lock on our notes vector and add the new note
-        std::lock_guard<std::mutex> guard(g_notesMutex);
-        g_notes.push_back(SNote(frequency, g_currentEnvelope));
+        CDemoMgr::QueueKeyNote(frequency, pressed);
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -49,24 +49,24 @@ namespace DemoFMSynth {
     struct SNote {
         SNote(float frequency, EMode mode)
             : m_frequency(frequency)
+            , m_velocity(1.0f)
             , m_mode(mode)
             , m_age(0)
             , m_dead(false)
             , m_wantsKeyRelease(false)
-            , m_releaseAge(0)
-            , m_phase(0.0f)
-            , m_phase2(0.0f)
-            , m_phase3(0.0f) {}
+            , m_releaseAge(0) {}
 
         float           m_frequency;
+        float           m_velocity;
         EMode           m_mode;
         size_t          m_age;
         bool            m_dead;
         bool            m_wantsKeyRelease;
         size_t          m_releaseAge;
-        float           m_phase;
-        float           m_phase2;
-        float           m_phase3;
+
+        SPhaseAccumulator   m_phase;
+        SPhaseAccumulator   m_phase2;
+        SPhaseAccumulator   m_phase3;
     };
 
     std::vector<SNote>  g_notes;
@@ -117,8 +117,8 @@ namespace DemoFMSynth {
                 c_envelopeTime, 0.0f
             );
 
-            // kill the note when the release is done
-            if (secondsInRelease > c_envelopeTime)
+            // kill the note when the release is done, or once it has faded below hearing
+            if (secondsInRelease > c_envelopeTime || envelope < c_envelopeCullThreshold)
                 note.m_dead = true;
         }
 
@@ -146,20 +146,20 @@ namespace DemoFMSynth {
     }
 
     //--------------------------------------------------------------------------------------------------
-    inline float AdvanceSineWave (float& phase, float frequency, float sampleRate) {
+    inline float AdvanceSineWave (SPhaseAccumulator& phase, float frequency, float sampleRate) {
 
         // calculate the sine wave value
         float ret = SineWave(phase);
 
-        // advance phase
-        phase = std::fmodf(phase + frequency / sampleRate, 1.0f);
+        // advance phase.  The frequency is modulated every sample, so the increment is too.
+        phase.Advance(SPhaseAccumulator::FrequencyToIncrement(frequency, sampleRate));
 
         // return the sine wave value
         return ret;
     }
 
     //--------------------------------------------------------------------------------------------------
-    inline float FMOperator (float& phase, float frequency, float modulationSample, float envelopeSample, float sampleRate) {
+    inline float FMOperator (SPhaseAccumulator& phase, float frequency, float modulationSample, float envelopeSample, float sampleRate) {
         return AdvanceSineWave(phase, frequency + modulationSample, sampleRate) * envelopeSample;
     }
 
@@ -238,13 +238,17 @@ namespace DemoFMSynth {
     }
 
     //--------------------------------------------------------------------------------------------------
-    void GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
+    size_t GenerateAudioSamples (float **outputChannels, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
 
         // get a lock on our notes vector
         std::lock_guard<std::mutex> guard(g_notesMutex);
 
+        // nothing is playing, so let the demo manager know this buffer is silent
+        if (g_notes.empty())
+            return 0;
+
         // for every sample in our output buffer
-        for (size_t sample = 0; sample < framesPerBuffer; ++sample, outputBuffer += numChannels) {
+        for (size_t sample = 0; sample < framesPerBuffer; ++sample) {
             
             // add up all notes to get the final value.
             float value = 0.0f;
@@ -252,13 +256,12 @@ namespace DemoFMSynth {
                 g_notes.begin(),
                 g_notes.end(),
                 [&value, sampleRate](SNote& note) {
-                    value += GenerateNoteSample(note, sampleRate);
+                    value += GenerateNoteSample(note, sampleRate) * note.m_velocity;
                 }
             );
 
-            // copy the value to all audio channels
-            for (size_t channel = 0; channel < numChannels; ++channel)
-                outputBuffer[channel] = value;
+            // write the value to the mono output
+            outputChannels[0][sample] = value;
         }
 
         // remove notes that have died
@@ -270,8 +273,9 @@ namespace DemoFMSynth {
             }
         );
 
-        if (iter != g_notes.end())
-            g_notes.erase(iter);
+        g_notes.erase(iter, g_notes.end());
+
+        return 1;
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -292,6 +296,21 @@ namespace DemoFMSynth {
         );
     }
 
+    //--------------------------------------------------------------------------------------------------
+    void OnNote (float frequency, float velocity, bool pressed) {
+
+        // if releasing a note, we need to find and kill the flute note of the same frequency
+        if (!pressed) {
+            StopNote(frequency);
+            return;
+        }
+
+        // get a lock on our notes vector and add the new note
+        std::lock_guard<std::mutex> guard(g_notesMutex);
+        g_notes.push_back(SNote(frequency, g_mode));
+        g_notes.back().m_velocity = velocity;
+    }
+
     //--------------------------------------------------------------------------------------------------
     void OnKey (char key, bool pressed) {
 
@@ -364,15 +383,7 @@ namespace DemoFMSynth {
             }
         }
 
-        // if releasing a note, we need to find and kill the flute note of the same frequency
-        if (!pressed) {
-            StopNote(frequency);
-            return;
-        }
-
-        // get a lock on our notes vector and add the new note
-        std::lock_guard<std::mutex> guard(g_notesMutex);
-        g_notes.push_back(SNote(frequency, g_mode));
+        CDemoMgr::QueueKeyNote(frequency, pressed);
     }
 
     //--------------------------------------------------------------------------------------------------
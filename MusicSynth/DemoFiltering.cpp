@@ -7,6 +7,7 @@
 
 #include "DemoMgr.h"
 #include "AudioEffects.h"
+#include "Sequencer.h"
 #include <algorithm>
 #include "Samples.h"
 
@@ -56,18 +57,24 @@ namespace DemoFiltering {
     struct SNote {
         SNote(float frequency, EWaveForm waveForm)
             : m_frequency(frequency)
+            , m_velocity(1.0f)
             , m_waveForm(waveForm)
             , m_age(0)
             , m_dead(false)
             , m_wantsKeyRelease(false)
-            , m_releaseAge(0) {}
+            , m_releaseAge(0)
+            , m_phase(frequency, CDemoMgr::GetSampleRate()) {}
 
         float       m_frequency;
+        float       m_velocity;
         EWaveForm   m_waveForm;
         size_t      m_age;
         bool        m_dead;
         bool        m_wantsKeyRelease;
         size_t      m_releaseAge;
+
+        SPhaseAccumulator       m_phase;
+        SStateVariableFilter    m_filter;
     };
 
     std::vector<SNote>  g_notes;
@@ -76,12 +83,43 @@ namespace DemoFiltering {
 
     EEffect             g_lpf;
     EEffect             g_hpf;
+    TSampleId           g_sampleCymbal;
+    TSampleId           g_sampleVoice;
 
     bool                g_rhythmOn;
     bool                g_masterOutLPFOn;
+    bool                g_noteFilterOn;
+
+    // the background rhythm, and the notes it has started.  Only touched by the audio thread once set up.
+    struct SRhythmNote {
+        uint32_t        m_phaseIncrement;
+        TSampleClock    m_startClock;
+        size_t          m_length;
+    };
+
+    CStepSequencer              g_rhythm;
+    std::vector<SRhythmNote>    g_rhythmNotes;
 
     //--------------------------------------------------------------------------------------------------
-    void OnInit() { }
+    void OnInit() {
+        g_sampleCymbal = CSampleRegistry::Find("cymbal");
+        g_sampleVoice = CSampleRegistry::Find("legend1");
+
+        // an arpeggio jumping between octaves, that moves up a whole step halfway through.
+        // 8 notes a second, each lasting a step.
+        static const int c_notes[2][4] = {
+            { 0, 0, 3, 3 },
+            { 2, 2, 5, 5 }
+        };
+        SSequencerTrack track;
+        for (size_t step = 0; step < 32; ++step) {
+            int octave = step % 2 == 0 ? 2 : 1;
+            track.m_steps.push_back(SSequencerStep(NoteToFrequency(octave, c_notes[step / 16][step % 4])));
+        }
+        g_rhythm.AddTrack(track);
+        g_rhythm.SetTempo(120.0f, 4);
+        g_rhythmNotes.reserve(16);
+    }
 
     //--------------------------------------------------------------------------------------------------
     void OnExit() { }
@@ -125,8 +163,8 @@ namespace DemoFiltering {
                 c_envelopeTime, 0.0f
             );
 
-            // kill the note when the release is done
-            if (secondsInRelease > c_envelopeTime)
+            // kill the note when the release is done, or once it has faded below hearing
+            if (secondsInRelease > c_envelopeTime || envelope < c_envelopeCullThreshold)
                 note.m_dead = true;
         }
 
@@ -134,11 +172,10 @@ namespace DemoFiltering {
     }
 
     //--------------------------------------------------------------------------------------------------
-    inline float SampleAudioSample(SNote& note, SWavFile& sample, float ageInSeconds) {
+    inline float SampleAudioSample(SNote& note, const SWavFile* sample, float ageInSeconds) {
 
-        // handle the note dieing when it is done
-        size_t sampleIndex = note.m_age*sample.m_numChannels;
-        if (sampleIndex >= sample.m_numSamples) {
+        // handle the note dieing when it is done, or if the sample isn't loaded
+        if (!sample || note.m_age >= sample->GetNumFrames()) {
             note.m_dead = true;
             return 0.0f;
         }
@@ -148,16 +185,31 @@ namespace DemoFiltering {
             ageInSeconds,
             0.0f, 0.0f,
             0.1f, 1.0f,
-            sample.m_lengthSeconds - 0.1f, 1.0f,
-            sample.m_lengthSeconds, 0.0f
+            sample->m_lengthSeconds - 0.1f, 1.0f,
+            sample->m_lengthSeconds, 0.0f
         );
 
         // return the sample value multiplied by the envelope
-        return sample.m_samples[sampleIndex] * envelope;
+        return sample->GetSample(note.m_age, 0) * envelope;
     }
 
     //--------------------------------------------------------------------------------------------------
-    inline float GenerateNoteSample (SNote& note, float sampleRate) {
+    inline float ApplyNoteFilter (SNote& note, float value, float ageInSeconds, float sampleRate) {
+
+        // each note has its own low pass filter, with the cutoff swept by an envelope, like a
+        // subtractive synth.  The cutoff opens quickly and then decays back down.
+        float filterEnvelope = Envelope3Pt(
+            ageInSeconds,
+            0.00f, 0.0f,
+            0.01f, 1.0f,
+            0.60f, 0.0f
+        );
+        note.m_filter.SetCutoff(Lerp(150.0f, 4000.0f, filterEnvelope), sampleRate);
+        return note.m_filter.AddSample(value).m_lowPass;
+    }
+
+    //--------------------------------------------------------------------------------------------------
+    inline float GenerateNoteSample (SNote& note, float sampleRate, bool noteFilterOn) {
 
         // calculate our age in seconds and advance our age in samples, by 1 sample
         float ageInSeconds = float(note.m_age) / sampleRate;
@@ -167,78 +219,77 @@ namespace DemoFiltering {
         // decrease note volume a bit, because the volume adjustments don't seem to be quite enough
         float envelope = GenerateEnvelope(note, ageInSeconds, sampleRate) * 0.8f;
 
-        // generate the audio sample value for the current time.
-        // Note that it is ok that we are basing audio samples on age instead of phase, because the
-        // frequency never changes and we envelope the front and back to avoid popping.
-        float phase = std::fmodf(ageInSeconds * note.m_frequency, 1.0f);
+        // generate the audio sample value for the current phase, and advance the phase by 1 sample
+        SPhaseAccumulator phase = note.m_phase;
+        note.m_phase.Advance();
+        float value = 0.0f;
         switch (note.m_waveForm) {
-            case e_waveSine:        return SineWave(phase) * envelope;
-            case e_waveSaw:         return SawWave(phase) * envelope;
-            case e_waveSquare:      return SquareWave(phase)  * envelope;
-            case e_waveTriangle:    return TriangleWave(phase)  * envelope;
-            case e_sampleCymbals:   return SampleAudioSample(note, g_sample_cymbal, ageInSeconds);
-            case e_sampleVoice:     return SampleAudioSample(note, g_sample_legend1, ageInSeconds);
+            case e_waveSine:        value = SineWave(phase) * envelope; break;
+            case e_waveSaw:         value = SawWave(phase.GetPhase()) * envelope; break;
+            case e_waveSquare:      value = SquareWave(phase.GetPhase())  * envelope; break;
+            case e_waveTriangle:    value = TriangleWave(phase.GetPhase())  * envelope; break;
+            case e_sampleCymbals:   value = SampleAudioSample(note, CSampleRegistry::Get(g_sampleCymbal), ageInSeconds); break;
+            case e_sampleVoice:     value = SampleAudioSample(note, CSampleRegistry::Get(g_sampleVoice), ageInSeconds); break;
         }
 
-        return 0.0f;
+        // apply the per note filter if we should
+        if (noteFilterOn)
+            value = ApplyNoteFilter(note, value, ageInSeconds, sampleRate);
+
+        return value;
     }
 
     //--------------------------------------------------------------------------------------------------
-    float GenerateRhythm (size_t sampleIndex, float sampleRate) {
-        size_t beatSize = size_t(sampleRate) / 8;
-        float beatTime = float(beatSize) / sampleRate;
+    float GenerateRhythmNoteSample (const SRhythmNote& note, TSampleClock sampleClock, float sampleRate) {
 
-        size_t beatIndex = sampleIndex / beatSize;
-        size_t beatOffset = sampleIndex % beatSize;
-        float timeInSeconds = float(beatOffset) / sampleRate;
-        
-        beatIndex = beatIndex % 32;
+        // notes can be scheduled to start part way through the buffer
+        if (sampleClock < note.m_startClock)
+            return 0.0f;
 
-        float frequency = 0.0f;
-        if (beatIndex < 16) {
-            beatIndex = beatIndex % 4;
-            switch (beatIndex) {
-                case 0: frequency = NoteToFrequency(2, 0); break;
-                case 1: frequency = NoteToFrequency(1, 0); break;
-                case 2: frequency = NoteToFrequency(2, 3); break;
-                case 3: frequency = NoteToFrequency(1, 3); break;
-            }
-        }
-        else {
-            beatIndex = beatIndex % 4;
-            switch (beatIndex) {
-                case 0: frequency = NoteToFrequency(2, 2); break;
-                case 1: frequency = NoteToFrequency(1, 2); break;
-                case 2: frequency = NoteToFrequency(2, 5); break;
-                case 3: frequency = NoteToFrequency(1, 5); break;
-            }
-        }
+        float timeInSeconds = float(sampleClock - note.m_startClock) / sampleRate;
+        float lengthInSeconds = float(note.m_length) / sampleRate;
 
-        float phase = std::fmodf(timeInSeconds * frequency, 1.0f);
+        // the phase is exact at any time from the start of the note, since it wraps around for free
+        uint32_t phase = uint32_t(sampleClock - note.m_startClock) * note.m_phaseIncrement;
 
         float envelope = Envelope3Pt(
             timeInSeconds,
             0.0f, 0.0f,
             0.1f, 1.0f,
-            beatTime, 0.0f
+            lengthInSeconds, 0.0f
         );
 
         switch (g_currentWaveForm) {
-            case e_waveSine:        return SineWave(phase) * envelope;
-            case e_waveSaw:         return SawWave(phase) * envelope;
-            case e_waveSquare:      return SquareWave(phase) * envelope;
-            case e_waveTriangle:    return TriangleWave(phase) * envelope;
+            case e_waveSine:        return SineWaveFixed(phase) * envelope;
+            case e_waveSaw:         return SawWave(SPhaseAccumulator::ToFloat(phase)) * envelope;
+            case e_waveSquare:      return SquareWave(SPhaseAccumulator::ToFloat(phase)) * envelope;
+            case e_waveTriangle:    return TriangleWave(SPhaseAccumulator::ToFloat(phase)) * envelope;
         }
         return 0.0f;
     }
 
     //--------------------------------------------------------------------------------------------------
-    void GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
+    float LPFLFOFrequency (TSampleClock sampleClock, float sampleRate) {
+        float LFOValue = SineWave(SampleClockToPhase(sampleClock, 1.0 / 7.0, sampleRate));
+        return ScaleBiPolarValue(LFOValue, 250, 1500);
+    }
+
+    //--------------------------------------------------------------------------------------------------
+    float HPFLFOFrequency (TSampleClock sampleClock, float sampleRate) {
+        return SineWave(SampleClockToPhase(sampleClock, 0.125, sampleRate)) * 225.0f + 450.0f;
+    }
+
+    //--------------------------------------------------------------------------------------------------
+    size_t GenerateAudioSamples (float **outputChannels, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
 
         // size of resonating peak
         const float Q = 2.0f;
         static const int c_numFilters = 4;
 
+        // LFO controlled filters only calculate new coefficients this often (in samples), and ramp
+        // the coefficients smoothly between them.
+        static const size_t c_controlRate = 32;
+
         // a LPF to apply at the end to keep things from getting too gnarly
         static SBiQuad masterOutLPF;
         static bool masterOutLPFInited = false;
@@ -247,6 +298,7 @@ namespace DemoFiltering {
             masterOutLPFInited = true;
         }
         bool masterOutLPFOn = g_masterOutLPFOn;
+        bool noteFilterOn = g_noteFilterOn;
 
         // update our low pass filter
         static SBiQuad lowPassFilter[c_numFilters];
@@ -271,6 +323,12 @@ namespace DemoFiltering {
                         lowPassFilter[i].SetEffectParams(SBiQuad::EType::e_lowPass, 220.0f, sampleRate, Q, 1.0f);
                     break;
                 }
+                case e_LFO: {
+                    float LFOfrequency = LPFLFOFrequency(CDemoMgr::GetSampleClock(), sampleRate);
+                    for (int i = 0; i < c_numFilters; ++i)
+                        lowPassFilter[i].SetEffectParams(SBiQuad::EType::e_lowPass, LFOfrequency, sampleRate, Q, 1.0f);
+                    break;
+                }
             }
         }
 
@@ -293,37 +351,70 @@ namespace DemoFiltering {
                     for (int i = 0; i < c_numFilters; ++i)
                         highPassFilter[i].SetEffectParams(SBiQuad::EType::e_highPass, 1760.0f, sampleRate, Q, 1.0f);
                     break;
+                case e_LFO: {
+                    float LFOfrequency = HPFLFOFrequency(CDemoMgr::GetSampleClock(), sampleRate);
+                    for (int i = 0; i < c_numFilters; ++i)
+                        highPassFilter[i].SetEffectParams(SBiQuad::EType::e_highPass, LFOfrequency, sampleRate, Q, 1.0f);
+                    break;
+                }
             }
         }
 
         // handle auto generated rhythm starting and stopping
         static bool rhythmWasOn = false;
         bool rhythmIsOn = g_rhythmOn;
-        static size_t rhythmStart = 0;
         if (rhythmWasOn != rhythmIsOn) {
             rhythmWasOn = rhythmIsOn;
-            rhythmStart = CDemoMgr::GetSampleClock();
+            if (rhythmIsOn) {
+                g_rhythm.Start(CDemoMgr::GetSampleClock());
+            }
+            else {
+                g_rhythm.Stop();
+                g_rhythmNotes.clear();
+            }
         }
 
+        // start any rhythm notes that land in this buffer
+        g_rhythm.ScheduleBlock(CDemoMgr::GetSampleClock(), framesPerBuffer, sampleRate,
+            [sampleRate] (const SSequencerEvent& event) {
+                SRhythmNote note;
+                note.m_phaseIncrement = SPhaseAccumulator::FrequencyToIncrement(event.m_frequency, sampleRate);
+                note.m_startClock = event.m_sampleClock;
+                note.m_length = event.m_lengthSamples;
+                g_rhythmNotes.push_back(note);
+            }
+        );
+
         // get a lock on our notes vector
         std::lock_guard<std::mutex> guard(g_notesMutex);
 
+        // no notes or rhythm notes are playing, so let the demo manager know this buffer is silent
+        if (g_notes.empty() && g_rhythmNotes.empty())
+            return 0;
+
         // for every sample in our output buffer
-        for (size_t sample = 0; sample < framesPerBuffer; ++sample, outputBuffer += numChannels) {
+        for (size_t sample = 0; sample < framesPerBuffer; ++sample) {
             
-            // handle LFO controlled LPF
-            if (currentLPF == e_LFO) {
-                float LFOValue = std::sinf(float(CDemoMgr::GetSampleClock()) * (1.0f / 7.0f) / sampleRate*2.0f*c_pi);
-                float LFOfrequency = ScaleBiPolarValue(LFOValue, 250, 1500);
-                for (int i = 0; i < c_numFilters; ++i)
-                    lowPassFilter[i].SetEffectParams(SBiQuad::EType::e_lowPass, LFOfrequency, sampleRate, Q, 1.0f);
-            }
+            // at the start of each control block, calculate where the LFO will be at the end of the
+            // block, and have the filters ramp their coefficients there.  All filters in the cascade
+            // share the same coefficients, so they only need to be calculated once.
+            if (sample % c_controlRate == 0) {
+                size_t rampSamples = std::min(c_controlRate, framesPerBuffer - sample);
+                TSampleClock rampEndClock = CDemoMgr::GetSampleClock() + sample + rampSamples;
+
+                // handle LFO controlled LPF
+                if (currentLPF == e_LFO) {
+                    SBiQuad::SCoefficients coefficients = SBiQuad::CalculateCoefficients(SBiQuad::EType::e_lowPass, LPFLFOFrequency(rampEndClock, sampleRate), sampleRate, Q, 1.0f);
+                    for (int i = 0; i < c_numFilters; ++i)
+                        lowPassFilter[i].RampToCoefficients(coefficients, rampSamples);
+                }
 
-            // handle LFO controlled HPF
-            if (currentHPF == e_LFO) {
-                float LFOfrequency = std::sinf(float(CDemoMgr::GetSampleClock()) * 0.125f / sampleRate*2.0f*c_pi) * 225.0f + 450.0f;
-                for (int i = 0; i < c_numFilters; ++i)
-                    highPassFilter[i].SetEffectParams(SBiQuad::EType::e_highPass, LFOfrequency, sampleRate, Q, 1.0f);
+                // handle LFO controlled HPF
+                if (currentHPF == e_LFO) {
+                    SBiQuad::SCoefficients coefficients = SBiQuad::CalculateCoefficients(SBiQuad::EType::e_highPass, HPFLFOFrequency(rampEndClock, sampleRate), sampleRate, Q, 1.0f);
+                    for (int i = 0; i < c_numFilters; ++i)
+                        highPassFilter[i].RampToCoefficients(coefficients, rampSamples);
+                }
             }
 
             // add up all notes to get the final value.
@@ -331,14 +422,14 @@ namespace DemoFiltering {
             std::for_each(
                 g_notes.begin(),
                 g_notes.end(),
-                [&value, sampleRate](SNote& note) {
-                    value += GenerateNoteSample(note, sampleRate);
+                [&value, sampleRate, noteFilterOn](SNote& note) {
+                    value += GenerateNoteSample(note, sampleRate, noteFilterOn) * note.m_velocity;
                 }
             );
 
-            // generate rhythm notes if we should
-            if (rhythmIsOn)
-                value += GenerateRhythm(CDemoMgr::GetSampleClock() - rhythmStart + sample, sampleRate);
+            // add in the rhythm notes
+            for (const SRhythmNote& note : g_rhythmNotes)
+                value += GenerateRhythmNoteSample(note, CDemoMgr::GetSampleClock() + sample, sampleRate);
 
             // apply lpf
             if (currentLPF != e_none) {
@@ -356,9 +447,8 @@ namespace DemoFiltering {
             if (masterOutLPFOn)
                 value = masterOutLPF.AddSample(value);
 
-            // copy the value to all audio channels
-            for (size_t channel = 0; channel < numChannels; ++channel)
-                outputBuffer[channel] = value;
+            // write the value to the mono output
+            outputChannels[0][sample] = value;
         }
 
         // remove notes that have died
@@ -370,8 +460,22 @@ namespace DemoFiltering {
             }
         );
 
-        if (iter != g_notes.end())
-            g_notes.erase(iter);
+        g_notes.erase(iter, g_notes.end());
+
+        // remove rhythm notes that are done
+        TSampleClock bufferEndClock = CDemoMgr::GetSampleClock() + framesPerBuffer;
+        g_rhythmNotes.erase(
+            std::remove_if(
+                g_rhythmNotes.begin(),
+                g_rhythmNotes.end(),
+                [bufferEndClock] (const SRhythmNote& note) {
+                    return note.m_startClock + note.m_length <= bufferEndClock;
+                }
+            ),
+            g_rhythmNotes.end()
+        );
+
+        return 1;
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -394,7 +498,22 @@ namespace DemoFiltering {
 
     //--------------------------------------------------------------------------------------------------
     void ReportParams () {
-        printf("Instrument: %s  LPF: %s  HPF: %s  master out lpf = %s\r\n", WaveFormToString(g_currentWaveForm), EffectToString(g_lpf), EffectToString(g_hpf), g_masterOutLPFOn ? "On" : "Off");
+        printf("Instrument: %s  LPF: %s  HPF: %s  master out lpf = %s  note filter = %s\r\n", WaveFormToString(g_currentWaveForm), EffectToString(g_lpf), EffectToString(g_hpf), g_masterOutLPFOn ? "On" : "Off", g_noteFilterOn ? "On" : "Off");
+    }
+
+    //--------------------------------------------------------------------------------------------------
+    void OnNote (float frequency, float velocity, bool pressed) {
+
+        // if releasing a note, we need to find and kill the flute note of the same frequency
+        if (!pressed) {
+            StopNote(frequency);
+            return;
+        }
+
+        // get a lock on our notes vector and add the new note
+        std::lock_guard<std::mutex> guard(g_notesMutex);
+        g_notes.push_back(SNote(frequency, g_currentWaveForm));
+        g_notes.back().m_velocity = velocity;
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -437,6 +556,11 @@ namespace DemoFiltering {
                     ReportParams();
                     return;
                 }
+                case -67: {
+                    g_noteFilterOn = !g_noteFilterOn;
+                    ReportParams();
+                    return;
+                }
             }
         }
 
@@ -494,27 +618,24 @@ namespace DemoFiltering {
             }
         }
 
-        // if releasing a note, we need to find and kill the flute note of the same frequency
-        if (!pressed) {
-            StopNote(frequency);
-            return;
+        if (pressed) {
+            double time = SampleClockToSeconds(CDemoMgr::GetSampleClock(), CDemoMgr::GetSampleRate());
+            printf("%c : %0.2f\r\n", key, time);
         }
 
-        float time = float(CDemoMgr::GetSampleClock()) / CDemoMgr::GetSampleRate();
-        printf("%c : %0.2f\r\n", key, time);
-
-        // get a lock on our notes vector and add the new note
-        std::lock_guard<std::mutex> guard(g_notesMutex);
-        g_notes.push_back(SNote(frequency, g_currentWaveForm));
+        CDemoMgr::QueueKeyNote(frequency, pressed);
     }
 
     //--------------------------------------------------------------------------------------------------
     void OnEnterDemo () {
+        CSampleRegistry::Prefetch(g_sampleCymbal);
+        CSampleRegistry::Prefetch(g_sampleVoice);
         g_currentWaveForm = e_waveSine;
         g_lpf = e_none;
         g_hpf = e_none;
         g_rhythmOn = false;
         g_masterOutLPFOn = false;
+        g_noteFilterOn = false;
         printf("Letter keys to play notes.\r\nleft shift / control is super low frequency.\r\n");
         printf("1 = Sine\r\n");
         printf("2 = Saw\r\n");
@@ -526,6 +647,7 @@ namespace DemoFiltering {
         printf("8 = cycle High Pass Filter\r\n");
         printf("9 = Toggle afzv / dhcn\r\n");
         printf("0 = toggle master out lpf\r\n");
+        printf("- = toggle per note envelope filter\r\n");
         printf("\r\nInstructions:\r\n");
         printf("show how lpf / hpf work, then show some notes on LFO.\r\n");
         printf("sine not as interesting, not as much to cut away.\r\n");
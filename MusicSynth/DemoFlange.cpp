@@ -7,6 +7,7 @@
 
 #include "DemoMgr.h"
 #include "AudioEffects.h"
+#include "AudioGraph.h"
 #include <algorithm>
 #include "Samples.h"
 
@@ -56,27 +57,45 @@ namespace DemoFlange {
     struct SNote {
         SNote(float frequency, EWaveForm waveForm)
             : m_frequency(frequency)
+            , m_velocity(1.0f)
             , m_waveForm(waveForm)
             , m_age(0)
             , m_dead(false)
             , m_wantsKeyRelease(false)
-            , m_releaseAge(0) {}
+            , m_releaseAge(0)
+            , m_phase(frequency, CDemoMgr::GetSampleRate()) {}
 
         float       m_frequency;
+        float       m_velocity;
         EWaveForm   m_waveForm;
         size_t      m_age;
         bool        m_dead;
         bool        m_wantsKeyRelease;
         size_t      m_releaseAge;
+
+        SPhaseAccumulator   m_phase;
     };
 
     std::vector<SNote>  g_notes;
     std::mutex          g_notesMutex;
     EWaveForm           g_currentWaveForm;
     EEffect             g_effect;
+    TSampleId           g_sampleCymbal;
+    TSampleId           g_sampleVoice;
+
+    // the signal chain.  Rebuilt on the main thread whenever the effect changes.
+    CAudioGraphPlayer   g_graphPlayer;
+    static const size_t c_maxFramesPerBuffer = 1024;
+
+    // the notes are split into this many sources, which the worker pool can render at the same time
+    static const size_t c_numVoiceGroups = 4;
 
     //--------------------------------------------------------------------------------------------------
-    void OnInit() { }
+    void OnInit() {
+        g_sampleCymbal = CSampleRegistry::Find("cymbal");
+        g_sampleVoice = CSampleRegistry::Find("legend1");
+        g_graphPlayer.SetWorkerPool(&CDemoMgr::GetWorkerPool());
+    }
 
     //--------------------------------------------------------------------------------------------------
     void OnExit() { }
@@ -120,8 +139,8 @@ namespace DemoFlange {
                 c_envelopeTime, 0.0f
             );
 
-            // kill the note when the release is done
-            if (secondsInRelease > c_envelopeTime)
+            // kill the note when the release is done, or once it has faded below hearing
+            if (secondsInRelease > c_envelopeTime || envelope < c_envelopeCullThreshold)
                 note.m_dead = true;
         }
 
@@ -129,11 +148,10 @@ namespace DemoFlange {
     }
 
     //--------------------------------------------------------------------------------------------------
-    inline float SampleAudioSample(SNote& note, SWavFile& sample, float ageInSeconds) {
+    inline float SampleAudioSample(SNote& note, const SWavFile* sample, float ageInSeconds) {
 
-        // handle the note dieing when it is done
-        size_t sampleIndex = note.m_age*sample.m_numChannels;
-        if (sampleIndex >= sample.m_numSamples) {
+        // handle the note dieing when it is done, or if the sample isn't loaded
+        if (!sample || note.m_age >= sample->GetNumFrames()) {
             note.m_dead = true;
             return 0.0f;
         }
@@ -143,12 +161,12 @@ namespace DemoFlange {
             ageInSeconds,
             0.0f, 0.0f,
             0.1f, 1.0f,
-            sample.m_lengthSeconds - 0.1f, 1.0f,
-            sample.m_lengthSeconds, 0.0f
+            sample->m_lengthSeconds - 0.1f, 1.0f,
+            sample->m_lengthSeconds, 0.0f
         );
 
         // return the sample value multiplied by the envelope
-        return sample.m_samples[sampleIndex] * envelope;
+        return sample->GetSample(note.m_age, 0) * envelope;
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -162,82 +180,112 @@ namespace DemoFlange {
         // decrease note volume a bit, because the volume adjustments don't seem to be quite enough
         float envelope = GenerateEnvelope(note, ageInSeconds, sampleRate) * 0.8f;
 
-        // generate the audio sample value for the current time.
-        // Note that it is ok that we are basing audio samples on age instead of phase, because the
-        // frequency never changes and we envelope the front and back to avoid popping.
-        float phase = std::fmodf(ageInSeconds * note.m_frequency, 1.0f);
+        // generate the audio sample value for the current phase, and advance the phase by 1 sample
+        SPhaseAccumulator phase = note.m_phase;
+        note.m_phase.Advance();
         switch (note.m_waveForm) {
             case e_waveSine:        return SineWave(phase) * envelope;
-            case e_waveSaw:         return SawWaveBandLimited(phase, 10) * envelope;
-            case e_waveSquare:      return SquareWaveBandLimited(phase, 10) * envelope;
-            case e_waveTriangle:    return TriangleWaveBandLimited(phase, 10) * envelope;
-            case e_sampleCymbals:   return SampleAudioSample(note, g_sample_cymbal, ageInSeconds);
-            case e_sampleVoice:     return SampleAudioSample(note, g_sample_legend1, ageInSeconds);
+            case e_waveSaw:         return SawWaveBandLimited(phase.GetPhase(), 10) * envelope;
+            case e_waveSquare:      return SquareWaveBandLimited(phase.GetPhase(), 10) * envelope;
+            case e_waveTriangle:    return TriangleWaveBandLimited(phase.GetPhase(), 10) * envelope;
+            case e_sampleCymbals:   return SampleAudioSample(note, CSampleRegistry::Get(g_sampleCymbal), ageInSeconds);
+            case e_sampleVoice:     return SampleAudioSample(note, CSampleRegistry::Get(g_sampleVoice), ageInSeconds);
         }
 
         return 0.0f;
     }
 
     //--------------------------------------------------------------------------------------------------
-    void GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
-
-        // initialize our effects
-        static SFlangeEffect flangeEffect;
-        static SMultiTapReverbEffect reverbEffect;
-        static bool effectsInitialized = false;
-        if (!effectsInitialized) {
-            reverbEffect.SetEffectParams(sampleRate, numChannels);
-            effectsInitialized = true;
+    // returns whether the voice group is silent, which it is when it has no notes
+    bool RenderVoiceGroup (size_t voiceGroup, float *buffer, size_t framesPerBuffer, float sampleRate) {
+
+        // Each voice group renders every c_numVoiceGroups'th note, so the groups can run in parallel.
+        // GenerateAudioSamples holds the notes lock for us while the graph runs.
+        for (size_t index = voiceGroup; index < g_notes.size(); index += c_numVoiceGroups) {
+            SNote& note = g_notes[index];
+            for (size_t sample = 0; sample < framesPerBuffer; ++sample)
+                buffer[sample] += GenerateNoteSample(note, sampleRate) * note.m_velocity;
         }
+        return voiceGroup >= g_notes.size();
+    }
 
-        // update our effect parameters if parameters have changed
-        static EEffect lastEffect = e_none;
-        EEffect currentEffect = g_effect;
-        if (currentEffect != lastEffect) {
-            lastEffect = currentEffect;
-
-            flangeEffect.ClearBuffer();
-            reverbEffect.ClearBuffer();
+    //--------------------------------------------------------------------------------------------------
+    void BuildGraph (EEffect effect) {
+        float sampleRate = CDemoMgr::GetSampleRate();
+
+        // voice groups -> notes bus -> flange -> reverb -> master, skipping whichever effects are off.
+        // The effects are created fresh each time, so they start out with clear buffers.
+        CAudioGraph graph;
+        CAudioGraph::TNodeId lastNode = graph.AddBus();
+        for (size_t voiceGroup = 0; voiceGroup < c_numVoiceGroups; ++voiceGroup) {
+            CAudioGraph::TNodeId voiceGroupNode = graph.AddSource(
+                [voiceGroup] (float *buffer, size_t framesPerBuffer, float sampleRate, bool silent) {
+                    return RenderVoiceGroup(voiceGroup, buffer, framesPerBuffer, sampleRate);
+                }
+            );
+            graph.Connect(voiceGroupNode, lastNode);
+        }
 
-            switch (currentEffect) {
+        if (effect != e_none) {
+            // the depths are what the flange has always sounded like, from when its buffer was sized
+            // for interleaved stereo
+            std::shared_ptr<SFlangeEffect> flangeEffect = std::make_shared<SFlangeEffect>();
+            switch (effect) {
                 case e_flangeSlowAndReverb:
-                case e_flangeSlow: flangeEffect.SetEffectParams(sampleRate, numChannels, 0.4f, 0.001f); break;
-                case e_flangeFast: flangeEffect.SetEffectParams(sampleRate, numChannels, 1.2f, 0.001f); break;
-                case e_flangeFastAndDeep: flangeEffect.SetEffectParams(sampleRate, numChannels, 1.2f, 0.005f); break;
+                case e_flangeSlow: flangeEffect->SetEffectParams(sampleRate, 0.4f, 0.002f); break;
+                case e_flangeFast: flangeEffect->SetEffectParams(sampleRate, 1.2f, 0.002f); break;
+                case e_flangeFastAndDeep: flangeEffect->SetEffectParams(sampleRate, 1.2f, 0.01f); break;
             }
-        }
 
-        // get a lock on our notes vector
-        std::lock_guard<std::mutex> guard(g_notesMutex);
+            CAudioGraph::TNodeId flangeNode = graph.AddEffect(
+                [flangeEffect] (float *buffer, size_t framesPerBuffer, float sampleRate, bool silent) {
+                    // sleep through silence once the flange has emptied out
+                    if (silent && flangeEffect->IsAsleep()) {
+                        flangeEffect->AdvancePhase(framesPerBuffer);
+                        return true;
+                    }
+                    for (size_t sample = 0; sample < framesPerBuffer; ++sample) {
+                        buffer[sample] = flangeEffect->AddSample(buffer[sample]);
+                        flangeEffect->AdvancePhase();
+                    }
+                    return false;
+                }
+            );
+            graph.Connect(lastNode, flangeNode);
+            lastNode = flangeNode;
+        }
 
-        // for every sample in our output buffer
-        for (size_t sample = 0; sample < framesPerBuffer; ++sample, outputBuffer += numChannels) {
-            
-            // add up all notes to get the final value.
-            float value = 0.0f;
-            std::for_each(
-                g_notes.begin(),
-                g_notes.end(),
-                [&value, sampleRate](SNote& note) {
-                    value += GenerateNoteSample(note, sampleRate);
+        if (effect == e_flangeSlowAndReverb) {
+            std::shared_ptr<SMultiTapReverbEffect> reverbEffect = std::make_shared<SMultiTapReverbEffect>();
+            reverbEffect->SetEffectParams(sampleRate);
+
+            CAudioGraph::TNodeId reverbNode = graph.AddEffect(
+                [reverbEffect] (float *buffer, size_t framesPerBuffer, float sampleRate, bool silent) {
+                    // sleep through silence once the reverb tail has died out
+                    if (silent && reverbEffect->IsAsleep())
+                        return true;
+                    for (size_t sample = 0; sample < framesPerBuffer; ++sample)
+                        buffer[sample] = reverbEffect->AddSample(buffer[sample]);
+                    return false;
                 }
             );
+            graph.Connect(lastNode, reverbNode);
+            lastNode = reverbNode;
+        }
 
-            // apply effects if appropriate
-            if (currentEffect != e_none) {
-                value = flangeEffect.AddSample(value);
-                if (currentEffect == e_flangeSlowAndReverb)
-                    value = reverbEffect.AddSample(value);
-            }
+        graph.Connect(lastNode, graph.GetMaster());
+        g_graphPlayer.SetGraph(graph.Compile(c_maxFramesPerBuffer));
+    }
 
-            // copy the value to all audio channels
-            for (size_t channel = 0; channel < numChannels; ++channel)
-                outputBuffer[channel] = value;
+    //--------------------------------------------------------------------------------------------------
+    size_t GenerateAudioSamples (float **outputChannels, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
 
-            // advance the phase of the flange effect if flange is on
-            if (currentEffect != e_none)
-                flangeEffect.AdvancePhase();
-        }
+        // get a lock on our notes vector, for the voice groups to read from
+        std::lock_guard<std::mutex> guard(g_notesMutex);
+
+        // the graph does all the work, and its output is mono.  It's silent until the first graph
+        // shows up, and once all the notes and effect tails have died out.
+        bool silent = !g_graphPlayer.GenerateAudioSamples(outputChannels[0], framesPerBuffer, sampleRate);
 
         // remove notes that have died
         auto iter = std::remove_if(
@@ -248,8 +296,9 @@ namespace DemoFlange {
             }
         );
 
-        if (iter != g_notes.end())
-            g_notes.erase(iter);
+        g_notes.erase(iter, g_notes.end());
+
+        return silent ? 0 : 1;
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -275,6 +324,21 @@ namespace DemoFlange {
         printf("Instrument: %s  Effect: %s\r\n", WaveFormToString(g_currentWaveForm), EffectToString(g_effect));
     }
 
+    //--------------------------------------------------------------------------------------------------
+    void OnNote (float frequency, float velocity, bool pressed) {
+
+        // if releasing a note, we need to find and kill the flute note of the same frequency
+        if (!pressed) {
+            StopNote(frequency);
+            return;
+        }
+
+        // get a lock on our notes vector and add the new note
+        std::lock_guard<std::mutex> guard(g_notesMutex);
+        g_notes.push_back(SNote(frequency, g_currentWaveForm));
+        g_notes.back().m_velocity = velocity;
+    }
+
     //--------------------------------------------------------------------------------------------------
     void OnKey (char key, bool pressed) {
 
@@ -286,7 +350,7 @@ namespace DemoFlange {
                 case '2': g_currentWaveForm = e_waveSaw; ReportParams(); return;
                 case '3': g_currentWaveForm = e_waveSquare; ReportParams(); return;
                 case '4': g_currentWaveForm = e_waveTriangle; ReportParams(); return;
-                case '5': g_effect = EEffect(int(g_effect+1)%e_numEffects); ReportParams(); return;
+                case '5': g_effect = EEffect(int(g_effect+1)%e_numEffects); BuildGraph(g_effect); ReportParams(); return;
                 case '6': {
                     std::lock_guard<std::mutex> guard(g_notesMutex);
                     g_notes.push_back(SNote(0.0f, e_sampleCymbals));
@@ -354,21 +418,16 @@ namespace DemoFlange {
             }
         }
 
-        // if releasing a note, we need to find and kill the flute note of the same frequency
-        if (!pressed) {
-            StopNote(frequency);
-            return;
-        }
-
-        // get a lock on our notes vector and add the new note
-        std::lock_guard<std::mutex> guard(g_notesMutex);
-        g_notes.push_back(SNote(frequency, g_currentWaveForm));
+        CDemoMgr::QueueKeyNote(frequency, pressed);
     }
 
     //--------------------------------------------------------------------------------------------------
     void OnEnterDemo () {
+        CSampleRegistry::Prefetch(g_sampleCymbal);
+        CSampleRegistry::Prefetch(g_sampleVoice);
         g_currentWaveForm = e_waveSine;
         g_effect = e_none;
+        BuildGraph(g_effect);
         printf("Letter keys to play notes.\r\nleft shift / control is super low frequency.\r\n");
         printf("1 = Sine\r\n");
         printf("2 = Band Limited Saw\r\n");
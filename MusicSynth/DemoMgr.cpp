@@ -6,13 +6,53 @@
 //--------------------------------------------------------------------------------------------------
 
 #include "DemoMgr.h"
+#include "Platform.h"
+#include "AudioGraph.h"
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+#include <xmmintrin.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
 
 EDemo CDemoMgr::s_currentDemo = e_demoFirst;
 bool CDemoMgr::s_exit = false;
 int CDemoMgr::s_volumeMultiplier = 18;
 bool CDemoMgr::s_clippingOn = false;
+SWaveShaperEffect::EShape CDemoMgr::s_clipShape = SWaveShaperEffect::EShape::e_hardClip;
+size_t CDemoMgr::s_clipOversampling = 1;
+std::vector<float> CDemoMgr::s_planarBuffer;
+SWaveShaperEffect CDemoMgr::s_clippers[CDemoMgr::c_maxChannels];
+const float CDemoMgr::c_limiterRelease = 0.1f;
+const float CDemoMgr::c_limiterCeilingdB = -1.0f;
+const float CDemoMgr::c_limiterMaxLookAhead = 0.005f;
+bool CDemoMgr::s_limiterOn = false;
+float CDemoMgr::s_limiterLookAhead = 0.002f;
+SLimiterEffect CDemoMgr::s_limiter;
+CAudioWorkerPool CDemoMgr::s_workerPool;
 FILE* CDemoMgr::s_recordingWavFile = nullptr;
 
+// for timestamped note and controller events
+std::mutex CDemoMgr::s_demoEventsMutex;
+std::deque<CDemoMgr::SDemoEvent> CDemoMgr::s_demoEvents;
+TSampleClock CDemoMgr::s_keySampleClock = 0;
+const double CDemoMgr::c_midiFeedSeconds = 0.5;
+std::vector<CDemoMgr::SDemoEvent> CDemoMgr::s_midiFileEvents;
+size_t CDemoMgr::s_midiFileCursor = 0;
+std::atomic<size_t> CDemoMgr::s_streamTimeSequence(0);
+std::atomic<TSampleClock> CDemoMgr::s_streamTimeSampleClock(0);
+std::atomic<double> CDemoMgr::s_streamTime(0.0);
+std::atomic<size_t> CDemoMgr::s_maxFramesPerBuffer(0);
+
+// for waking the main thread up
+std::mutex CDemoMgr::s_wakeMutex;
+std::condition_variable CDemoMgr::s_wakeCondition;
+std::atomic<bool> CDemoMgr::s_wakeRequested(false);
+int CDemoMgr::s_wakePipe[2] = { -1, -1 };
+
 // for recording audio
 std::mutex CDemoMgr::s_recordingBuffersMutex;
 std::queue<std::unique_ptr<CDemoMgr::SRecordingBuffer>> CDemoMgr::s_recordingBuffers;
@@ -20,14 +60,13 @@ SWaveFileHeader CDemoMgr::s_waveFileHeader;
 size_t CDemoMgr::s_recordedNumSamples;
 size_t CDemoMgr::s_recordingNumChannels;
 size_t CDemoMgr::s_recordingSampleRate;
-size_t CDemoMgr::s_sampleClock; // yes in 32 bit mode this is a uint32 and could roll over, but it would take 27 hours.
+std::atomic<TSampleClock> CDemoMgr::s_sampleClock(0);
 size_t CDemoMgr::s_numChannels;
 float CDemoMgr::s_sampleRate;
 
 //--------------------------------------------------------------------------------------------------
 static bool FileExists (const char* fileName) {
-    FILE *file = nullptr;
-    fopen_s(&file, fileName, "rb");
+    FILE *file = OpenFile(fileName, "rb");
     if (file) {
         fclose(file);
         return true;
@@ -40,15 +79,15 @@ void CDemoMgr::StartRecording() {
 
     // find a filename
     char fileName[256];
-    sprintf_s(fileName, 256, "recording.wav");
+    snprintf(fileName, 256, "recording.wav");
     int i = 1;
     while (FileExists(fileName)) {
-        sprintf_s(fileName, 256, "recording%i.wav", i);
+        snprintf(fileName, 256, "recording%i.wav", i);
         ++i;
     }
 
     // open the file for writing
-    fopen_s(&s_recordingWavFile, fileName, "w+b");
+    s_recordingWavFile = OpenFile(fileName, "w+b");
     if (!s_recordingWavFile) {
         printf("ERROR: could not start recording to %s\r\n", fileName);
         return;
@@ -89,10 +128,278 @@ void CDemoMgr::StopRecording() {
     printf("Recording stopped.\r\n");
 }
 
+//--------------------------------------------------------------------------------------------------
+void CDemoMgr::InsertDemoEvent (const SDemoEvent& event) {
+
+    // keep the queue sorted, keeping events with the same time in the order they were queued.
+    // Events are almost always queued in order, so start looking from the back.
+    auto iter = s_demoEvents.end();
+    while (iter != s_demoEvents.begin() && (iter - 1)->m_sampleClock > event.m_sampleClock)
+        --iter;
+    s_demoEvents.insert(iter, event);
+}
+
+//--------------------------------------------------------------------------------------------------
+void CDemoMgr::QueueKeyNote (float frequency, bool pressed) {
+    SDemoEvent event = {};
+    event.m_sampleClock = s_keySampleClock;
+    event.m_type = EDemoEventType::e_note;
+    event.m_demo = s_currentDemo;
+    event.m_frequency = frequency;
+    event.m_velocity = 1.0f;
+    event.m_pressed = pressed;
+
+    std::lock_guard<std::mutex> guard(s_demoEventsMutex);
+    InsertDemoEvent(event);
+}
+
+//--------------------------------------------------------------------------------------------------
+void CDemoMgr::QueueNoteEvent (float frequency, float velocity, bool pressed, TSampleClock sampleClock) {
+    SDemoEvent event = {};
+    event.m_sampleClock = sampleClock;
+    event.m_type = EDemoEventType::e_note;
+    event.m_demo = e_demoUnknown;
+    event.m_frequency = frequency;
+    event.m_velocity = velocity;
+    event.m_pressed = pressed;
+
+    std::lock_guard<std::mutex> guard(s_demoEventsMutex);
+    InsertDemoEvent(event);
+}
+
+//--------------------------------------------------------------------------------------------------
+void CDemoMgr::QueueControlChangeEvent (int controller, int value, TSampleClock sampleClock) {
+    SDemoEvent event = {};
+    event.m_sampleClock = sampleClock;
+    event.m_type = EDemoEventType::e_controlChange;
+    event.m_demo = e_demoUnknown;
+    event.m_controller = controller;
+    event.m_value = value;
+
+    std::lock_guard<std::mutex> guard(s_demoEventsMutex);
+    InsertDemoEvent(event);
+}
+
+//--------------------------------------------------------------------------------------------------
+void CDemoMgr::QueueMidiFile (const SMidiFile& midiFile, TSampleClock sampleClock) {
+
+    // drop the notes already fed from any file that is still playing, so the new file's notes can
+    // be merged in with the rest of it
+    s_midiFileEvents.erase(s_midiFileEvents.begin(), s_midiFileEvents.begin() + s_midiFileCursor);
+    s_midiFileCursor = 0;
+
+    SDemoEvent event = {};
+    event.m_type = EDemoEventType::e_note;
+    event.m_demo = e_demoUnknown;
+    for (const SMidiNoteEvent& noteEvent : midiFile.m_noteEvents) {
+        event.m_sampleClock = sampleClock + TSampleClock(noteEvent.m_time * double(s_sampleRate) + 0.5);
+        event.m_frequency = MIDINoteToFrequency(noteEvent.m_note);
+        event.m_velocity = MIDIVelocityToAmplitude(noteEvent.m_velocity);
+        event.m_pressed = noteEvent.m_on;
+        s_midiFileEvents.push_back(event);
+    }
+    std::stable_sort(s_midiFileEvents.begin(), s_midiFileEvents.end(),
+        [] (const SDemoEvent& a, const SDemoEvent& b) {
+            return a.m_sampleClock < b.m_sampleClock;
+        }
+    );
+
+    // the start of the file may be due before the next Update()
+    FeedMidiFile();
+}
+
+//--------------------------------------------------------------------------------------------------
+void CDemoMgr::FeedMidiFile () {
+    if (s_midiFileCursor >= s_midiFileEvents.size())
+        return;
+
+    // queue the notes that come up in the next little while.  They come after anything else in the
+    // queue, except live notes from less than a buffer ago, so inserting them is just adding them to
+    // the end.
+    TSampleClock feedEnd = s_streamTimeSampleClock.load() + TSampleClock(c_midiFeedSeconds * double(s_sampleRate));
+    {
+        std::lock_guard<std::mutex> guard(s_demoEventsMutex);
+        while (s_midiFileCursor < s_midiFileEvents.size() && s_midiFileEvents[s_midiFileCursor].m_sampleClock < feedEnd) {
+            InsertDemoEvent(s_midiFileEvents[s_midiFileCursor]);
+            ++s_midiFileCursor;
+        }
+    }
+
+    // let the memory go once the whole file has been fed in
+    if (s_midiFileCursor == s_midiFileEvents.size()) {
+        s_midiFileEvents.clear();
+        s_midiFileEvents.shrink_to_fit();
+        s_midiFileCursor = 0;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+TSampleClock CDemoMgr::StreamTimeToSampleClock (double streamTime) {
+
+    // read the sample clock and stream time of the last buffer, trying again if the audio thread
+    // was in the middle of writing them
+    TSampleClock sampleClock;
+    double bufferStreamTime;
+    size_t sequence;
+    do {
+        sequence = s_streamTimeSequence.load();
+        sampleClock = s_streamTimeSampleClock.load();
+        bufferStreamTime = s_streamTime.load();
+    } while ((sequence & 1) != 0 || sequence != s_streamTimeSequence.load());
+
+    // if the audio thread hasn't run yet, the event happens as soon as it does
+    if (sequence == 0)
+        return 0;
+
+    double offset = (streamTime - bufferStreamTime) * double(s_sampleRate) + double(s_maxFramesPerBuffer.load());
+    if (offset <= 0.0)
+        return sampleClock;
+    return sampleClock + TSampleClock(offset);
+}
+
+//--------------------------------------------------------------------------------------------------
+void CDemoMgr::PublishStreamTime (double streamTime, size_t framesPerBuffer) {
+    if (framesPerBuffer > s_maxFramesPerBuffer.load())
+        s_maxFramesPerBuffer.store(framesPerBuffer);
+
+    ++s_streamTimeSequence;
+    s_streamTimeSampleClock.store(GetSampleClock());
+    s_streamTime.store(streamTime);
+    ++s_streamTimeSequence;
+}
+
+//--------------------------------------------------------------------------------------------------
+size_t CDemoMgr::DispatchDemoEvents (size_t maxFrames) {
+
+    // pass on every event that is due, and return how many frames to render until the next one
+    std::lock_guard<std::mutex> guard(s_demoEventsMutex);
+    while (!s_demoEvents.empty()) {
+        const SDemoEvent& event = s_demoEvents.front();
+        TSampleClock sampleClock = GetSampleClock();
+        if (event.m_sampleClock > sampleClock)
+            return size_t(std::min<TSampleClock>(event.m_sampleClock - sampleClock, maxFrames));
+
+        switch (event.m_type) {
+            case EDemoEventType::e_note: {
+                // a note played from one demo's keyboard doesn't carry over to the next demo
+                if (event.m_demo != e_demoUnknown && event.m_demo != s_currentDemo)
+                    break;
+                switch (s_currentDemo) {
+                    #define DEMO(name) case e_demo##name: Demo##name::OnNote(event.m_frequency, event.m_velocity, event.m_pressed); break;
+                    #include "DemoList.h"
+                }
+                break;
+            }
+            case EDemoEventType::e_controlChange: {
+                // channel volume maps onto the same 0 to 20 steps as the up and down arrows
+                if (event.m_controller == 7)
+                    s_volumeMultiplier = event.m_value * 20 / 127;
+                break;
+            }
+        }
+        s_demoEvents.pop_front();
+    }
+    return maxFrames;
+}
+
+//--------------------------------------------------------------------------------------------------
+void CDemoMgr::SpreadMono (float* const* channels, size_t numChannels, size_t frameBegin, size_t frameEnd) {
+    for (size_t channel = 1; channel < numChannels; ++channel)
+        memcpy(&channels[channel][frameBegin], &channels[0][frameBegin], sizeof(float) * (frameEnd - frameBegin));
+}
+
+//--------------------------------------------------------------------------------------------------
+void CDemoMgr::InterleaveChannels (const float* const* channels, size_t numSourceChannels, float *outputBuffer, size_t framesPerBuffer, size_t numChannels) {
+
+    // stereo is the common case, so it gets done four frames at a time
+    size_t sample = 0;
+    if (numChannels == 2 && numSourceChannels == 2) {
+        for (; sample + 4 <= framesPerBuffer; sample += 4, outputBuffer += 8) {
+            __m128 left = _mm_loadu_ps(&channels[0][sample]);
+            __m128 right = _mm_loadu_ps(&channels[1][sample]);
+            _mm_storeu_ps(&outputBuffer[0], _mm_unpacklo_ps(left, right));
+            _mm_storeu_ps(&outputBuffer[4], _mm_unpackhi_ps(left, right));
+        }
+    }
+
+    for (; sample < framesPerBuffer; ++sample, outputBuffer += numChannels) {
+        if (numSourceChannels == 1) {
+            for (size_t channel = 0; channel < numChannels; ++channel)
+                outputBuffer[channel] = channels[0][sample];
+        }
+        else {
+            for (size_t channel = 0; channel < numChannels; ++channel)
+                outputBuffer[channel] = channel < numSourceChannels ? channels[channel][sample] : 0.0f;
+        }
+    }
+}
+
 //--------------------------------------------------------------------------------------------------
 void CDemoMgr::Update() {
+    FeedMidiFile();
+    CAudioGraphPlayer::CollectAllGarbage();
     if (IsRecording())
         FlushRecordingBuffers();
+    CSampleRegistry::Update();
+    CAudioThreads::Update();
+}
+
+//--------------------------------------------------------------------------------------------------
+void CDemoMgr::InitWake () {
+#ifndef _WIN32
+    if (s_wakePipe[0] >= 0)
+        return;
+
+    // neither end blocks, so the audio thread can't get stuck on a full pipe, and emptying it stops
+    // once it's empty
+    if (pipe(s_wakePipe) != 0) {
+        printf("ERROR: could not create the pipe for waking the main thread\r\n");
+        s_wakePipe[0] = -1;
+        s_wakePipe[1] = -1;
+        return;
+    }
+    fcntl(s_wakePipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(s_wakePipe[1], F_SETFL, O_NONBLOCK);
+#endif
+}
+
+//--------------------------------------------------------------------------------------------------
+void CDemoMgr::WaitForWork (size_t timeoutMs, int inputFd) {
+#ifdef _WIN32
+    (void)inputFd;
+    std::unique_lock<std::mutex> lock(s_wakeMutex);
+    s_wakeCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs), [] () { return s_wakeRequested.load(); });
+    s_wakeRequested = false;
+#else
+    // poll skips descriptors that are negative, so a missing pipe or input is fine
+    pollfd descriptors[2];
+    descriptors[0].fd = s_wakePipe[0];
+    descriptors[0].events = POLLIN;
+    descriptors[0].revents = 0;
+    descriptors[1].fd = inputFd;
+    descriptors[1].events = POLLIN;
+    descriptors[1].revents = 0;
+    poll(descriptors, 2, int(timeoutMs));
+
+    // empty the pipe, so the next wait sleeps until the next wake
+    if (descriptors[0].revents & POLLIN) {
+        char wakes[64];
+        while (read(s_wakePipe[0], wakes, sizeof(wakes)) > 0) {}
+    }
+#endif
+}
+
+//--------------------------------------------------------------------------------------------------
+void CDemoMgr::Wake () {
+#ifdef _WIN32
+    s_wakeRequested = true;
+    s_wakeCondition.notify_one();
+#else
+    // if the pipe is full, the main thread already has wakes waiting for it
+    char wake = 0;
+    ssize_t written = write(s_wakePipe[1], &wake, 1);
+    (void)written;
+#endif
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -139,6 +446,14 @@ void CDemoMgr::AddRecordingBuffer (float *buffer, size_t framesPerBuffer, size_t
         newBuffer->m_buffer[i] = ConvertFloatToAudioSample(buffer[i]);
 
     // get a lock on the mutex and add this buffer
-    std::lock_guard<std::mutex> guard(s_recordingBuffersMutex);
-    s_recordingBuffers.push(std::move(newBuffer));
+    size_t numBuffers;
+    {
+        std::lock_guard<std::mutex> guard(s_recordingBuffersMutex);
+        s_recordingBuffers.push(std::move(newBuffer));
+        numBuffers = s_recordingBuffers.size();
+    }
+
+    // have the main thread write them out once enough have piled up
+    if (numBuffers >= c_recordingWakeBuffers)
+        Wake();
 }
\ No newline at end of file
@@ -8,11 +8,20 @@
 #pragma once
 
 #include <stdio.h>
+#include <string.h>
 #include "AudioUtils.h"
+#include "AudioEffects.h"
+#include "AudioWorkerPool.h"
+#include "AudioThreads.h"
 #include "WavFile.h"
+#include "MidiFile.h"
+#include "Timebase.h"
 #include <vector>
 #include <mutex>
+#include <condition_variable>
 #include <queue>
+#include <deque>
+#include <atomic>
 #include <memory>
 #include "Samples.h"
 
@@ -27,10 +36,14 @@ enum EDemo {
 };
 
 //--------------------------------------------------------------------------------------------------
-// forward declarations of demo specific functions, in their respective namespaces
+// forward declarations of demo specific functions, in their respective namespaces.
+// GenerateAudioSamples writes to planar buffers, one per output channel, and returns how many of
+// them it wrote.  A demo that returns 1 is mono, and gets copied to the other channels at the end.
+// A demo that returns 0 is silent, and doesn't have to write anything at all.
 #define DEMO(name)  namespace Demo##name {\
-    void GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, size_t numChannels, float sampleRate); \
+    size_t GenerateAudioSamples (float **outputChannels, size_t framesPerBuffer, size_t numChannels, float sampleRate); \
     void OnKey (char key, bool pressed); \
+    void OnNote (float frequency, float velocity, bool pressed); \
     void OnEnterDemo (); \
     void OnInit (); \
     void OnExit (); \
@@ -41,16 +54,40 @@ enum EDemo {
 class CDemoMgr {
 public:
     inline static void Init (float sampleRate, size_t numChannels) {
+
+        // set up waking the main thread before anything can ask for it
+        InitWake();
+
+        // start the audio worker threads, leaving a core each for the audio thread and main thread,
+        // or one per core set aside for them
+        size_t numCores = std::thread::hardware_concurrency();
+        size_t numWorkers = numCores > 2 ? numCores - 2 : 0;
+        if (CAudioThreads::GetNumWorkerCores() > 0)
+            numWorkers = CAudioThreads::GetNumWorkerCores();
+        if (numWorkers > c_maxAudioWorkers)
+            numWorkers = c_maxAudioWorkers;
+        s_workerPool.Start(numWorkers, 2);
+
         printf("\r\n\r\n\r\n\r\n============================================\r\n");
-        printf("Welcome!\r\nUp and down to adjust volume.\r\nLeft and right to change demo.\r\nEnter to toggle clipping.\r\nbackspace to toggle audio recording.\r\nEscape to exit.\r\n");
+        printf("Welcome!\r\nUp and down to adjust volume.\r\nLeft and right to change demo.\r\nEnter to toggle clipping.\r\nF1 to cycle clipping shape, F2 to cycle clipping oversampling.\r\nF3 to toggle limiter, F4 to cycle limiter look ahead.\r\nbackspace to toggle audio recording.\r\nEscape to exit.\r\n");
         printf("sampleRate = %0.0f, numChannels = %i\r\n", sampleRate, numChannels);
+        printf("audio worker threads = %i\r\n", int(numWorkers));
         printf("============================================\r\n\r\n");
 
         s_sampleRate = sampleRate;
         s_numChannels = numChannels;
 
-        // load the audio samples
-        LoadSamples();
+        // make room for the planar buffers up front, so the audio thread only allocates if it gets
+        // a bigger buffer than this
+        size_t numPlanarChannels = numChannels < c_maxChannels ? numChannels : c_maxChannels;
+        s_planarBuffer.resize(c_planarReserveFrames * numPlanarChannels);
+
+        // allocate the limiter for the longest look ahead F4 goes up to, so the audio thread only has
+        // to reset it when the look ahead changes
+        s_limiter.SetEffectParams(sampleRate, numPlanarChannels, c_limiterMaxLookAhead, c_limiterRelease, c_limiterCeilingdB);
+
+        // find the audio samples.  Each demo loads the ones it uses when it's entered.
+        CSampleRegistry::Init("Samples", sampleRate);
 
         // give each demo and OnInit() call
         #define DEMO(name) Demo##name::OnInit();
@@ -70,53 +107,145 @@ public:
             #include "DemoList.h"
         }
 
+        // the demo has loaded its samples, so show where they went
+        CEngineMemory::Report();
+
         printf("--------------------------------------------\r\n\r\n");
     }
 
-    inline static void GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
-        // pass this call onto the current demo
-        switch (s_currentDemo) {
-            #define DEMO(name) case e_demo##name: Demo##name::GenerateAudioSamples(outputBuffer, framesPerBuffer, numChannels, sampleRate); break;
-            #include "DemoList.h"
+    // streamTime is the PortAudio stream time at the start of the buffer, used to line key events up
+    // with the sample clock.
+    inline static void GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, size_t numChannels, float sampleRate, double streamTime) {
+
+        // keep decaying effect tails from turning into slow denormal math
+        SDenormalGuard denormalGuard;
+
+        // publish where the sample clock is in stream time, for timestamping key events
+        PublishStreamTime(streamTime, framesPerBuffer);
+
+        // Everything is rendered and processed in planar buffers, one per channel, and interleaved
+        // into the output buffer once at the end.  Channels past c_maxChannels are left silent.
+        size_t numPlanarChannels = numChannels < c_maxChannels ? numChannels : c_maxChannels;
+        if (s_planarBuffer.size() < framesPerBuffer * numPlanarChannels)
+            s_planarBuffer.resize(framesPerBuffer * numPlanarChannels);
+        float* channels[c_maxChannels];
+        for (size_t channel = 0; channel < numPlanarChannels; ++channel)
+            channels[channel] = &s_planarBuffer[channel * framesPerBuffer];
+
+        // Split the buffer at key and note events, and pass each piece onto the current demo, so that
+        // events take effect on the exact sample they were scheduled for.  The sample clock is
+        // advanced as we go, so the demo sees the right time for each piece.
+        // Mono stays in channel 0 alone for as long as it can, and is only copied to the other
+        // channels if part of the buffer turns out not to be mono.
+        size_t numSourceChannels = 1;
+        size_t frameOffset = 0;
+        bool silent = true;
+        while (frameOffset < framesPerBuffer) {
+            size_t frameEnd = DispatchDemoEvents(framesPerBuffer - frameOffset) + frameOffset;
+            float* segment[c_maxChannels];
+            for (size_t channel = 0; channel < numPlanarChannels; ++channel)
+                segment[channel] = channels[channel] + frameOffset;
+            size_t numSegmentChannels = 1;
+            switch (s_currentDemo) {
+                #define DEMO(name) case e_demo##name: numSegmentChannels = Demo##name::GenerateAudioSamples(segment, frameEnd - frameOffset, numPlanarChannels, sampleRate); break;
+                #include "DemoList.h"
+            }
+            if (numSegmentChannels == 0) {
+                memset(segment[0], 0, sizeof(float) * (frameEnd - frameOffset));
+                numSegmentChannels = 1;
+            }
+            else {
+                silent = false;
+            }
+            if (numSegmentChannels > 1 && numSourceChannels == 1) {
+                SpreadMono(channels, numPlanarChannels, 0, frameOffset);
+                numSourceChannels = numPlanarChannels;
+            }
+            else if (numSegmentChannels == 1 && numSourceChannels > 1) {
+                SpreadMono(channels, numPlanarChannels, frameOffset, frameEnd);
+            }
+            s_sampleClock.store(GetSampleClock() + (frameEnd - frameOffset), std::memory_order_relaxed);
+            frameOffset = frameEnd;
         }
 
-        // store off the original value of outputBuffer so we can use it for recording
-        float *bufferStart = outputBuffer;
+        // re-initialize the clippers if the clipping settings have changed
+        static SWaveShaperEffect::EShape lastClipShape = SWaveShaperEffect::EShape::e_count;
+        static size_t lastClipOversampling = 0;
+        SWaveShaperEffect::EShape clipShape = s_clipShape;
+        size_t clipOversampling = s_clipOversampling;
+        if (clipShape != lastClipShape || clipOversampling != lastClipOversampling) {
+            lastClipShape = clipShape;
+            lastClipOversampling = clipOversampling;
+            for (size_t channel = 0; channel < c_maxChannels; ++channel)
+                s_clippers[channel].SetEffectParams(clipShape, clipOversampling);
+        }
 
-        // apply volume adjustment smoothly over the buffer window via a lerp of amplitude.
-        // also apply clipping.
+        // reset the limiter if it's been turned on, or the look ahead has changed.  Its buffers were
+        // allocated by Init(), so this doesn't allocate.
+        static bool limiterWasOn = false;
+        static float lastLimiterLookAhead = 0.0f;
+        bool limiterOn = s_limiterOn;
+        float limiterLookAhead = s_limiterLookAhead;
+        if (limiterOn && (!limiterWasOn || limiterLookAhead != lastLimiterLookAhead)) {
+            lastLimiterLookAhead = limiterLookAhead;
+            s_limiter.SetLookAhead(limiterLookAhead);
+        }
+        limiterWasOn = limiterOn;
+
+        // the limiter keeps a delay line per channel, so it needs every channel filled in.  Volume
+        // and clipping are the same on every channel, so mono only needs them done once.
+        if (limiterOn && numSourceChannels == 1) {
+            SpreadMono(channels, numPlanarChannels, 0, framesPerBuffer);
+            numSourceChannels = numPlanarChannels;
+        }
+
+        // A silent buffer stays silent through volume, and through the limiter and clippers too once
+        // they have nothing left in them, so all of that can be skipped.
         bool clip = s_clippingOn;
+        if (silent && limiterOn && !s_limiter.IsAsleep())
+            silent = false;
+        for (size_t channel = 0; channel < c_maxChannels && silent && clip; ++channel)
+            silent = s_clippers[channel].IsAsleep();
+
+        // apply volume adjustment smoothly over the buffer window via a lerp of amplitude.
+        // also apply limiting and clipping.
         static float lastVolumeMultiplier = 1.0;
         float volumeMultiplier = dBToAmplitude((1.0f - float(s_volumeMultiplier)/20.0f) * -60.0f);
-        for (size_t sample = 0; sample < framesPerBuffer; ++sample, outputBuffer += numChannels) {
+        for (size_t sample = 0; sample < framesPerBuffer && !silent; ++sample) {
             // lerp the volume change across the buffer
             float percent = float(sample) / float(framesPerBuffer);
             float volume = Lerp(lastVolumeMultiplier, volumeMultiplier, percent);
 
-            // apply volume and clipping
-            for (size_t channel = 0; channel < numChannels; ++channel) {
-                float value = outputBuffer[channel] * volume;
+            // apply volume
+            for (size_t channel = 0; channel < numSourceChannels; ++channel)
+                channels[channel][sample] *= volume;
 
-                if (clip) {
-                    if (value > 1.0f)
-                        value = 1.0f;
-                    else if (value < -1.0f)
-                        value = -1.0f;
-                }
-                outputBuffer[channel] = value;
+            // apply the limiter to the whole frame, so all channels get the same gain
+            if (limiterOn)
+                s_limiter.AddFrame(channels, sample);
+
+            // apply clipping
+            if (clip) {
+                for (size_t channel = 0; channel < numSourceChannels; ++channel)
+                    channels[channel][sample] = s_clippers[channel].AddSample(channels[channel][sample]);
             }
         }
 
-        s_sampleClock += framesPerBuffer;
-
         lastVolumeMultiplier = volumeMultiplier;
 
+        // write the final interleaved output
+        InterleaveChannels(channels, numSourceChannels, outputBuffer, framesPerBuffer, numChannels);
+
         // if we are recording, add this frame to our frame queue
         if (IsRecording())
-            AddRecordingBuffer(bufferStart, framesPerBuffer, numChannels, sampleRate);
+            AddRecordingBuffer(outputBuffer, framesPerBuffer, numChannels, sampleRate);
+
+        // let the samples know the audio thread is done with this buffer
+        CSampleRegistry::OnAudioBufferDone(GetSampleClock());
     }
 
-    static void OnKey(char key, bool pressed) {
+    // streamTime is the PortAudio stream time when the key event happened
+    static void OnKey(char key, bool pressed, double streamTime) {
         switch (key) {
             // exit when escape is pressed on any demo
             case 27: Exit(); return;
@@ -128,6 +257,39 @@ public:
                 }
                 return;
             }
+            // F1 cycles the clipping shape
+            case 112: {
+                if (pressed) {
+                    s_clipShape = SWaveShaperEffect::EShape((int(s_clipShape) + 1) % int(SWaveShaperEffect::EShape::e_count));
+                    printf("clipping shape = %s\r\n", SWaveShaperEffect::ShapeToString(s_clipShape));
+                }
+                return;
+            }
+            // F2 cycles the clipping oversampling between 1x, 2x, 4x and 8x
+            case 113: {
+                if (pressed) {
+                    s_clipOversampling = s_clipOversampling >= 8 ? 1 : s_clipOversampling * 2;
+                    printf("clipping oversampling = %ix\r\n", int(s_clipOversampling));
+                }
+                return;
+            }
+            // F3 toggles the limiter
+            case 114: {
+                if (pressed) {
+                    s_limiterOn = !s_limiterOn;
+                    printf("limiter = %s\r\n", s_limiterOn ? "on" : "off");
+                }
+                return;
+            }
+            // F4 cycles the limiter look ahead between 1 ms and c_limiterMaxLookAhead
+            case 115: {
+                if (pressed) {
+                    int lookAheadMs = int(s_limiterLookAhead * 1000.0f + 0.5f) % int(c_limiterMaxLookAhead * 1000.0f + 0.5f) + 1;
+                    s_limiterLookAhead = float(lookAheadMs) / 1000.0f;
+                    printf("limiter look ahead = %ims\r\n", lookAheadMs);
+                }
+                return;
+            }
             // backspace toggles recording
             case 8: {
                 if (pressed) {
@@ -160,39 +322,74 @@ public:
             }
             // left arrow means go to previous demo
             case 37: {
-                if (pressed && s_currentDemo > e_demoFirst) {
-                    s_currentDemo = EDemo(int(s_currentDemo) - 1);
-                    OnEnterDemo();
-                }
+                if (pressed && s_currentDemo > e_demoFirst)
+                    SwitchDemo(EDemo(int(s_currentDemo) - 1));
                 return;
             }
             // right arrow means go to next demo
             case 39: {
-                if (pressed && s_currentDemo < e_demoLast) {
-                    s_currentDemo = EDemo(int(s_currentDemo) + 1);
-                    OnEnterDemo();
-                }
+                if (pressed && s_currentDemo < e_demoLast)
+                    SwitchDemo(EDemo(int(s_currentDemo) + 1));
                 return;
             }
         }
 
-        // else pass this key event onto the current demo
+        // else pass this key onto the current demo.  Any notes it plays are scheduled for when the
+        // key was pressed.
+        s_keySampleClock = StreamTimeToSampleClock(streamTime);
         switch (s_currentDemo) {
             #define DEMO(name) case e_demo##name: Demo##name::OnKey(key, pressed); break;
             #include "DemoList.h"
         }
     }
 
+    // Main thread, from a demo's OnKey.  Schedules a note from the demo's keyboard layout for when
+    // the key was pressed.  The note is dropped if the demo changes before it plays.
+    static void QueueKeyNote (float frequency, bool pressed);
+
+    // Any thread.  Schedules a note to start or stop on the current demo, like a key from its
+    // keyboard layout would, but for any frequency.  Velocity is an amplitude from 0 to 1.
+    static void QueueNoteEvent (float frequency, float velocity, bool pressed, TSampleClock sampleClock);
+
+    // Any thread.  Schedules a MIDI control change.  Controller 7 (channel volume) sets the master
+    // volume, the rest are ignored for now.
+    static void QueueControlChangeEvent (int controller, int value, TSampleClock sampleClock);
+
+    // Main thread.  Schedules all the notes in a midi file, with the start of the file at sampleClock.
+    // The notes go to the audio thread a little at a time, from Update().
+    static void QueueMidiFile (const SMidiFile& midiFile, TSampleClock sampleClock);
+
+    // Main thread.
+    static void SwitchDemo (EDemo demo) {
+        s_currentDemo = demo;
+        OnEnterDemo();
+    }
+
+    // Any thread.  Converts a PortAudio stream time to the sample clock it should take effect at.
+    // This is delayed by the largest buffer seen so far, so that events land a constant time after
+    // they happen instead of at whatever buffer boundary comes next.
+    static TSampleClock StreamTimeToSampleClock (double streamTime);
+
     static bool IsRecording() { return s_recordingWavFile != nullptr; }
 
     static void StartRecording ();
     static void StopRecording ();
     static void Update ();
 
+    // Main thread.  Sleeps until there is work for Update() to do, or the timeout passes.  Recording
+    // buffers piling up, samples being asked for and exit being requested wake it early.  Off
+    // Windows, so does inputFd having something to read, so input doesn't need polling.
+    static void WaitForWork (size_t timeoutMs, int inputFd = -1);
+
+    // Any thread.  Wakes up WaitForWork().  Doesn't take a lock, so it's safe from the audio thread.
+    // On Windows, a wake that lands just as the main thread goes to sleep can wait for the timeout.
+    static void Wake ();
+
     static void Exit () {
         if (IsRecording())
             StopRecording();
         s_exit = true;
+        Wake();
 
         // tell all of our demos about exit in case they need to do any clean up
         #define DEMO(name) Demo##name::OnExit();
@@ -201,11 +398,30 @@ public:
 
     static bool WantsExit () { return s_exit; }
 
-    static size_t GetSampleClock () { return s_sampleClock; }
+    // Any thread.  On the audio thread, the sample clock at the start of what's being rendered.  Other
+    // threads get wherever the audio thread was last up to, which is only good as a rough time.
+    static TSampleClock GetSampleClock () { return s_sampleClock.load(std::memory_order_relaxed); }
     static size_t GetNumChannels () { return s_numChannels; }
     static float GetSampleRate () { return s_sampleRate; }
 
+    // The most frames a buffer is expected to have.  Buffers the audio thread renders into are sized
+    // for this up front, and only grow if a bigger buffer comes along.
+    static const size_t c_planarReserveFrames = 4096;
+
+    // worker threads that the audio thread can split work across
+    static CAudioWorkerPool& GetWorkerPool () { return s_workerPool; }
+
 private:
+    static void PublishStreamTime (double streamTime, size_t framesPerBuffer);
+    static size_t DispatchDemoEvents (size_t maxFrames);
+
+    // copies channel 0 over the other channels, for frames [frameBegin, frameEnd)
+    static void SpreadMono (float* const* channels, size_t numChannels, size_t frameBegin, size_t frameEnd);
+
+    // Interleaves planar channels into the output.  If there is one source channel it's copied to
+    // every output channel, otherwise output channels past numSourceChannels are silent.
+    static void InterleaveChannels (const float* const* channels, size_t numSourceChannels, float *outputBuffer, size_t framesPerBuffer, size_t numChannels);
+
     static void FlushRecordingBuffers ();
     static void ClearRecordingBuffers ();
     static void AddRecordingBuffer (float *buffer, size_t framesPerBuffer, size_t numChannels, float sampleRate);
@@ -239,8 +455,82 @@ private:
     static int      s_volumeMultiplier;
     static float    s_lastVolumeMultiplier;
     static bool     s_clippingOn;
+
+    // the planar buffers the demos render into, and the master effects process, c_maxChannels at most
+    static const size_t                 c_maxChannels = 8;
+    static std::vector<float>           s_planarBuffer;
+
+    // clipping on the master output, one per channel
+    static SWaveShaperEffect::EShape    s_clipShape;
+    static size_t                       s_clipOversampling;
+    static SWaveShaperEffect            s_clippers[c_maxChannels];
+
+    // limiter on the master output
+    static const float                  c_limiterRelease;
+    static const float                  c_limiterCeilingdB;
+    static const float                  c_limiterMaxLookAhead;
+    static bool                         s_limiterOn;
+    static float                        s_limiterLookAhead;
+    static SLimiterEffect               s_limiter;
+
+    // audio worker threads.  Stopped when the app shuts down, after the audio stream is closed.
+    static const size_t                 c_maxAudioWorkers = 3;
+    static CAudioWorkerPool             s_workerPool;
+
+    // note and controller events waiting for the audio thread, sorted by sample clock
+    enum class EDemoEventType {
+        e_note,
+        e_controlChange
+    };
+
+    // m_demo is the demo a note is for, or e_demoUnknown for whichever demo is current
+    struct SDemoEvent {
+        TSampleClock    m_sampleClock;
+        EDemoEventType  m_type;
+        EDemo           m_demo;
+        float           m_frequency;
+        float           m_velocity;
+        bool            m_pressed;
+        int             m_controller;
+        int             m_value;
+    };
+    static void InsertDemoEvent (const SDemoEvent& event);
+
+    static std::mutex               s_demoEventsMutex;
+    static std::deque<SDemoEvent>   s_demoEvents;
+
+    // the sample clock the key being passed to the current demo's OnKey was pressed at
+    static TSampleClock             s_keySampleClock;
+
+    // Notes from midi files, sorted by sample clock, and the next one to go in the queue.  Update()
+    // feeds the queue the ones due in the next c_midiFeedSeconds, so that the audio thread and live
+    // notes never have to get past a whole file's worth of them while holding the lock.
+    static void FeedMidiFile ();
+
+    static const double             c_midiFeedSeconds;
+    static std::vector<SDemoEvent>  s_midiFileEvents;
+    static size_t                   s_midiFileCursor;
+
+    // the sample clock and stream time at the start of the last buffer, written by the audio thread.
+    // The sequence number is odd while they are being written.
+    static std::atomic<size_t>      s_streamTimeSequence;
+    static std::atomic<TSampleClock> s_streamTimeSampleClock;
+    static std::atomic<double>      s_streamTime;
+    static std::atomic<size_t>      s_maxFramesPerBuffer;
+
+    // For waking the main thread up.  Windows uses the condition variable, everything else writes
+    // to the pipe, which WaitForWork() can poll along with input.
+    static void InitWake ();
+    static std::mutex                   s_wakeMutex;
+    static std::condition_variable      s_wakeCondition;
+    static std::atomic<bool>            s_wakeRequested;
+    static int                          s_wakePipe[2];
+
     static FILE*    s_recordingWavFile;
 
+    // wake the main thread to write the recording to disk once this many buffers are waiting
+    static const size_t c_recordingWakeBuffers = 8;
+
     // for recording audio
     static std::mutex                                       s_recordingBuffersMutex;
     static std::queue<std::unique_ptr<SRecordingBuffer>>    s_recordingBuffers;
@@ -248,7 +538,7 @@ private:
     static size_t                                           s_recordedNumSamples;
     static size_t                                           s_recordingNumChannels;
     static size_t                                           s_recordingSampleRate;
-    static size_t                                           s_sampleClock;
+    static std::atomic<TSampleClock>                        s_sampleClock;   // only written by the audio thread
     static size_t                                           s_numChannels;
     static float                                            s_sampleRate;
 };
\ No newline at end of file
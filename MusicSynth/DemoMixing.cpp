@@ -10,8 +10,9 @@
 
 namespace DemoMixing {
     struct SNote {
-        SNote(float frequency) :m_frequency(frequency), m_age(0), m_dead(false) {}
+        SNote(float frequency) :m_frequency(frequency), m_velocity(1.0f), m_age(0), m_dead(false) {}
         float   m_frequency;
+        float   m_velocity;
         size_t  m_age;
         bool    m_dead;
     };
@@ -62,13 +63,17 @@ namespace DemoMixing {
     }
 
     //--------------------------------------------------------------------------------------------------
-    void GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
+    size_t GenerateAudioSamples (float **outputChannels, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
 
         // get a lock on our notes vector
         std::lock_guard<std::mutex> guard(g_notesMutex);
 
+        // nothing is playing, so let the demo manager know this buffer is silent
+        if (g_notes.empty())
+            return 0;
+
         // for every sample in our output buffer
-        for (size_t sample = 0; sample < framesPerBuffer; ++sample, outputBuffer += numChannels) {
+        for (size_t sample = 0; sample < framesPerBuffer; ++sample) {
             
             // add up all notes to get the final value.
             float value = 0.0f;
@@ -76,13 +81,12 @@ namespace DemoMixing {
                 g_notes.begin(),
                 g_notes.end(),
                 [&value, sampleRate](SNote& note) {
-                    value += GenerateNoteSample(note, sampleRate);
+                    value += GenerateNoteSample(note, sampleRate) * note.m_velocity;
                 }
             );
 
-            // copy the value to all audio channels
-            for (size_t channel = 0; channel < numChannels; ++channel)
-                outputBuffer[channel] = value;
+            // write the value to the mono output
+            outputChannels[0][sample] = value;
         }
 
         // remove notes that have died
@@ -94,8 +98,22 @@ namespace DemoMixing {
             }
         );
 
-        if (iter != g_notes.end())
-            g_notes.erase(iter);
+        g_notes.erase(iter, g_notes.end());
+
+        return 1;
+    }
+
+    //--------------------------------------------------------------------------------------------------
+    void OnNote (float frequency, float velocity, bool pressed) {
+
+        // nothing to do on note release
+        if (!pressed)
+            return;
+
+        // get a lock on our notes vector and add the new note
+        std::lock_guard<std::mutex> guard(g_notesMutex);
+        g_notes.push_back(SNote(frequency));
+        g_notes.back().m_velocity = velocity;
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -171,9 +189,7 @@ namespace DemoMixing {
             }
         }
 
-        // get a lock on our notes vector and add the new note
-        std::lock_guard<std::mutex> guard(g_notesMutex);
-        g_notes.push_back(SNote(frequency));
+        CDemoMgr::QueueKeyNote(frequency, pressed);
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -30,81 +30,81 @@ namespace DemoPopping {
         return "???";
     }
 
-    EMode g_mode = e_silence;
+    EMode       g_mode = e_silence;
+    TSampleId   g_sampleDreams = c_invalidSampleId;
 
     //--------------------------------------------------------------------------------------------------
-    void OnInit() { }
+    void OnInit() {
+        g_sampleDreams = CSampleRegistry::Find("dreams");
+    }
 
     //--------------------------------------------------------------------------------------------------
     void OnExit() { }
 
     //--------------------------------------------------------------------------------------------------
-    void SampleAudioSamples(float *outputBuffer, size_t framesPerBuffer, size_t numChannels, float sampleRate, size_t &baseIndex, bool pop) {
-
-        SWavFile& sound = g_sample_dreams;
-
-        // fill the buffer
-        for (size_t sample = 0; sample < framesPerBuffer; ++sample, outputBuffer += numChannels, ++baseIndex) {
-
-            // handle the sound dieing when it is done
-            size_t sampleIndex = baseIndex*sound.m_numChannels;
-            if (sampleIndex >= sound.m_numSamples) {
-                g_mode = e_silence;
-                for (size_t channel = 0; channel < numChannels; ++channel)
-                    outputBuffer[channel] = 0.0f;
-                return;
-            }
-
-            // calculate and apply an envelope to the sound samples
-            float envelope = 1.0f;
-            if (!pop) {
-                const float c_envelopeTime = 0.03f;
-                float ageInSeconds = float(baseIndex) / sampleRate;
-                envelope = Envelope4Pt(
+    void SampleAudioSamples(float *outputBuffer, size_t framesPerBuffer, float sampleRate, size_t &baseIndex, bool pop) {
+
+        // read the part of the sound this buffer plays all at once.  If it isn't loaded, it's over.
+        const SWavFile* sound = CSampleRegistry::Get(g_sampleDreams);
+        size_t numFrames = sound ? sound->GetNumFrames() : 0;
+        size_t framesLeft = baseIndex < numFrames ? numFrames - baseIndex : 0;
+        size_t framesToRead = framesPerBuffer < framesLeft ? framesPerBuffer : framesLeft;
+        if (framesToRead > 0)
+            sound->ReadSamples(baseIndex, 0, outputBuffer, framesToRead);
+
+        // calculate and apply an envelope to the sound samples
+        if (!pop) {
+            const float c_envelopeTime = 0.03f;
+            for (size_t sample = 0; sample < framesToRead; ++sample) {
+                float ageInSeconds = float(baseIndex + sample) / sampleRate;
+                outputBuffer[sample] *= Envelope4Pt(
                     ageInSeconds,
                     0.0f, 0.0f,
                     c_envelopeTime, 1.0f,
-                    sound.m_lengthSeconds - c_envelopeTime, 1.0f,
-                    sound.m_lengthSeconds, 0.0f
+                    sound->m_lengthSeconds - c_envelopeTime, 1.0f,
+                    sound->m_lengthSeconds, 0.0f
                 );
             }
-
-            // return the sample value multiplied by the envelope
-            float value = sound.m_samples[sampleIndex] * envelope;
-
-            // copy the value to all audio channels
-            for (size_t channel = 0; channel < numChannels; ++channel)
-                outputBuffer[channel] = value;
         }
+        baseIndex += framesToRead;
 
+        // handle the sound dieing when it is done, with silence for the rest of the buffer
+        if (framesToRead < framesPerBuffer) {
+            g_mode = e_silence;
+            std::fill(&outputBuffer[framesToRead], &outputBuffer[framesPerBuffer], 0.0f);
+        }
     }
 
     //--------------------------------------------------------------------------------------------------
-    void GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
+    size_t GenerateAudioSamples (float **outputChannels, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
 
         // state information stored as statics
         static EMode mode = e_silence;
-        static float phase = 0.0f;
+        static SPhaseAccumulator phase;
         static size_t sampleIndex = 0;
 
         // switch modes if we should
         EMode newMode = g_mode;
         if (newMode != mode) {
             mode = newMode;
-            phase = 0.0f;
+            phase = SPhaseAccumulator();
             sampleIndex = 0;
         }
 
+        // nothing to play until a key is pressed
+        if (mode == e_silence)
+            return 0;
+
         // sample our audio samples if we should
         if (mode == e_samplePop || mode == e_sampleNoPop) {
-            SampleAudioSamples(outputBuffer, framesPerBuffer, numChannels, sampleRate, sampleIndex, mode == e_samplePop);
-            return;
+            SampleAudioSamples(outputChannels[0], framesPerBuffer, sampleRate, sampleIndex, mode == e_samplePop);
+            return 1;
         }
 
         // calculate how many audio samples happen in 1/4 of a second
         const size_t c_quarterSecond = size_t(sampleRate) / 4;
 
-        for (size_t sample = 0; sample < framesPerBuffer; ++sample, outputBuffer += numChannels, ++sampleIndex) {
+        for (size_t sample = 0; sample < framesPerBuffer; ++sample, ++sampleIndex) {
 
             // calculate a floating point time in seconds
             float timeInSeconds = float(sampleIndex) / sampleRate;
@@ -162,17 +162,16 @@ namespace DemoPopping {
                     }
 
                     // calculate how much to advance our phase for this frequency
-                    float phaseAdvance = frequency / sampleRate;
+                    phase.SetFrequency(frequency, sampleRate);
 
                     // calculate the sine value based entirely on phase
-                    value = std::sinf(phase * 2.0f * c_pi);
+                    value = SineWave(phase);
 
                     // multiply in the envelope to avoid popping at the beginning and end
                     value *= envelope;
 
-                    // advance the phase, making sure to stay within 0 and 1
-                    phase += phaseAdvance;
-                    phase = std::fmod(phase, 1.0f);
+                    // advance the phase, which wraps around from 1 to 0 by itself
+                    phase.Advance();
                     break;
                 }
                 case e_notesSlideNoPop: {
@@ -197,25 +196,25 @@ namespace DemoPopping {
                     }
 
                     // calculate how much to advance our phase for this frequency
-                    float phaseAdvance = frequency / sampleRate;
+                    phase.SetFrequency(frequency, sampleRate);
 
                     // calculate the sine value based entirely on phase
-                    value = std::sinf(phase * 2.0f * c_pi);
+                    value = SineWave(phase);
 
                     // multiply in the envelope to avoid popping at the beginning and end
                     value *= envelope;
 
-                    // advance the phase, making sure to stay within 0 and 1
-                    phase += phaseAdvance;
-                    phase = std::fmod(phase, 1.0f);
+                    // advance the phase, which wraps around from 1 to 0 by itself
+                    phase.Advance();
                     break;
                 }
             }
 
-            // copy the value to all audio channels
-            for (size_t channel = 0; channel < numChannels; ++channel)
-                outputBuffer[channel] = value;
+            // write the value to the mono output
+            outputChannels[0][sample] = value;
         }
+
+        return 1;
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -223,6 +222,9 @@ namespace DemoPopping {
         printf("%s\r\n", ModeToString(g_mode));
     }
 
+    //--------------------------------------------------------------------------------------------------
+    void OnNote (float frequency, float velocity, bool pressed) { }
+
     //--------------------------------------------------------------------------------------------------
     void OnKey (char key, bool pressed) {
 
@@ -242,6 +244,7 @@ namespace DemoPopping {
 
     //--------------------------------------------------------------------------------------------------
     void OnEnterDemo () {
+        CSampleRegistry::Prefetch(g_sampleDreams);
         g_mode = e_silence;
         printf("1 = notes with pop.\r\n2 = notes without pop.\r\n3 = note slide without pop.\r\n4 = sample with pop\r\n5 = sample without pop\r\n");
         printf("\r\nInstructions:\r\n");
@@ -34,27 +34,37 @@ namespace DemoReverb {
     struct SNote {
         SNote(float frequency, EWaveForm waveForm)
             : m_frequency(frequency)
+            , m_velocity(1.0f)
             , m_waveForm(waveForm)
             , m_age(0)
             , m_dead(false)
             , m_wantsKeyRelease(false)
-            , m_releaseAge(0) {}
+            , m_releaseAge(0)
+            , m_phase(frequency, CDemoMgr::GetSampleRate()) {}
 
         float       m_frequency;
+        float       m_velocity;
         EWaveForm   m_waveForm;
         size_t      m_age;
         bool        m_dead;
         bool        m_wantsKeyRelease;
         size_t      m_releaseAge;
+
+        SPhaseAccumulator   m_phase;
     };
 
     std::vector<SNote>  g_notes;
     std::mutex          g_notesMutex;
     EWaveForm           g_currentWaveForm;
     bool                g_reverbOn;
+    TSampleId           g_sampleCymbal;
+    TSampleId           g_sampleVoice;
 
     //--------------------------------------------------------------------------------------------------
-    void OnInit() { }
+    void OnInit() {
+        g_sampleCymbal = CSampleRegistry::Find("cymbal");
+        g_sampleVoice = CSampleRegistry::Find("legend1");
+    }
 
     //--------------------------------------------------------------------------------------------------
     void OnExit() { }
@@ -98,8 +108,8 @@ namespace DemoReverb {
                 c_envelopeTime, 0.0f
             );
 
-            // kill the note when the release is done
-            if (secondsInRelease > c_envelopeTime)
+            // kill the note when the release is done, or once it has faded below hearing
+            if (secondsInRelease > c_envelopeTime || envelope < c_envelopeCullThreshold)
                 note.m_dead = true;
         }
 
@@ -107,11 +117,10 @@ namespace DemoReverb {
     }
 
     //--------------------------------------------------------------------------------------------------
-    inline float SampleAudioSample(SNote& note, SWavFile& sample, float ageInSeconds) {
+    inline float SampleAudioSample(SNote& note, const SWavFile* sample, float ageInSeconds) {
 
-        // handle the note dieing when it is done
-        size_t sampleIndex = note.m_age*sample.m_numChannels;
-        if (sampleIndex >= sample.m_numSamples) {
+        // handle the note dieing when it is done, or if the sample isn't loaded
+        if (!sample || note.m_age >= sample->GetNumFrames()) {
             note.m_dead = true;
             return 0.0f;
         }
@@ -121,12 +130,12 @@ namespace DemoReverb {
             ageInSeconds,
             0.0f, 0.0f,
             0.1f, 1.0f,
-            sample.m_lengthSeconds - 0.1f, 1.0f,
-            sample.m_lengthSeconds, 0.0f
+            sample->m_lengthSeconds - 0.1f, 1.0f,
+            sample->m_lengthSeconds, 0.0f
             );
 
         // return the sample value multiplied by the envelope
-        return sample.m_samples[sampleIndex] * envelope;
+        return sample->GetSample(note.m_age, 0) * envelope;
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -139,30 +148,29 @@ namespace DemoReverb {
         // decrease note volume a bit, because the volume adjustments don't seem to be quite enough
         float envelope = GenerateEnvelope(note, ageInSeconds, sampleRate) * 0.8f;
 
-        // generate the audio sample value for the current time.
-        // Note that it is ok that we are basing audio samples on age instead of phase, because the
-        // frequency never changes and we envelope the front and back to avoid popping.
-        float phase = std::fmodf(ageInSeconds * note.m_frequency, 1.0f);
+        // generate the audio sample value for the current phase, and advance the phase by 1 sample
+        SPhaseAccumulator phase = note.m_phase;
+        note.m_phase.Advance();
         switch (note.m_waveForm) {
             case e_waveSine:    return SineWave(phase) * envelope;
-            case e_waveSaw:     return SawWaveBandLimited(phase, 10) * envelope;
-            case e_waveSquare:  return SquareWaveBandLimited(phase, 10) * envelope;
-            case e_waveTriangle:return TriangleWaveBandLimited(phase, 10) * envelope;
-            case e_sampleCymbals:   return SampleAudioSample(note, g_sample_cymbal, ageInSeconds);
-            case e_sampleVoice:     return SampleAudioSample(note, g_sample_legend1, ageInSeconds);
+            case e_waveSaw:     return SawWaveBandLimited(phase.GetPhase(), 10) * envelope;
+            case e_waveSquare:  return SquareWaveBandLimited(phase.GetPhase(), 10) * envelope;
+            case e_waveTriangle:return TriangleWaveBandLimited(phase.GetPhase(), 10) * envelope;
+            case e_sampleCymbals:   return SampleAudioSample(note, CSampleRegistry::Get(g_sampleCymbal), ageInSeconds);
+            case e_sampleVoice:     return SampleAudioSample(note, CSampleRegistry::Get(g_sampleVoice), ageInSeconds);
         }
 
         return 0.0f;
     }
 
     //--------------------------------------------------------------------------------------------------
-    void GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
+    size_t GenerateAudioSamples (float **outputChannels, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
 
         // initialize our effects
         static SMultiTapReverbEffect multiTapReverbEffect;
         static bool effectsInitialized = false;
         if (!effectsInitialized) {
-            multiTapReverbEffect.SetEffectParams(sampleRate, numChannels);
+            multiTapReverbEffect.SetEffectParams(sampleRate);
             effectsInitialized = true;
         }
 
@@ -177,8 +185,12 @@ namespace DemoReverb {
         // get a lock on our notes vector
         std::lock_guard<std::mutex> guard(g_notesMutex);
 
+        // once nothing is playing and the reverb tail has died away, the buffer is silent
+        if (g_notes.empty() && (!currentReverbOn || multiTapReverbEffect.IsAsleep()))
+            return 0;
+
         // for every sample in our output buffer
-        for (size_t sample = 0; sample < framesPerBuffer; ++sample, outputBuffer += numChannels) {
+        for (size_t sample = 0; sample < framesPerBuffer; ++sample) {
             
             // add up all notes to get the final value.
             float value = 0.0f;
@@ -186,7 +198,7 @@ namespace DemoReverb {
                 g_notes.begin(),
                 g_notes.end(),
                 [&value, sampleRate](SNote& note) {
-                    value += GenerateNoteSample(note, sampleRate);
+                    value += GenerateNoteSample(note, sampleRate) * note.m_velocity;
                 }
             );
 
@@ -194,9 +206,8 @@ namespace DemoReverb {
             if (currentReverbOn)
                 value = multiTapReverbEffect.AddSample(value);
 
-            // copy the value to all audio channels
-            for (size_t channel = 0; channel < numChannels; ++channel)
-                outputBuffer[channel] = value;
+            // write the value to the mono output
+            outputChannels[0][sample] = value;
         }
 
         // remove notes that have died
@@ -208,8 +219,9 @@ namespace DemoReverb {
             }
         );
 
-        if (iter != g_notes.end())
-            g_notes.erase(iter);
+        g_notes.erase(iter, g_notes.end());
+
+        return 1;
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -235,6 +247,21 @@ namespace DemoReverb {
         printf("Instrument: %s  Reverb: %s\r\n", WaveFormToString(g_currentWaveForm), g_reverbOn ? "On" : "Off");
     }
 
+    //--------------------------------------------------------------------------------------------------
+    void OnNote (float frequency, float velocity, bool pressed) {
+
+        // if releasing a note, we need to find and kill the flute note of the same frequency
+        if (!pressed) {
+            StopNote(frequency);
+            return;
+        }
+
+        // get a lock on our notes vector and add the new note
+        std::lock_guard<std::mutex> guard(g_notesMutex);
+        g_notes.push_back(SNote(frequency, g_currentWaveForm));
+        g_notes.back().m_velocity = velocity;
+    }
+
     //--------------------------------------------------------------------------------------------------
     void OnKey (char key, bool pressed) {
 
@@ -314,19 +341,13 @@ namespace DemoReverb {
             }
         }
 
-        // if releasing a note, we need to find and kill the flute note of the same frequency
-        if (!pressed) {
-            StopNote(frequency);
-            return;
-        }
-
-        // get a lock on our notes vector and add the new note
-        std::lock_guard<std::mutex> guard(g_notesMutex);
-        g_notes.push_back(SNote(frequency, g_currentWaveForm));
+        CDemoMgr::QueueKeyNote(frequency, pressed);
     }
 
     //--------------------------------------------------------------------------------------------------
     void OnEnterDemo () {
+        CSampleRegistry::Prefetch(g_sampleCymbal);
+        CSampleRegistry::Prefetch(g_sampleVoice);
         g_currentWaveForm = e_waveSine;
         g_reverbOn = false;
         printf("Letter keys to play notes.\r\nleft shift / control is super low frequency.\r\n");
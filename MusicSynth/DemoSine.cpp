@@ -18,25 +18,35 @@ namespace DemoSine {
     void OnExit() { }
 
     //--------------------------------------------------------------------------------------------------
-    void GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
-        static float phase = 0.0f;
+    size_t GenerateAudioSamples (float **outputChannels, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
+        static SPhaseAccumulator phase;
 
         // calculate how much our phase should change each sample
-        float phaseAdvance = g_frequency / sampleRate;
+        phase.SetFrequency(g_frequency, sampleRate);
 
-        for (size_t sample = 0; sample < framesPerBuffer; ++sample, outputBuffer += numChannels) {
+        for (size_t sample = 0; sample < framesPerBuffer; ++sample) {
 
             // get the sine wave amplitude for this phase (angle)
             float value = SineWave(phase);
 
-            // advance the phase, making sure to stay within 0 and 1
-            phase += phaseAdvance;
-            phase = std::fmod(phase, 1.0f);
+            // advance the phase, which wraps around from 1 to 0 by itself
+            phase.Advance();
 
-            // copy the value to all audio channels
-            for (size_t channel = 0; channel < numChannels; ++channel)
-                outputBuffer[channel] = value;
+            // write the value to the mono output
+            outputChannels[0][sample] = value;
         }
+
+        return 1;
+    }
+
+    //--------------------------------------------------------------------------------------------------
+    void OnNote (float frequency, float velocity, bool pressed) {
+
+        // play the new frequency, and go silent when the note playing is released
+        if (pressed)
+            g_frequency = frequency;
+        else if (frequency == g_frequency)
+            g_frequency = 0.0f;
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -14,16 +14,19 @@ namespace DemoStereo {
     struct SNote {
         SNote(float frequency)
             : m_frequency(frequency)
+            , m_velocity(1.0f)
             , m_age(0)
             , m_dead(false)
             , m_releaseAge(0)
-            , m_phase(0.0f) {}
+            , m_phase(frequency, CDemoMgr::GetSampleRate()) {}
 
         float       m_frequency;
+        float       m_velocity;
         size_t      m_age;
         bool        m_dead;
         size_t      m_releaseAge;
-        float       m_phase;
+
+        SPhaseAccumulator   m_phase;
     };
 
     std::vector<SNote>  g_notes;
@@ -32,9 +35,14 @@ namespace DemoStereo {
     bool                g_pingPongDelay;
     bool                g_cymbalsOn;
     bool                g_voiceOn;
+    TSampleId           g_sampleCymbal;
+    TSampleId           g_sampleVoice;
 
     //--------------------------------------------------------------------------------------------------
-    void OnInit() { }
+    void OnInit() {
+        g_sampleCymbal = CSampleRegistry::Find("cymbal");
+        g_sampleVoice = CSampleRegistry::Find("legend2");
+    }
 
     //--------------------------------------------------------------------------------------------------
     void OnExit() { }
@@ -66,20 +74,19 @@ namespace DemoStereo {
                 c_decayTime*0.10f, 0.6f,
                 c_decayTime, 0.0f
             );
-            float phase = std::fmodf(note.m_phase * float(index) , 1.0f);
-            //ret += SineWave(phase) * envelope;
-            ret += SineWave(phase) * envelope;
+            uint32_t phase = note.m_phase.GetHarmonic(uint32_t(index));
+            ret += SineWaveFixed(phase) * envelope;
         }
 
         // advance phase
-        note.m_phase = std::fmodf(note.m_phase + note.m_frequency / sampleRate, 1.0f);
+        note.m_phase.Advance();
 
         // return the value
         return ret;
     }
 
     //--------------------------------------------------------------------------------------------------
-    void GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
+    size_t GenerateAudioSamples (float **outputChannels, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
 
         // handle effect params
         static SPingPongDelayEffect delayEffect;
@@ -87,31 +94,39 @@ namespace DemoStereo {
         static bool wasDelayOn = false;
         bool isDelayOn = g_pingPongDelay;
         if (isDelayOn != wasDelayOn) {
-            delayEffect.SetEffectParams(0.33f, sampleRate, numChannels, 0.0625f);
+            // the delay has always sounded this long, from when its buffer was sized for interleaved stereo
+            delayEffect.SetEffectParams(0.66f, sampleRate, 0.0625f);
             wasDelayOn = isDelayOn;
         }
 
         // handle playing samples
         static bool cymbalsWereOn = false;
-        static size_t cymbalsStarted = 0;
+        static TSampleClock cymbalsStarted = 0;
         bool cymbalsAreOn = g_cymbalsOn;
         if (cymbalsWereOn != cymbalsAreOn) {
             cymbalsWereOn = cymbalsAreOn;
             cymbalsStarted = CDemoMgr::GetSampleClock();
         }
         static bool voiceWasOn = false;
-        static size_t voiceStarted = 0;
+        static TSampleClock voiceStarted = 0;
         bool voiceIsOn = g_voiceOn;
         if (voiceWasOn != voiceIsOn) {
             voiceWasOn = voiceIsOn;
             voiceStarted = CDemoMgr::GetSampleClock();
         }
 
+        const SWavFile* cymbals = cymbalsAreOn ? CSampleRegistry::Get(g_sampleCymbal) : nullptr;
+        const SWavFile* voice = voiceIsOn ? CSampleRegistry::Get(g_sampleVoice) : nullptr;
+
         // get a lock on our notes vector
         std::lock_guard<std::mutex> guard(g_notesMutex);
 
+        // once nothing is playing and the echoes have died away, the buffer is silent
+        if (g_notes.empty() && !cymbalsAreOn && !voiceIsOn && (!isDelayOn || numChannels < 2 || delayEffect.IsAsleep()))
+            return 0;
+
         // for every sample in our output buffer
-        for (size_t sample = 0; sample < framesPerBuffer; ++sample, outputBuffer += numChannels) {
+        for (size_t sample = 0; sample < framesPerBuffer; ++sample) {
             
             // add up all notes to get the final value.
             float valueMono = 0.0f;
@@ -119,24 +134,24 @@ namespace DemoStereo {
                 g_notes.begin(),
                 g_notes.end(),
                 [&valueMono, sampleRate](SNote& note) {
-                    valueMono += GenerateNoteSample(note, sampleRate) * 0.25f;
+                    valueMono += GenerateNoteSample(note, sampleRate) * note.m_velocity * 0.25f;
                 }
             );
 
             // sample the samples if we should
             if (cymbalsAreOn) {
-                size_t sampleIndex = (CDemoMgr::GetSampleClock() + sample - cymbalsStarted) * numChannels;
-                if (sampleIndex < g_sample_cymbal.m_numSamples) {
-                    valueMono += g_sample_cymbal.m_samples[sampleIndex] * 2.0f;
+                size_t sampleIndex = size_t(CDemoMgr::GetSampleClock() + sample - cymbalsStarted);
+                if (cymbals && sampleIndex < cymbals->GetNumFrames()) {
+                    valueMono += cymbals->GetSample(sampleIndex, 0) * 2.0f;
                 }
                 else {
                     g_cymbalsOn = false;
                 }
             }
             if (voiceIsOn) {
-                size_t sampleIndex = (CDemoMgr::GetSampleClock() + sample - voiceStarted) * numChannels;
-                if (sampleIndex < g_sample_legend2.m_numSamples) {
-                    valueMono += g_sample_legend2.m_samples[sampleIndex] * 2.0f;
+                size_t sampleIndex = size_t(CDemoMgr::GetSampleClock() + sample - voiceStarted);
+                if (voice && sampleIndex < voice->GetNumFrames()) {
+                    valueMono += voice->GetSample(sampleIndex, 0) * 2.0f;
                 }
                 else {
                     g_voiceOn = false;
@@ -149,9 +164,9 @@ namespace DemoStereo {
 
             // if sound rotation is on, make some sine/cosine tones to simulate 3d
             if (rotateSound) {
-                float timeInSeconds = float(CDemoMgr::GetSampleClock() + sample) / sampleRate;
-                valueLeft *= std::sinf(timeInSeconds*0.25f*2.0f*c_pi) * 0.45f + 0.55f;
-                valueRight *= std::cosf(timeInSeconds*0.25f*2.0f*c_pi) * 0.45f + 0.55f;
+                float rotation = SampleClockToPhase(CDemoMgr::GetSampleClock() + sample, 0.25, sampleRate);
+                valueLeft *= std::sinf(rotation*2.0f*c_pi) * 0.45f + 0.55f;
+                valueRight *= std::cosf(rotation*2.0f*c_pi) * 0.45f + 0.55f;
             }
 
             // do ping pong delay if we should
@@ -162,12 +177,12 @@ namespace DemoStereo {
                 valueRight += echoRight;
             }
 
-            // copy the values to all audio channels
+            // write the values to the left and right channels
             for (size_t channel = 0; channel < numChannels; ++channel) {
                 if (channel % 2 == 0)
-                    outputBuffer[channel] = valueLeft;
+                    outputChannels[channel][sample] = valueLeft;
                 else
-                    outputBuffer[channel] = valueRight;
+                    outputChannels[channel][sample] = valueRight;
             }
         }
 
@@ -180,8 +195,9 @@ namespace DemoStereo {
             }
         );
 
-        if (iter != g_notes.end())
-            g_notes.erase(iter);
+        g_notes.erase(iter, g_notes.end());
+
+        return numChannels;
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -189,6 +205,19 @@ namespace DemoStereo {
         printf("Rotate Sound: %s, Ping Pong Delay: %s\r\n", g_rotateSound ? "On" : "Off", g_pingPongDelay ? "On" : "Off");
     }
 
+    //--------------------------------------------------------------------------------------------------
+    void OnNote (float frequency, float velocity, bool pressed) {
+
+        // nothing to do on note release
+        if (!pressed)
+            return;
+
+        // get a lock on our notes vector and add the new note
+        std::lock_guard<std::mutex> guard(g_notesMutex);
+        g_notes.push_back(SNote(frequency));
+        g_notes.back().m_velocity = velocity;
+    }
+
     //--------------------------------------------------------------------------------------------------
     void OnKey (char key, bool pressed) {
 
@@ -273,13 +302,13 @@ namespace DemoStereo {
             }
         }
 
-        // get a lock on our notes vector and add the new note
-        std::lock_guard<std::mutex> guard(g_notesMutex);
-        g_notes.push_back(SNote(frequency));
+        CDemoMgr::QueueKeyNote(frequency, pressed);
     }
 
     //--------------------------------------------------------------------------------------------------
     void OnEnterDemo () {
+        CSampleRegistry::Prefetch(g_sampleCymbal);
+        CSampleRegistry::Prefetch(g_sampleVoice);
         g_rotateSound = false;
         g_pingPongDelay = false;
         g_cymbalsOn = false;
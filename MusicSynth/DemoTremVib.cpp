@@ -24,9 +24,22 @@ namespace DemoTremVib {
         e_effectFast
     };
 
+    //--------------------------------------------------------------------------------------------------
+    inline float GetEffectFrequency (EEffectSpeed speed) {
+        switch (speed) {
+            case e_effectOff: return 0.0;
+            case e_effectSlow: return 2.8f;
+            case e_effectMedium: return 10.0f;
+            case e_effectFast: return 20.0f;
+        }
+
+        return 0.0f;
+    }
+
     struct SNote {
         SNote(float frequency, EWaveForm waveForm, EEffectSpeed tremolo, EEffectSpeed vibrato)
             : m_frequency(frequency)
+            , m_velocity(1.0f)
             , m_waveForm(waveForm)
             , m_tremolo(tremolo)
             , m_vibrato(vibrato)
@@ -34,9 +47,12 @@ namespace DemoTremVib {
             , m_dead(false)
             , m_wantsKeyRelease(false)
             , m_releaseAge(0)
-            , m_phase(0.0f) {}
+            , m_phase(frequency, CDemoMgr::GetSampleRate())
+            , m_tremoloPhase(GetEffectFrequency(tremolo), CDemoMgr::GetSampleRate())
+            , m_vibratoPhase(GetEffectFrequency(vibrato), CDemoMgr::GetSampleRate()) {}
 
         float           m_frequency;
+        float           m_velocity;
         EWaveForm       m_waveForm;
         EEffectSpeed    m_tremolo;
         EEffectSpeed    m_vibrato;
@@ -44,7 +60,10 @@ namespace DemoTremVib {
         bool            m_dead;
         bool            m_wantsKeyRelease;
         size_t          m_releaseAge;
-        float           m_phase;
+
+        SPhaseAccumulator   m_phase;
+        SPhaseAccumulator   m_tremoloPhase;
+        SPhaseAccumulator   m_vibratoPhase;
     };
 
     std::vector<SNote>  g_notes;
@@ -98,26 +117,14 @@ namespace DemoTremVib {
                 c_envelopeTime, 0.0f
             );
 
-            // kill the note when the release is done
-            if (secondsInRelease > c_envelopeTime)
+            // kill the note when the release is done, or once it has faded below hearing
+            if (secondsInRelease > c_envelopeTime || envelope < c_envelopeCullThreshold)
                 note.m_dead = true;
         }
 
         return envelope;
     }
 
-    //--------------------------------------------------------------------------------------------------
-    inline float GetEffectFrequency (EEffectSpeed speed) {
-        switch (speed) {
-            case e_effectOff: return 0.0;
-            case e_effectSlow: return 2.8f;
-            case e_effectMedium: return 10.0f;
-            case e_effectFast: return 20.0f;
-        }
-
-        return 0.0f;
-    }
-
     //--------------------------------------------------------------------------------------------------
     inline float GenerateNoteSample (SNote& note, float sampleRate) {
 
@@ -131,36 +138,37 @@ namespace DemoTremVib {
 
         // adjust our envelope by applying tremolo.
         // the tremolo affects the amplitude by multiplying it between 0.5 and 1.0 in a sine wave.
-        envelope *= SineWave(ageInSeconds * GetEffectFrequency(note.m_tremolo)) * 0.25f + 0.5f;
+        envelope *= SineWave(note.m_tremoloPhase) * 0.25f + 0.5f;
+        note.m_tremoloPhase.Advance();
 
-        // calculate our frequency by starting with the base note and applying vibrato.
+        // advance phase, applying vibrato to the base note.
         // our vibratto adds plus or minus 5% of the frequency, on a sine wave.
-        float frequency = note.m_frequency;
-        frequency += frequency * SineWave(ageInSeconds * GetEffectFrequency(note.m_vibrato)) * 0.05f;
-
-        // advance phase, making sure to keep it between 0 and 1
-        note.m_phase += frequency / sampleRate;
-        note.m_phase = std::fmodf(note.m_phase, 1.0);
+        note.m_phase.AdvanceScaled(1.0f + SineWave(note.m_vibratoPhase) * 0.05f);
+        note.m_vibratoPhase.Advance();
 
         // generate the audio sample value for the current phase.
         switch (note.m_waveForm) {
             case e_waveSine:    return SineWave(note.m_phase) * envelope;
-            case e_waveSaw:     return SawWaveBandLimited(note.m_phase, 10) * envelope;
-            case e_waveSquare:  return SquareWaveBandLimited(note.m_phase, 10) * envelope;
-            case e_waveTriangle:return TriangleWaveBandLimited(note.m_phase, 10) * envelope;
+            case e_waveSaw:     return SawWaveBandLimited(note.m_phase.GetPhase(), 10) * envelope;
+            case e_waveSquare:  return SquareWaveBandLimited(note.m_phase.GetPhase(), 10) * envelope;
+            case e_waveTriangle:return TriangleWaveBandLimited(note.m_phase.GetPhase(), 10) * envelope;
         }
 
         return 0.0f;
     }
 
     //--------------------------------------------------------------------------------------------------
-    void GenerateAudioSamples (float *outputBuffer, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
+    size_t GenerateAudioSamples (float **outputChannels, size_t framesPerBuffer, size_t numChannels, float sampleRate) {
 
         // get a lock on our notes vector
         std::lock_guard<std::mutex> guard(g_notesMutex);
 
+        // nothing is playing, so let the demo manager know this buffer is silent
+        if (g_notes.empty())
+            return 0;
+
         // for every sample in our output buffer
-        for (size_t sample = 0; sample < framesPerBuffer; ++sample, outputBuffer += numChannels) {
+        for (size_t sample = 0; sample < framesPerBuffer; ++sample) {
             
             // add up all notes to get the final value.
             float value = 0.0f;
@@ -168,13 +176,12 @@ namespace DemoTremVib {
                 g_notes.begin(),
                 g_notes.end(),
                 [&value, sampleRate](SNote& note) {
-                    value += GenerateNoteSample(note, sampleRate);
+                    value += GenerateNoteSample(note, sampleRate) * note.m_velocity;
                 }
             );
 
-            // copy the value to all audio channels
-            for (size_t channel = 0; channel < numChannels; ++channel)
-                outputBuffer[channel] = value;
+            // write the value to the mono output
+            outputChannels[0][sample] = value;
         }
 
         // remove notes that have died
@@ -186,8 +193,9 @@ namespace DemoTremVib {
             }
         );
 
-        if (iter != g_notes.end())
-            g_notes.erase(iter);
+        g_notes.erase(iter, g_notes.end());
+
+        return 1;
     }
 
     //--------------------------------------------------------------------------------------------------
@@ -208,6 +216,21 @@ namespace DemoTremVib {
         );
     }
 
+    //--------------------------------------------------------------------------------------------------
+    void OnNote (float frequency, float velocity, bool pressed) {
+
+        // if releasing a note, we need to find and kill the flute note of the same frequency
+        if (!pressed) {
+            StopNote(frequency);
+            return;
+        }
+
+        // get a lock on our notes vector and add the new note
+        std::lock_guard<std::mutex> guard(g_notesMutex);
+        g_notes.push_back(SNote(frequency, g_currentWaveForm, g_tremolo, g_vibrato));
+        g_notes.back().m_velocity = velocity;
+    }
+
     //--------------------------------------------------------------------------------------------------
     void OnKey (char key, bool pressed) {
 
@@ -278,16 +301,7 @@ namespace DemoTremVib {
             }
         }
 
-
-        // if releasing a note, we need to find and kill the flute note of the same frequency
-        if (!pressed) {
-            StopNote(frequency);
-            return;
-        }
-
-        // get a lock on our notes vector and add the new note
-        std::lock_guard<std::mutex> guard(g_notesMutex);
-        g_notes.push_back(SNote(frequency, g_currentWaveForm, g_tremolo, g_vibrato));
+        CDemoMgr::QueueKeyNote(frequency, pressed);
     }
 
     //--------------------------------------------------------------------------------------------------
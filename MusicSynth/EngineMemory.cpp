@@ -0,0 +1,233 @@
+//--------------------------------------------------------------------------------------------------
+// EngineMemory.cpp
+//
+// Memory for sample data and effect buffers, from a locked arena if there is one.
+//
+//--------------------------------------------------------------------------------------------------
+
+#include "EngineMemory.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <map>
+#include <iterator>
+#include <mutex>
+#include <atomic>
+#include <new>
+
+#ifdef _WIN32
+#include <Windows.h> // for VirtualAlloc and VirtualLock
+#else
+#include <sys/mman.h>
+#endif
+
+// every allocation starts with this, which keeps what comes after it 16 byte aligned for SSE
+struct SAllocationHeader {
+    uint64_t    m_size;     // including the header
+    uint64_t    m_inArena;
+};
+static const size_t c_alignment = 16;
+static_assert(sizeof(SAllocationHeader) == c_alignment, "the header has to keep allocations aligned");
+
+// The arena, and the free ranges in it by offset, so neighbours can be merged when freed.  Made once
+// by Init() and never destroyed, so that effects and samples that are destroyed at exit can still
+// free into it.
+struct SArena {
+    std::mutex                  m_mutex;
+    uint8_t*                    m_memory;
+    size_t                      m_size;
+    bool                        m_locked;
+    bool                        m_hugePages;
+    std::map<size_t, size_t>    m_freeRanges;
+    size_t                      m_used;
+    size_t                      m_peakUsed;
+};
+
+static SArena*              s_arena = nullptr;
+static std::atomic<size_t>  s_heapUsed(0);
+
+//--------------------------------------------------------------------------------------------------
+static size_t RoundUp (size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+//--------------------------------------------------------------------------------------------------
+static uint8_t* MapArena (size_t& bytes, bool hugePages, bool& gotHugePages, bool& locked) {
+    uint8_t* memory = nullptr;
+    gotHugePages = false;
+    locked = false;
+
+#ifdef _WIN32
+    // large pages need the "lock pages in memory" privilege, and are always locked
+    if (hugePages && GetLargePageMinimum() > 0) {
+        size_t largeBytes = RoundUp(bytes, GetLargePageMinimum());
+        memory = (uint8_t*)VirtualAlloc(nullptr, largeBytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (memory) {
+            bytes = largeBytes;
+            gotHugePages = true;
+            locked = true;
+            return memory;
+        }
+    }
+
+    memory = (uint8_t*)VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (!memory)
+        return nullptr;
+
+    // the working set has to be big enough to hold everything we lock, on top of what's in it already
+    SIZE_T minWorkingSet, maxWorkingSet;
+    if (GetProcessWorkingSetSize(GetCurrentProcess(), &minWorkingSet, &maxWorkingSet))
+        SetProcessWorkingSetSize(GetCurrentProcess(), minWorkingSet + bytes, maxWorkingSet + bytes);
+    locked = VirtualLock(memory, bytes) != 0;
+#else
+    // MAP_POPULATE faults the whole arena in now, rather than a page at a time as it's first used
+    #ifdef MAP_HUGETLB
+    if (hugePages) {
+        static const size_t c_hugePageSize = 2 * 1024 * 1024;
+        size_t hugeBytes = RoundUp(bytes, c_hugePageSize);
+        void* mapped = mmap(nullptr, hugeBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGETLB, -1, 0);
+        if (mapped != MAP_FAILED) {
+            memory = (uint8_t*)mapped;
+            bytes = hugeBytes;
+            gotHugePages = true;
+        }
+    }
+    #endif
+
+    if (!memory) {
+        void* mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (mapped == MAP_FAILED)
+            return nullptr;
+        memory = (uint8_t*)mapped;
+    }
+
+    // this fails without CAP_IPC_LOCK or a high enough RLIMIT_MEMLOCK
+    locked = mlock(memory, bytes) == 0;
+#endif
+
+    // touch every page, in case the platform didn't fault them in for us
+    memset(memory, 0, bytes);
+    return memory;
+}
+
+//--------------------------------------------------------------------------------------------------
+bool CEngineMemory::Init (size_t bytes, bool hugePages) {
+    if (s_arena || bytes == 0)
+        return false;
+
+    bytes = RoundUp(bytes, c_alignment);
+    bool gotHugePages, locked;
+    uint8_t* memory = MapArena(bytes, hugePages, gotHugePages, locked);
+    if (!memory) {
+        printf("ERROR: could not map %i MB for the engine memory arena\r\n", int(bytes / (1024 * 1024)));
+        return false;
+    }
+
+    SArena* arena = new SArena;
+    arena->m_memory = memory;
+    arena->m_size = bytes;
+    arena->m_locked = locked;
+    arena->m_hugePages = gotHugePages;
+    arena->m_freeRanges[0] = bytes;
+    arena->m_used = 0;
+    arena->m_peakUsed = 0;
+    s_arena = arena;
+
+    if (!locked)
+        printf("WARNING: could not lock the engine memory arena in RAM, it may page fault.  Raise the memlock limit to lock it.\r\n");
+    if (hugePages && !gotHugePages)
+        printf("WARNING: could not get huge pages for the engine memory arena, using normal pages\r\n");
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+void* CEngineMemory::AllocateBytes (size_t bytes) {
+    size_t size = RoundUp(bytes + sizeof(SAllocationHeader), c_alignment);
+
+    // first fit from the arena
+    SAllocationHeader* header = nullptr;
+    if (s_arena) {
+        std::lock_guard<std::mutex> guard(s_arena->m_mutex);
+        for (auto iter = s_arena->m_freeRanges.begin(); iter != s_arena->m_freeRanges.end(); ++iter) {
+            if (iter->second < size)
+                continue;
+
+            size_t offset = iter->first;
+            size_t rangeSize = iter->second;
+            s_arena->m_freeRanges.erase(iter);
+            if (rangeSize > size)
+                s_arena->m_freeRanges[offset + size] = rangeSize - size;
+
+            s_arena->m_used += size;
+            if (s_arena->m_used > s_arena->m_peakUsed)
+                s_arena->m_peakUsed = s_arena->m_used;
+
+            header = (SAllocationHeader*)&s_arena->m_memory[offset];
+            header->m_inArena = 1;
+            break;
+        }
+    }
+
+    // else from the heap
+    if (!header) {
+        header = (SAllocationHeader*)::operator new(size);
+        header->m_inArena = 0;
+        s_heapUsed += size;
+    }
+
+    header->m_size = size;
+    void* memory = header + 1;
+    memset(memory, 0, size - sizeof(SAllocationHeader));
+    return memory;
+}
+
+//--------------------------------------------------------------------------------------------------
+void CEngineMemory::Free (void* memory) {
+    if (!memory)
+        return;
+
+    SAllocationHeader* header = (SAllocationHeader*)memory - 1;
+    size_t size = size_t(header->m_size);
+    if (!header->m_inArena) {
+        s_heapUsed -= size;
+        ::operator delete(header);
+        return;
+    }
+
+    // give the range back, merging it with the free ranges either side of it
+    std::lock_guard<std::mutex> guard(s_arena->m_mutex);
+    size_t offset = (uint8_t*)header - s_arena->m_memory;
+    s_arena->m_used -= size;
+    auto next = s_arena->m_freeRanges.lower_bound(offset);
+    if (next != s_arena->m_freeRanges.end() && next->first == offset + size) {
+        size += next->second;
+        next = s_arena->m_freeRanges.erase(next);
+    }
+    if (next != s_arena->m_freeRanges.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            prev->second += size;
+            return;
+        }
+    }
+    s_arena->m_freeRanges[offset] = size;
+}
+
+//--------------------------------------------------------------------------------------------------
+void CEngineMemory::Report () {
+    static const double c_MB = 1024.0 * 1024.0;
+    if (!s_arena) {
+        printf("Engine memory: no arena, %0.1f MB from the heap\r\n", double(s_heapUsed.load()) / c_MB);
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(s_arena->m_mutex);
+    printf("Engine memory: %0.1f MB arena (%s%s), %0.1f MB used, %0.1f MB peak, %0.1f MB from the heap\r\n",
+        double(s_arena->m_size) / c_MB,
+        s_arena->m_locked ? "locked" : "not locked",
+        s_arena->m_hugePages ? ", huge pages" : "",
+        double(s_arena->m_used) / c_MB,
+        double(s_arena->m_peakUsed) / c_MB,
+        double(s_heapUsed.load()) / c_MB
+    );
+}
@@ -0,0 +1,38 @@
+//--------------------------------------------------------------------------------------------------
+// EngineMemory.h
+//
+// Memory for sample data and effect buffers, which the audio thread reads and writes.  If an arena
+// is set up it comes from there, which is mapped, faulted in and locked in RAM up front, so the
+// audio thread never takes a page fault on it, even the first time a buffer is touched or after the
+// system has been short on memory.  Allocations that don't fit in the arena, or when there is no
+// arena, come from the heap instead.
+//
+// Memory always comes back zeroed, which faults in every page of heap allocations too.
+//
+//--------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <stddef.h>
+
+//--------------------------------------------------------------------------------------------------
+class CEngineMemory {
+public:
+    // Main thread, before anything is allocated.  Maps an arena of this many bytes, faults it in and
+    // tries to lock it.  Returns false if it couldn't be mapped at all.  Not being able to lock it,
+    // which needs privileges or a high enough memlock limit, or not getting huge pages, is reported
+    // but not an error.
+    static bool Init (size_t bytes, bool hugePages);
+
+    // Any thread.  Zeroed memory for count Ts, which must not need constructing.  Never nullptr.
+    template <typename T>
+    static T* Allocate (size_t count) { return (T*)AllocateBytes(count * sizeof(T)); }
+
+    // Any thread.  Frees memory from Allocate().  nullptr is ignored.
+    static void Free (void* memory);
+
+    // Prints the arena size, whether it's locked, and how much is used in and outside of it.
+    static void Report ();
+
+private:
+    static void* AllocateBytes (size_t bytes);
+};
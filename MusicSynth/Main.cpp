@@ -6,32 +6,39 @@
 //--------------------------------------------------------------------------------------------------
 
 #include <stdio.h>
-#include "PortAudio/include/portaudio.h"
+#include <string.h>
+#include <stdlib.h>
+#include "AudioBackend.h"
 #include "DemoMgr.h"
+#include "EngineMemory.h"
+#include "MidiFile.h"
+#include "MidiInput.h"
 #include <algorithm>
-#include <Windows.h> // for getting key states
+#include <chrono>
+#include <thread>
+#ifdef _WIN32
+#include <Windows.h> // for getting key states, and the timer resolution (link with winmm.lib)
+#else
+#include <termios.h> // for reading keys from the terminal
+#include <unistd.h>
+#endif
 
-// audio data needed by the audio sample generator
-float               g_sampleRate = 0.0f;
 static const size_t g_numChannels = 2;
 
+#ifdef _WIN32
+
+// How often the main thread checks the keyboard.  GetAsyncKeyState can't be waited on, so the main
+// thread sleeps this long in between, instead of spinning a core.
+static const size_t c_keyPollMs = 2;
+
 //--------------------------------------------------------------------------------------------------
 struct SKeyState {
     SHORT m_keys[256];
 };
 
-//--------------------------------------------------------------------------------------------------
-static int GenerateAudioSamples (
-    const void *inputBuffer,
-    void *outputBuffer,
-    unsigned long framesPerBuffer,
-    const PaStreamCallbackTimeInfo* timeInfo,
-    PaStreamCallbackFlags statusFlags,
-    void *userData
-) {
-    CDemoMgr::GenerateAudioSamples((float*)outputBuffer, framesPerBuffer, g_numChannels, g_sampleRate);
-    return paContinue;
-}
+static SKeyState g_keyStates[2];
+static SKeyState* g_oldKeyState = &g_keyStates[0];
+static SKeyState* g_newKeyState = &g_keyStates[1];
 
 //--------------------------------------------------------------------------------------------------
 void GatherKeyStates (SKeyState& state) {
@@ -42,125 +49,487 @@ void GatherKeyStates (SKeyState& state) {
 }
 
 //--------------------------------------------------------------------------------------------------
-void GenerateKeyEvents (SKeyState& oldState, SKeyState& newState) {
+void GenerateKeyEvents (SKeyState& oldState, SKeyState& newState, double streamTime) {
     for (size_t i = 0; i < 256; ++i) {
         if ((oldState.m_keys[i] != 0) != (newState.m_keys[i] != 0)) {
-            CDemoMgr::OnKey(char(i), newState.m_keys[i] != 0);
+            CDemoMgr::OnKey(char(i), newState.m_keys[i] != 0, streamTime);
         }
     }
 }
 
 //--------------------------------------------------------------------------------------------------
-int main (int argc, char **argv)
-{
-    // initialize port audio
-    PaError err = Pa_Initialize();
-    if (err != paNoError)
-    {
-        printf("Pa_Initialize returned error: %i\n", err);
-        return err;
+static void StartKeyInput () {
+    GatherKeyStates(*g_oldKeyState);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void PollKeyInput (double streamTime) {
+    GatherKeyStates(*g_newKeyState);
+    GenerateKeyEvents(*g_oldKeyState, *g_newKeyState, streamTime);
+    std::swap(g_oldKeyState, g_newKeyState);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void WaitForKeyInput () {
+    CDemoMgr::WaitForWork(c_keyPollMs);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void StopKeyInput () { }
+
+#else
+
+// Without GetAsyncKeyState, keys come from the terminal, which only says when a key is typed, not
+// when it's let go.  A key counts as held until it stops auto repeating.  Auto repeat waits around
+// half a second (up to 660ms by default on X) before the first repeat, then repeats every 30-40ms,
+// so a key is held longer than that first wait until it repeats, and only briefly after that.
+static const int c_terminalKeyFirstHoldMs = 750;
+static const int c_terminalKeyRepeatHoldMs = 100;
+
+// With no keys held, the main thread sleeps until a key is typed or it's woken, but wakes up this
+// often anyway, to keep a midi file fed and free up what the audio thread is done with.
+static const int c_idleWakeMs = 100;
+
+static bool g_terminalRaw = false;
+static termios g_savedTerminal;
+static bool g_keyDown[256];
+static bool g_keyRepeating[256];
+static std::chrono::steady_clock::time_point g_keyLastSeen[256];
+
+//--------------------------------------------------------------------------------------------------
+// Turns the next key in what the terminal sent into the Windows virtual key code the demos use,
+// or 0 if it isn't one they use.  Sets used to how many bytes it took up.
+static unsigned char TerminalToKey (const unsigned char* bytes, size_t count, size_t& used) {
+    used = 1;
+    unsigned char c = bytes[0];
+
+    // escape sequences for the arrow keys and F1-F4, or escape on its own
+    if (c == 27) {
+        if (count >= 3 && (bytes[1] == '[' || bytes[1] == 'O')) {
+            used = 3;
+            switch (bytes[2]) {
+                case 'A': return 38;    // up
+                case 'B': return 40;    // down
+                case 'C': return 39;    // right
+                case 'D': return 37;    // left
+                case 'P': return 112;   // F1
+                case 'Q': return 113;   // F2
+                case 'R': return 114;   // F3
+                case 'S': return 115;   // F4
+            }
+            return 0;
+        }
+        return 27;
     }
 
-    // figure out what api index WASAPI is
-    PaHostApiIndex hostApiIndex = Pa_HostApiTypeIdToHostApiIndex(paWASAPI);
-    if (hostApiIndex < 0)
-    {
-        printf("Pa_HostApiTypeIdToHostApiIndex returned error: %i\n", err);
-        return err;
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 'A';
+    if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == ' ')
+        return c;
+
+    switch (c) {
+        case 3: return 27;      // ctrl+c exits cleanly, like escape
+        case '\r':
+        case '\n': return 13;
+        case 8:
+        case 127: return 8;     // backspace
+        case ';': return 0xBA;
+        case '-': return 0xBD;
+        case ',': return 0xBC;
+        case '.': return 0xBE;
+        case '/': return 0xBF;
+        case '[': return 0xDB;
+        case '\'': return 0xDE;
     }
+    return 0;
+}
 
-    // get information about the WASAPI host api
-    const PaHostApiInfo *hostApiInfo = Pa_GetHostApiInfo(hostApiIndex);
-    if (hostApiInfo == nullptr)
-    {
-        printf("Pa_GetHostApiInfo returned nullptr\n");
-        return -1;
+//--------------------------------------------------------------------------------------------------
+static void StartKeyInput () {
+
+    // take keys as they are typed, without echoing them.  With no terminal there are no keys.
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &g_savedTerminal) != 0)
+        return;
+    termios raw = g_savedTerminal;
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    g_terminalRaw = tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void PollKeyInput (double streamTime) {
+    if (!g_terminalRaw)
+        return;
+
+    // press the keys that were typed, or note that they are still being held
+    auto now = std::chrono::steady_clock::now();
+    unsigned char bytes[64];
+    ssize_t count = read(STDIN_FILENO, bytes, sizeof(bytes));
+    for (size_t index = 0, used = 0; count > 0 && index < size_t(count); index += used) {
+        unsigned char key = TerminalToKey(&bytes[index], size_t(count) - index, used);
+        if (key == 0)
+            continue;
+        if (!g_keyDown[key]) {
+            g_keyDown[key] = true;
+            CDemoMgr::OnKey(char(key), true, streamTime);
+        }
+        else {
+            g_keyRepeating[key] = true;
+        }
+        g_keyLastSeen[key] = now;
     }
 
-    // make sure there's an output device
-    if (hostApiInfo->defaultOutputDevice == paNoDevice) {
-        fprintf(stderr, "No default output device\n");
-        return -1;
+    // let go of keys that have stopped repeating
+    for (size_t key = 0; key < 256; ++key) {
+        int holdMs = g_keyRepeating[key] ? c_terminalKeyRepeatHoldMs : c_terminalKeyFirstHoldMs;
+        if (g_keyDown[key] && now - g_keyLastSeen[key] > std::chrono::milliseconds(holdMs)) {
+            g_keyDown[key] = false;
+            g_keyRepeating[key] = false;
+            CDemoMgr::OnKey(char(key), false, streamTime);
+        }
     }
+}
 
-    // get device info if we can
-    const PaDeviceInfo* deviceInfo = Pa_GetDeviceInfo(hostApiInfo->defaultOutputDevice);
-    if (hostApiInfo == nullptr)
-    {
-        printf("Pa_GetDeviceInfo returned nullptr\n");
-        return -1;
+//--------------------------------------------------------------------------------------------------
+// Sleeps until a key is typed, or a held key should be let go
+static void WaitForKeyInput () {
+    auto now = std::chrono::steady_clock::now();
+    int timeoutMs = c_idleWakeMs;
+    for (size_t key = 0; key < 256; ++key) {
+        if (!g_keyDown[key])
+            continue;
+        int holdMs = g_keyRepeating[key] ? c_terminalKeyRepeatHoldMs : c_terminalKeyFirstHoldMs;
+        auto heldMs = std::chrono::duration_cast<std::chrono::milliseconds>(now - g_keyLastSeen[key]).count();
+        timeoutMs = std::min(timeoutMs, std::max(int(holdMs - heldMs) + 1, 0));
     }
+    CDemoMgr::WaitForWork(size_t(timeoutMs), g_terminalRaw ? STDIN_FILENO : -1);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void StopKeyInput () {
+    if (g_terminalRaw)
+        tcsetattr(STDIN_FILENO, TCSANOW, &g_savedTerminal);
+    g_terminalRaw = false;
+}
+
+#endif
+
+//--------------------------------------------------------------------------------------------------
+// Renders a midi file as fast as possible, without an audio device, and records it to a wave file.
+static int RenderOffline (const SMidiFile& midiFile, int demo) {
+    static const float c_sampleRate = 44100.0f;
+    static const size_t c_framesPerBuffer = 512;
+    static const double c_tailSeconds = 2.0; // let the last notes release and effects ring out
 
-    // open a stereo output stream
-    PaStreamParameters outputParameters;
-    outputParameters.device = hostApiInfo->defaultOutputDevice;
-    outputParameters.channelCount = g_numChannels;
-    outputParameters.sampleFormat = paFloat32;
-    outputParameters.suggestedLatency = deviceInfo->defaultLowOutputLatency;
-    outputParameters.hostApiSpecificStreamInfo = nullptr;
-    PaStream* stream = nullptr;
-    err = Pa_OpenStream(
-        &stream,
-        nullptr,
-        &outputParameters,
-        deviceInfo->defaultSampleRate,
-        0,
-        0,
-        GenerateAudioSamples,
-        nullptr
-    );
-    if (err != paNoError) {
-        printf("Pa_OpenStream returned error: %i\n", err);
-        return err;
+    CDemoMgr::Init(c_sampleRate, g_numChannels);
+    if (demo >= 0)
+        CDemoMgr::SwitchDemo(EDemo(demo));
+    CDemoMgr::QueueMidiFile(midiFile, 0);
+    CDemoMgr::StartRecording();
+
+    float buffer[c_framesPerBuffer * g_numChannels];
+    size_t numFrames = size_t((midiFile.m_lengthSeconds + c_tailSeconds) * c_sampleRate);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t frame = 0; frame < numFrames; frame += c_framesPerBuffer) {
+        size_t framesPerBuffer = numFrames - frame < c_framesPerBuffer ? numFrames - frame : c_framesPerBuffer;
+        CDemoMgr::GenerateAudioSamples(buffer, framesPerBuffer, g_numChannels, c_sampleRate, double(frame) / c_sampleRate);
+        CDemoMgr::Update();
     }
+    std::chrono::duration<double> renderTime = std::chrono::high_resolution_clock::now() - start;
+
+    // exiting stops the recording
+    CDemoMgr::Exit();
 
-    // get the stream info for the stream we created
-    const PaStreamInfo* streamInfo = Pa_GetStreamInfo(stream);
-    if (streamInfo == nullptr)
-    {
-        printf("Pa_GetStreamInfo returned nullptr\n");
+    double audioSeconds = double(numFrames) / c_sampleRate;
+    printf("Rendered %0.2f seconds of audio in %0.2f seconds (%0.1fx realtime)\r\n", audioSeconds, renderTime.count(), audioSeconds / renderTime.count());
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Plays a chord on a demo at each buffer size from smallest to largest, and reports the smallest
+// that gets through the given number of seconds without an xrun.
+static int CalibrateBufferSize (SAudioBackendSettings settings, int demo, double seconds) {
+    static const size_t c_bufferSizes[] = { 32, 64, 128, 256, 512, 1024, 2048 };
+    static const int c_chordNotes[] = { 48, 55, 60, 64, 67, 72, 76, 79 };
+    static const double c_warmUpSeconds = 0.25; // xruns while the stream starts up don't count
+    static const double c_retriggerSeconds = 0.5; // so that demos whose notes die out keep working
+
+    printf("Calibrating: %0.1f seconds per buffer size\r\n", seconds);
+
+    bool initialized = false;
+    size_t bestBufferSize = 0;
+    for (size_t bufferSize : c_bufferSizes) {
+        settings.m_framesPerBuffer = bufferSize;
+        std::unique_ptr<CAudioBackend> audioBackend = CAudioBackend::Create(settings.m_backend);
+        if (!audioBackend || !audioBackend->Open(settings, g_numChannels, CDemoMgr::GenerateAudioSamples))
+            return -1;
+        if (!initialized) {
+            CDemoMgr::Init(audioBackend->GetSampleRate(), g_numChannels);
+            if (demo >= 0)
+                CDemoMgr::SwitchDemo(EDemo(demo));
+            initialized = true;
+        }
+        if (!audioBackend->Start())
+            return -1;
+        std::this_thread::sleep_for(std::chrono::duration<double>(c_warmUpSeconds));
+        size_t startXruns = audioBackend->GetNumXruns();
+
+        // keep playing the chord for the whole run
+        float sampleRate = audioBackend->GetSampleRate();
+        TSampleClock startClock = CDemoMgr::StreamTimeToSampleClock(audioBackend->GetTime());
+        for (double time = 0.0; time < seconds; time += c_retriggerSeconds) {
+            TSampleClock noteOnClock = startClock + TSampleClock(time * double(sampleRate));
+            TSampleClock noteOffClock = noteOnClock + TSampleClock(c_retriggerSeconds * 0.9 * double(sampleRate));
+            for (int note : c_chordNotes) {
+                CDemoMgr::QueueNoteEvent(MIDINoteToFrequency(note), 1.0f, true, noteOnClock);
+                CDemoMgr::QueueNoteEvent(MIDINoteToFrequency(note), 0.0f, false, noteOffClock);
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+
+        size_t numXruns = audioBackend->GetNumXruns() - startXruns;
+        printf("  %4i frames: output latency %5.1fms, %i xruns\r\n", int(bufferSize), audioBackend->GetOutputLatency() * 1000.0, int(numXruns));
+        audioBackend->Close();
+
+        if (numXruns == 0) {
+            bestBufferSize = bufferSize;
+            break;
+        }
+    }
+
+    CDemoMgr::Exit();
+    if (bestBufferSize == 0) {
+        printf("No buffer size ran without xruns\r\n");
         return -1;
     }
-    g_sampleRate = (float)streamInfo->sampleRate;
+    printf("Smallest buffer without xruns: -buffer %i\r\n", int(bestBufferSize));
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Times buffers of a reverb, a feedback delay and a filter ringing out after a quiet impulse, which
+// decays into denormals within a second or so.  Reports the average and slowest buffer.
+static void TimeDecayingTail (double seconds, bool denormalGuard, double& averageMs, double& slowestMs) {
+    static const float c_sampleRate = 44100.0f;
+    static const size_t c_framesPerBuffer = 512;
+    static const float c_impulse = 1e-35f;
+
+    SMultiTapReverbEffect reverb;
+    SDelayEffect delay;
+    SBiQuad filter;
+    reverb.SetEffectParams(c_sampleRate);
+    delay.SetEffectParams(0.1f, c_sampleRate, 0.7f);
+    filter.SetEffectParams(SBiQuad::EType::e_lowPass, 2000.0f, c_sampleRate, 0.707f, 0.0f);
+
+    std::unique_ptr<SDenormalGuard> guard(denormalGuard ? new SDenormalGuard : nullptr);
+    float buffer[c_framesPerBuffer];
+    size_t numBuffers = size_t(seconds * c_sampleRate) / c_framesPerBuffer;
+    double totalSeconds = 0.0;
+    slowestMs = 0.0;
+    for (size_t bufferIndex = 0; bufferIndex < numBuffers; ++bufferIndex) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t frame = 0; frame < c_framesPerBuffer; ++frame) {
+            float input = (bufferIndex == 0 && frame == 0) ? c_impulse : 0.0f;
+            buffer[frame] = filter.AddSample(delay.AddSample(reverb.AddSample(input)) + input);
+        }
+        std::chrono::duration<double> renderTime = std::chrono::high_resolution_clock::now() - start;
+        totalSeconds += renderTime.count();
+        if (renderTime.count() * 1000.0 > slowestMs)
+            slowestMs = renderTime.count() * 1000.0;
+    }
+    averageMs = numBuffers > 0 ? totalSeconds * 1000.0 / double(numBuffers) : 0.0;
+
+    // keep the output alive so the work isn't optimized away
+    if (buffer[0] > 1.0f)
+        printf("%f\r\n", buffer[0]);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Shows what SDenormalGuard saves on a decaying effect tail
+static int TimeDenormals (double seconds) {
+    double averageMs, slowestMs, averageGuardedMs, slowestGuardedMs;
+    TimeDecayingTail(seconds, false, averageMs, slowestMs);
+    TimeDecayingTail(seconds, true, averageGuardedMs, slowestGuardedMs);
+    printf("Decaying tail, 512 frame buffers:\r\n");
+    printf("  without denormal guard: %0.3fms average, %0.3fms slowest\r\n", averageMs, slowestMs);
+    printf("  with denormal guard:    %0.3fms average, %0.3fms slowest\r\n", averageGuardedMs, slowestGuardedMs);
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+int main (int argc, char **argv)
+{
+    // command line options:
+    //   -midi <file>   play a midi file on the current demo
+    //   -render        render the midi file to a wave file as fast as possible, instead of playing it
+    //   -demo <number> start on this demo instead of the first one
+    //   -midiin        create a MIDI input port to play the demos from a keyboard or sequencer
+    //   -backend <name>    wasapi, alsa, jack, null (no output) or file (write output to a wave file)
+    //   -out <file>        the file for the file backend
+    //   -buffer <frames>   frames per buffer, instead of letting the backend choose
+    //   -latency <ms>      suggested output latency, instead of the device's default low latency
+    //   -calibrate <seconds>   find the smallest buffer that plays the demo for this long without xruns
+    //   -denormals <seconds>   time an effect tail decaying for this long, with and without flushing denormals
+    //   -compress      keep samples in memory as 16 bit with a scale per block, instead of float
+    //   -samplebudget <MB> unload samples that haven't played for a while to stay under this much memory
+    //   -lockmem <MB>  put samples and effect buffers in an arena this big, locked in RAM so it can't page fault
+    //   -hugepages     use huge pages for the -lockmem arena, if the system has them set up
+    //   -rtprio <1-99> run the audio thread and workers with real time scheduling at this priority
+    //   -rtpolicy fifo|rr  SCHED_FIFO (the default) or SCHED_RR for -rtprio
+    //   -cores <list>  pin the audio thread to the first of these cores, and the workers to the rest
+    SAudioBackendSettings audioSettings;
+    double calibrateSeconds = 0.0;
+    const char* midiFileName = nullptr;
+    bool render = false;
+    bool midiIn = false;
+    int demo = -1;
+    size_t lockMemory = 0;
+    bool hugePages = false;
+    int rtPriority = 0;
+    bool rtRoundRobin = false;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-midi") && i + 1 < argc) {
+            midiFileName = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-render")) {
+            render = true;
+        }
+        else if (!strcmp(argv[i], "-midiin")) {
+            midiIn = true;
+        }
+        else if (!strcmp(argv[i], "-backend") && i + 1 < argc) {
+            audioSettings.m_backend = CAudioBackend::StringToBackend(argv[++i]);
+            if (audioSettings.m_backend == EAudioBackend::e_count) {
+                printf("Unknown audio backend %s\n", argv[i]);
+                return -1;
+            }
+        }
+        else if (!strcmp(argv[i], "-out") && i + 1 < argc) {
+            audioSettings.m_fileName = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-buffer") && i + 1 < argc) {
+            audioSettings.m_framesPerBuffer = size_t(atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "-latency") && i + 1 < argc) {
+            audioSettings.m_suggestedLatency = atof(argv[++i]) / 1000.0;
+        }
+        else if (!strcmp(argv[i], "-calibrate") && i + 1 < argc) {
+            calibrateSeconds = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-denormals") && i + 1 < argc) {
+            return TimeDenormals(atof(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "-compress")) {
+            CSampleRegistry::SetCompress(true);
+        }
+        else if (!strcmp(argv[i], "-samplebudget") && i + 1 < argc) {
+            CSampleRegistry::SetMemoryBudget(size_t(atof(argv[++i]) * 1024.0 * 1024.0));
+        }
+        else if (!strcmp(argv[i], "-lockmem") && i + 1 < argc) {
+            lockMemory = size_t(atof(argv[++i]) * 1024.0 * 1024.0);
+        }
+        else if (!strcmp(argv[i], "-hugepages")) {
+            hugePages = true;
+        }
+        else if (!strcmp(argv[i], "-rtprio") && i + 1 < argc) {
+            rtPriority = atoi(argv[++i]);
+            if (rtPriority < 1 || rtPriority > 99) {
+                printf("Real time priority must be between 1 and 99\n");
+                return -1;
+            }
+        }
+        else if (!strcmp(argv[i], "-rtpolicy") && i + 1 < argc) {
+            ++i;
+            if (!strcmp(argv[i], "rr"))
+                rtRoundRobin = true;
+            else if (strcmp(argv[i], "fifo")) {
+                printf("Unknown scheduling policy %s, use fifo or rr\n", argv[i]);
+                return -1;
+            }
+        }
+        else if (!strcmp(argv[i], "-cores") && i + 1 < argc) {
+            if (!CAudioThreads::SetCores(argv[++i]))
+                return -1;
+        }
+        else if (!strcmp(argv[i], "-demo") && i + 1 < argc) {
+            demo = atoi(argv[++i]) - 1;
+            if (demo < e_demoFirst || demo > e_demoLast) {
+                printf("Demo number must be between 1 and %i\n", e_demoCount);
+                return -1;
+            }
+        }
+        else {
+            printf("Unknown option %s\nusage: MusicSynth [-midi <file> [-render]] [-demo <number>] [-midiin]\n                  [-backend wasapi|alsa|jack|null|file] [-out <file>] [-buffer <frames>] [-latency <ms>]\n                  [-calibrate <seconds>] [-denormals <seconds>] [-compress] [-samplebudget <MB>] [-lockmem <MB> [-hugepages]]\n                  [-rtprio <1-99> [-rtpolicy fifo|rr]] [-cores <list>]\n", argv[i]);
+            return -1;
+        }
+    }
 
-    // start the stream
-    err = Pa_StartStream(stream);
-    if (err != paNoError) {
-        printf("Pa_StartStream returned error: %i\n", err);
-        return err;
+    CAudioThreads::SetRealtime(rtPriority, rtRoundRobin);
+
+    // set up the locked memory before anything allocates samples or effect buffers
+    if (lockMemory > 0 && !CEngineMemory::Init(lockMemory, hugePages))
+        return -1;
+
+    // load the midi file if there is one, and render it if we should
+    SMidiFile midiFile;
+    if (midiFileName && !midiFile.Load(midiFileName)) {
+        printf("Could not load midi file %s\n", midiFileName);
+        return -1;
+    }
+    if (render) {
+        if (!midiFileName) {
+            printf("-render needs a midi file to render\n");
+            return -1;
+        }
+        return RenderOffline(midiFile, demo);
     }
+    if (calibrateSeconds > 0.0)
+        return CalibrateBufferSize(audioSettings, demo, calibrateSeconds);
+
+    // open the audio output
+    std::unique_ptr<CAudioBackend> audioBackend = CAudioBackend::Create(audioSettings.m_backend);
+    if (!audioBackend || !audioBackend->Open(audioSettings, g_numChannels, CDemoMgr::GenerateAudioSamples))
+        return -1;
+
+    // set up the demos before the audio starts, since the audio callback uses what Init() sets up
+    CDemoMgr::Init(audioBackend->GetSampleRate(), g_numChannels);
+    if (demo >= 0)
+        CDemoMgr::SwitchDemo(EDemo(demo));
+    if (!audioBackend->Start())
+        return -1;
+    if (audioSettings.m_framesPerBuffer > 0)
+        printf("Audio output: %s, %i frames per buffer, output latency %0.1fms\r\n", CAudioBackend::BackendToString(audioSettings.m_backend), int(audioSettings.m_framesPerBuffer), audioBackend->GetOutputLatency() * 1000.0);
+    else
+        printf("Audio output: %s, variable frames per buffer, output latency %0.1fms\r\n", CAudioBackend::BackendToString(audioSettings.m_backend), audioBackend->GetOutputLatency() * 1000.0);
 
     // loop of sending key events to demo manager, until it wants to exit.
     // also give the demo manager an update
-    CDemoMgr::Init(g_sampleRate, g_numChannels);
-    SKeyState keyState1;
-    SKeyState keyState2;
-    SKeyState* oldKeyState = &keyState1;
-    SKeyState* newKeyState = &keyState2;
-    GatherKeyStates(*oldKeyState);
+    if (midiFileName)
+        CDemoMgr::QueueMidiFile(midiFile, CDemoMgr::StreamTimeToSampleClock(audioBackend->GetTime()));
+    CMidiInput midiInput;
+    if (midiIn)
+        midiInput.Open("MusicSynth", [&audioBackend] () { return audioBackend->GetTime(); });
+#ifdef _WIN32
+    // Windows rounds sleeps up to the timer resolution, which is 15.6ms unless asked for better, so
+    // the waits between key polls would be far longer than c_keyPollMs
+    timeBeginPeriod(1);
+#endif
+    StartKeyInput();
     while (!CDemoMgr::WantsExit()) {
-        GatherKeyStates(*newKeyState);
-        GenerateKeyEvents(*oldKeyState, *newKeyState);
-        std::swap(oldKeyState, newKeyState);
+        PollKeyInput(audioBackend->GetTime());
         CDemoMgr::Update();
-        Sleep(0);
+        WaitForKeyInput();
     }
+    StopKeyInput();
+#ifdef _WIN32
+    timeEndPeriod(1);
+#endif
 
-    // stop the stream
-    err = Pa_StopStream(stream);
-    if (err != paNoError) {
-        printf("Pa_StopStream returned error: %i\n", err);
-        return err;
-    }
+    // stop listening to MIDI before the stream it timestamps against goes away
+    midiInput.Close();
 
-    // close the stream
-    err = Pa_CloseStream(stream);
-    if (err != paNoError) {
-        printf("Pa_CloseStream returned error: %i\n", err);
-        return err;
-    }
-    
-    // terminate port audio and return success
-    Pa_Terminate();
+    // stop the audio output
+    audioBackend->Close();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,261 @@
+//--------------------------------------------------------------------------------------------------
+// MidiFile.cpp
+//
+// Loads standard MIDI files (type 0 and 1) into a list of note on / note off events.
+//
+//--------------------------------------------------------------------------------------------------
+
+#include "MidiFile.h"
+#include "Platform.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+//--------------------------------------------------------------------------------------------------
+// reads big endian numbers and variable length quantities out of the file's bytes
+class CMidiReader {
+public:
+    CMidiReader (const uint8_t* data, size_t size) : m_data(data), m_size(size), m_pos(0), m_failed(false) { }
+
+    bool Failed () const { return m_failed; }
+    bool AtEnd () const { return m_pos >= m_size; }
+    size_t GetPos () const { return m_pos; }
+
+    uint8_t ReadByte () {
+        if (m_pos >= m_size) {
+            m_failed = true;
+            return 0;
+        }
+        return m_data[m_pos++];
+    }
+
+    uint32_t ReadBigEndian (size_t numBytes) {
+        uint32_t value = 0;
+        for (size_t i = 0; i < numBytes; ++i)
+            value = (value << 8) | ReadByte();
+        return value;
+    }
+
+    uint32_t ReadVariableLength () {
+        uint32_t value = 0;
+        for (size_t i = 0; i < 4; ++i) {
+            uint8_t byte = ReadByte();
+            value = (value << 7) | (byte & 0x7f);
+            if ((byte & 0x80) == 0)
+                return value;
+        }
+        m_failed = true;
+        return value;
+    }
+
+    bool IsTag (const char* tag) const {
+        return m_pos + 4 <= m_size && memcmp(&m_data[m_pos], tag, 4) == 0;
+    }
+
+    void Skip (size_t numBytes) {
+        if (numBytes > m_size - m_pos) {
+            m_failed = true;
+            m_pos = m_size;
+            return;
+        }
+        m_pos += numBytes;
+    }
+
+private:
+    const uint8_t*  m_data;
+    size_t          m_size;
+    size_t          m_pos;
+    bool            m_failed;
+};
+
+//--------------------------------------------------------------------------------------------------
+struct STickEvent {
+    uint32_t        m_tick;
+    SMidiNoteEvent  m_event;
+};
+
+struct STempoChange {
+    uint32_t    m_tick;
+    uint32_t    m_microsecondsPerQuarter;
+};
+
+//--------------------------------------------------------------------------------------------------
+static bool ReadTrack (CMidiReader& reader, std::vector<STickEvent>& noteEvents, std::vector<STempoChange>& tempoChanges) {
+
+    uint32_t tick = 0;
+    uint8_t runningStatus = 0;
+    while (!reader.AtEnd() && !reader.Failed()) {
+        tick += reader.ReadVariableLength();
+
+        // a data byte where a status byte should be means to re-use the last status
+        uint8_t status = reader.ReadByte();
+        uint8_t data1 = 0;
+        if (status < 0x80) {
+            if (runningStatus == 0)
+                return false;
+            data1 = status;
+            status = runningStatus;
+        }
+        else if (status < 0xf0) {
+            runningStatus = status;
+            data1 = reader.ReadByte();
+        }
+
+        switch (status & 0xf0) {
+            // note off, note on
+            case 0x80:
+            case 0x90: {
+                uint8_t velocity = reader.ReadByte();
+                STickEvent event;
+                event.m_tick = tick;
+                event.m_event.m_time = 0.0;
+                event.m_event.m_channel = status & 0x0f;
+                event.m_event.m_note = data1;
+                event.m_event.m_velocity = velocity;
+                // a note on with 0 velocity is a note off
+                event.m_event.m_on = (status & 0xf0) == 0x90 && velocity > 0;
+                noteEvents.push_back(event);
+                break;
+            }
+            // key pressure, controller, pitch bend have another data byte we don't use
+            case 0xa0:
+            case 0xb0:
+            case 0xe0: reader.ReadByte(); break;
+            // program change and channel pressure only have the one data byte
+            case 0xc0:
+            case 0xd0: break;
+            case 0xf0: {
+                // meta events.  We only care about tempo, and the end of the track.
+                if (status == 0xff) {
+                    runningStatus = 0;
+                    uint8_t type = reader.ReadByte();
+                    uint32_t length = reader.ReadVariableLength();
+                    if (type == 0x2f)
+                        return !reader.Failed();
+                    if (type == 0x51 && length == 3) {
+                        STempoChange tempoChange;
+                        tempoChange.m_tick = tick;
+                        tempoChange.m_microsecondsPerQuarter = reader.ReadBigEndian(3);
+                        tempoChanges.push_back(tempoChange);
+                    }
+                    else {
+                        reader.Skip(length);
+                    }
+                }
+                // sysex
+                else if (status == 0xf0 || status == 0xf7) {
+                    runningStatus = 0;
+                    reader.Skip(reader.ReadVariableLength());
+                }
+                else {
+                    return false;
+                }
+                break;
+            }
+        }
+    }
+
+    return !reader.Failed();
+}
+
+//--------------------------------------------------------------------------------------------------
+bool SMidiFile::Load (const char *fileName) {
+    m_noteEvents.clear();
+    m_lengthSeconds = 0.0;
+
+    // read the whole file in
+    FILE *file = OpenFile(fileName, "rb");
+    if (!file)
+        return false;
+    std::vector<uint8_t> data;
+    uint8_t buffer[4096];
+    size_t numRead;
+    while ((numRead = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data.insert(data.end(), buffer, buffer + numRead);
+    fclose(file);
+
+    // read the header chunk
+    CMidiReader reader(data.data(), data.size());
+    if (!reader.IsTag("MThd"))
+        return false;
+    reader.Skip(4);
+    uint32_t headerSize = reader.ReadBigEndian(4);
+    uint32_t format = reader.ReadBigEndian(2);
+    uint32_t numTracks = reader.ReadBigEndian(2);
+    uint32_t division = reader.ReadBigEndian(2);
+    if (reader.Failed() || headerSize < 6 || format > 1 || division == 0)
+        return false;
+    reader.Skip(headerSize - 6);
+
+    // read the tracks, skipping any chunks we don't know about
+    std::vector<STickEvent> tickEvents;
+    std::vector<STempoChange> tempoChanges;
+    for (uint32_t track = 0; track < numTracks; ) {
+        if (reader.AtEnd())
+            return false;
+        bool isTrack = reader.IsTag("MTrk");
+        reader.Skip(4);
+        uint32_t chunkSize = reader.ReadBigEndian(4);
+        if (reader.Failed() || chunkSize > data.size() - reader.GetPos())
+            return false;
+
+        if (isTrack) {
+            CMidiReader trackReader(data.data() + reader.GetPos(), chunkSize);
+            if (!ReadTrack(trackReader, tickEvents, tempoChanges))
+                return false;
+            ++track;
+        }
+        reader.Skip(chunkSize);
+    }
+
+    // Merge the tracks in time order.  Note offs go before note ons on the same tick, so that a note
+    // that ends as the same note starts again doesn't cut off the new one.
+    std::stable_sort(tickEvents.begin(), tickEvents.end(),
+        [] (const STickEvent& a, const STickEvent& b) {
+            if (a.m_tick != b.m_tick)
+                return a.m_tick < b.m_tick;
+            return !a.m_event.m_on && b.m_event.m_on;
+        }
+    );
+    std::stable_sort(tempoChanges.begin(), tempoChanges.end(),
+        [] (const STempoChange& a, const STempoChange& b) {
+            return a.m_tick < b.m_tick;
+        }
+    );
+
+    // convert ticks to seconds.  SMPTE timing is a fixed number of ticks per second, otherwise it's
+    // ticks per quarter note and we need to walk the tempo map.
+    bool smpte = (division & 0x8000) != 0;
+    double smpteTicksPerSecond = 0.0;
+    if (smpte) {
+        int framesPerSecond = -int(int8_t(division >> 8));
+        smpteTicksPerSecond = (framesPerSecond == 29 ? 29.97 : double(framesPerSecond)) * double(division & 0xff);
+        if (smpteTicksPerSecond <= 0.0)
+            return false;
+    }
+
+    size_t tempoIndex = 0;
+    uint32_t segmentTick = 0;
+    double segmentTime = 0.0;
+    double secondsPerTick = 500000.0 / 1000000.0 / double(division);
+    m_noteEvents.reserve(tickEvents.size());
+    for (STickEvent& tickEvent : tickEvents) {
+        if (smpte) {
+            tickEvent.m_event.m_time = double(tickEvent.m_tick) / smpteTicksPerSecond;
+        }
+        else {
+            while (tempoIndex < tempoChanges.size() && tempoChanges[tempoIndex].m_tick <= tickEvent.m_tick) {
+                segmentTime += double(tempoChanges[tempoIndex].m_tick - segmentTick) * secondsPerTick;
+                segmentTick = tempoChanges[tempoIndex].m_tick;
+                secondsPerTick = double(tempoChanges[tempoIndex].m_microsecondsPerQuarter) / 1000000.0 / double(division);
+                ++tempoIndex;
+            }
+            tickEvent.m_event.m_time = segmentTime + double(tickEvent.m_tick - segmentTick) * secondsPerTick;
+        }
+        m_noteEvents.push_back(tickEvent.m_event);
+    }
+
+    if (!m_noteEvents.empty())
+        m_lengthSeconds = m_noteEvents.back().m_time;
+    return true;
+}
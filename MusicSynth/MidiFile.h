@@ -0,0 +1,33 @@
+//--------------------------------------------------------------------------------------------------
+// MidiFile.h
+//
+// Loads standard MIDI files (type 0 and 1) into a list of note on / note off events, timed in
+// seconds using the file's tempo map.
+//
+//--------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <inttypes.h>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------
+struct SMidiNoteEvent {
+    double  m_time;         // in seconds from the start of the file
+    uint8_t m_channel;
+    uint8_t m_note;
+    uint8_t m_velocity;
+    bool    m_on;
+};
+
+//--------------------------------------------------------------------------------------------------
+struct SMidiFile {
+public:
+
+    SMidiFile () : m_lengthSeconds(0.0) { }
+
+    // returns false if the file can't be read or isn't a type 0 or type 1 midi file
+    bool Load (const char *fileName);
+
+    std::vector<SMidiNoteEvent> m_noteEvents;   // sorted by time
+    double                      m_lengthSeconds;
+};
@@ -0,0 +1,152 @@
+//--------------------------------------------------------------------------------------------------
+// MidiInput.cpp
+//
+// Live MIDI input, through the ALSA sequencer on Linux.
+//
+//--------------------------------------------------------------------------------------------------
+
+#include "MidiInput.h"
+#include "DemoMgr.h"
+#include <stdio.h>
+
+#ifdef __linux__
+#include <alsa/asoundlib.h> // link with -lasound
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+//--------------------------------------------------------------------------------------------------
+CMidiInput::CMidiInput () {
+    m_quit = false;
+    m_sequencer = nullptr;
+    m_port = -1;
+    m_wakePipe[0] = -1;
+    m_wakePipe[1] = -1;
+}
+
+//--------------------------------------------------------------------------------------------------
+CMidiInput::~CMidiInput () {
+    Close();
+}
+
+#ifdef __linux__
+
+//--------------------------------------------------------------------------------------------------
+bool CMidiInput::Open (const char *portName, const TGetStreamTime& getStreamTime) {
+    Close();
+
+    snd_seq_t* sequencer = nullptr;
+    if (snd_seq_open(&sequencer, "default", SND_SEQ_OPEN_INPUT, 0) < 0) {
+        printf("ERROR: could not open the ALSA sequencer\r\n");
+        return false;
+    }
+    snd_seq_set_client_name(sequencer, portName);
+
+    // a port other clients can write to and subscribe to
+    m_port = snd_seq_create_simple_port(sequencer, portName,
+        SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
+        SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+    if (m_port < 0 || pipe(m_wakePipe) != 0) {
+        printf("ERROR: could not create the ALSA sequencer port\r\n");
+        snd_seq_close(sequencer);
+        m_port = -1;
+        return false;
+    }
+
+    // the thread waits in poll(), then reads everything that's there without blocking
+    snd_seq_nonblock(sequencer, 1);
+
+    m_sequencer = sequencer;
+    m_getStreamTime = getStreamTime;
+    m_quit = false;
+    m_thread = std::thread(&CMidiInput::ThreadMain, this);
+
+    printf("MIDI input port %i:%i \"%s\" is ready to connect to\r\n", snd_seq_client_id(sequencer), m_port, portName);
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+void CMidiInput::Close () {
+    if (!m_sequencer)
+        return;
+
+    // wake the thread up and wait for it to finish
+    m_quit = true;
+    char wake = 0;
+    if (write(m_wakePipe[1], &wake, 1) != 1)
+        printf("ERROR: could not wake up the MIDI input thread\r\n");
+    m_thread.join();
+
+    snd_seq_t* sequencer = (snd_seq_t*)m_sequencer;
+    snd_seq_delete_simple_port(sequencer, m_port);
+    snd_seq_close(sequencer);
+    close(m_wakePipe[0]);
+    close(m_wakePipe[1]);
+
+    m_sequencer = nullptr;
+    m_port = -1;
+    m_wakePipe[0] = -1;
+    m_wakePipe[1] = -1;
+}
+
+//--------------------------------------------------------------------------------------------------
+void CMidiInput::ThreadMain () {
+    snd_seq_t* sequencer = (snd_seq_t*)m_sequencer;
+
+    // wait on the sequencer's descriptors, and the wake pipe
+    static const int c_maxDescriptors = 8;
+    struct pollfd descriptors[c_maxDescriptors + 1];
+    int numDescriptors = snd_seq_poll_descriptors_count(sequencer, POLLIN);
+    if (numDescriptors > c_maxDescriptors)
+        numDescriptors = c_maxDescriptors;
+    snd_seq_poll_descriptors(sequencer, descriptors, numDescriptors, POLLIN);
+    descriptors[numDescriptors].fd = m_wakePipe[0];
+    descriptors[numDescriptors].events = POLLIN;
+    descriptors[numDescriptors].revents = 0;
+
+    while (!m_quit) {
+        if (poll(descriptors, numDescriptors + 1, -1) < 0)
+            continue;
+
+        // stamp everything that arrived with when we woke up
+        TSampleClock sampleClock = CDemoMgr::StreamTimeToSampleClock(m_getStreamTime());
+
+        snd_seq_event_t* event = nullptr;
+        while (snd_seq_event_input(sequencer, &event) >= 0 && event) {
+            switch (event->type) {
+                case SND_SEQ_EVENT_NOTEON: {
+                    // a note on with 0 velocity is a note off
+                    const snd_seq_ev_note_t& note = event->data.note;
+                    CDemoMgr::QueueNoteEvent(MIDINoteToFrequency(note.note), MIDIVelocityToAmplitude(note.velocity), note.velocity > 0, sampleClock);
+                    break;
+                }
+                case SND_SEQ_EVENT_NOTEOFF: {
+                    const snd_seq_ev_note_t& note = event->data.note;
+                    CDemoMgr::QueueNoteEvent(MIDINoteToFrequency(note.note), 0.0f, false, sampleClock);
+                    break;
+                }
+                case SND_SEQ_EVENT_CONTROLLER: {
+                    const snd_seq_ev_ctrl_t& control = event->data.control;
+                    CDemoMgr::QueueControlChangeEvent(int(control.param), int(control.value), sampleClock);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+#else
+
+//--------------------------------------------------------------------------------------------------
+bool CMidiInput::Open (const char *portName, const TGetStreamTime& getStreamTime) {
+    printf("ERROR: MIDI input is only supported on Linux\r\n");
+    return false;
+}
+
+//--------------------------------------------------------------------------------------------------
+void CMidiInput::Close () { }
+
+//--------------------------------------------------------------------------------------------------
+void CMidiInput::ThreadMain () { }
+
+#endif
@@ -0,0 +1,40 @@
+//--------------------------------------------------------------------------------------------------
+// MidiInput.h
+//
+// Live MIDI input.  On Linux this creates an ALSA sequencer port that keyboards and other programs
+// can connect to (for instance with aconnect), and a thread that sleeps until MIDI arrives.  Note
+// and controller events are timestamped when they arrive and queued to CDemoMgr.
+//
+//--------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <functional>
+
+//--------------------------------------------------------------------------------------------------
+class CMidiInput {
+public:
+    // returns the current PortAudio stream time, for timestamping events
+    typedef std::function<double()> TGetStreamTime;
+
+    CMidiInput ();
+    ~CMidiInput ();
+
+    // Creates the input port.  Returns false if it can't, or MIDI input isn't supported on this
+    // platform.
+    bool Open (const char *portName, const TGetStreamTime& getStreamTime);
+    void Close ();
+
+private:
+    void ThreadMain ();
+
+    TGetStreamTime      m_getStreamTime;
+    std::thread         m_thread;
+    std::atomic<bool>   m_quit;
+
+    // platform specific
+    void*               m_sequencer;
+    int                 m_port;
+    int                 m_wakePipe[2];  // written to when closing, to wake the thread up
+};
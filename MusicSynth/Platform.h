@@ -0,0 +1,37 @@
+//--------------------------------------------------------------------------------------------------
+// Platform.h
+//
+// Small wrappers for the C library functions that Windows and everything else disagree on.  The
+// Windows build warns about (and with SDL checks, fails on) fopen, and POSIX has no fopen_s.
+//
+//--------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <stdio.h>
+#ifdef _WIN32
+#include <string.h>
+#else
+#include <strings.h>
+#endif
+
+//--------------------------------------------------------------------------------------------------
+// fopen, returning nullptr if the file couldn't be opened
+inline FILE* OpenFile (const char* fileName, const char* mode) {
+#ifdef _WIN32
+    FILE* file = nullptr;
+    fopen_s(&file, fileName, mode);
+    return file;
+#else
+    return fopen(fileName, mode);
+#endif
+}
+
+//--------------------------------------------------------------------------------------------------
+// strcmp, ignoring case
+inline int CompareNoCase (const char* a, const char* b) {
+#ifdef _WIN32
+    return _stricmp(a, b);
+#else
+    return strcasecmp(a, b);
+#endif
+}
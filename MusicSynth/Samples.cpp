@@ -1,21 +1,196 @@
 //--------------------------------------------------------------------------------------------------
 // Samples.cpp
 //
-// The loaded audio samples
+// The audio samples
 //
 //--------------------------------------------------------------------------------------------------
 
 #include "Samples.h"
 #include <stdio.h>
+#include <string.h>
 #include "DemoMgr.h"
+#include "Platform.h"
 
-#define SAMPLE(name) SWavFile g_sample_##name;
-#include "SampleList.h"
+#ifdef _WIN32
+#include <Windows.h> // for listing the samples directory
+#else
+#include <dirent.h>
+#endif
 
-void LoadSamples() {
+std::vector<std::unique_ptr<CSampleRegistry::SEntry>> CSampleRegistry::s_entries;
+bool CSampleRegistry::s_compress = false;
+size_t CSampleRegistry::s_memoryBudget = 256 * 1024 * 1024;
+size_t CSampleRegistry::s_memoryUsed = 0;
+float CSampleRegistry::s_sampleRate = 0.0f;
+std::atomic<TSampleClock> CSampleRegistry::s_audioSampleClock(0);
+std::atomic<size_t> CSampleRegistry::s_audioBufferCount(0);
 
-#define SAMPLE(name) \
-    if (!g_sample_##name.Load("Samples/" #name ".wav", CDemoMgr::GetNumChannels(), (size_t)CDemoMgr::GetSampleRate())) \
-        printf("Could not load Samples/" #name ".wav.\r\n");
-    #include "SampleList.h"
-}
\ No newline at end of file
+// samples that haven't been played for this long can be unloaded
+static const double c_sampleIdleSeconds = 2.0;
+
+//--------------------------------------------------------------------------------------------------
+static bool IsWaveFileName (const char* fileName) {
+    size_t length = strlen(fileName);
+    return length > 4 && !CompareNoCase(&fileName[length - 4], ".wav");
+}
+
+//--------------------------------------------------------------------------------------------------
+static void ListWaveFiles (const char* directory, std::vector<std::string>& fileNames) {
+#ifdef _WIN32
+    std::string pattern = std::string(directory) + "/*.wav";
+    WIN32_FIND_DATAA findData;
+    HANDLE find = FindFirstFileA(pattern.c_str(), &findData);
+    if (find == INVALID_HANDLE_VALUE)
+        return;
+    do {
+        if ((findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0 && IsWaveFileName(findData.cFileName))
+            fileNames.push_back(findData.cFileName);
+    } while (FindNextFileA(find, &findData));
+    FindClose(find);
+#else
+    DIR* dir = opendir(directory);
+    if (!dir)
+        return;
+    while (dirent* entry = readdir(dir)) {
+        if (IsWaveFileName(entry->d_name))
+            fileNames.push_back(entry->d_name);
+    }
+    closedir(dir);
+#endif
+}
+
+//--------------------------------------------------------------------------------------------------
+void CSampleRegistry::Init (const char* directory, float sampleRate) {
+    s_sampleRate = sampleRate;
+
+    std::vector<std::string> fileNames;
+    ListWaveFiles(directory, fileNames);
+    for (const std::string& fileName : fileNames) {
+        std::unique_ptr<SEntry> entry = std::make_unique<SEntry>();
+        entry->m_name = fileName.substr(0, fileName.size() - 4);
+        entry->m_fileName = std::string(directory) + "/" + fileName;
+        s_entries.push_back(std::move(entry));
+    }
+
+    printf("Found %i samples in %s, memory budget %i MB%s\r\n", int(s_entries.size()), directory, int(s_memoryBudget / (1024 * 1024)), s_compress ? " (compressed)" : "");
+}
+
+//--------------------------------------------------------------------------------------------------
+TSampleId CSampleRegistry::Find (const char* name) {
+    for (size_t index = 0; index < s_entries.size(); ++index) {
+        if (!CompareNoCase(s_entries[index]->m_name.c_str(), name))
+            return index;
+    }
+    return c_invalidSampleId;
+}
+
+//--------------------------------------------------------------------------------------------------
+const SWavFile* CSampleRegistry::Prefetch (TSampleId id) {
+    if (id >= s_entries.size())
+        return nullptr;
+
+    // a sample on its way out can just be put back
+    SEntry& entry = *s_entries[id];
+    EState state = EState::e_evicting;
+    if (!entry.m_state.compare_exchange_strong(state, EState::e_loaded) && state != EState::e_loaded)
+        Load(entry);
+
+    // count it as used now, so that loading other samples doesn't evict it before it's played
+    entry.m_lastUsed = s_audioSampleClock.load();
+    EvictToBudget();
+    return &entry.m_wavFile;
+}
+
+//--------------------------------------------------------------------------------------------------
+const SWavFile* CSampleRegistry::Get (TSampleId id) {
+    if (id >= s_entries.size())
+        return nullptr;
+
+    SEntry& entry = *s_entries[id];
+    entry.m_lastUsed.store(s_audioSampleClock.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+    EState state = entry.m_state.load(std::memory_order_acquire);
+    if (state == EState::e_loaded)
+        return &entry.m_wavFile;
+
+    // take back a sample that is being evicted, it's still all there
+    if (state == EState::e_evicting && entry.m_state.compare_exchange_strong(state, EState::e_loaded))
+        return &entry.m_wavFile;
+
+    // ask the main thread to load it
+    if (state == EState::e_unloaded && entry.m_state.compare_exchange_strong(state, EState::e_loadRequested))
+        CDemoMgr::Wake();
+    return nullptr;
+}
+
+//--------------------------------------------------------------------------------------------------
+void CSampleRegistry::OnAudioBufferDone (TSampleClock sampleClock) {
+    s_audioSampleClock.store(sampleClock, std::memory_order_relaxed);
+    s_audioBufferCount.fetch_add(1, std::memory_order_release);
+}
+
+//--------------------------------------------------------------------------------------------------
+void CSampleRegistry::Update () {
+    for (std::unique_ptr<SEntry>& entry : s_entries) {
+        if (entry->m_state.load() == EState::e_loadRequested)
+            Load(*entry);
+    }
+    EvictToBudget();
+}
+
+//--------------------------------------------------------------------------------------------------
+void CSampleRegistry::Load (SEntry& entry) {
+    if (!entry.m_wavFile.Load(entry.m_fileName.c_str(), size_t(s_sampleRate), s_compress)) {
+        // leave it marked as loaded, so the audio thread doesn't keep asking.  It has no samples so
+        // it plays as silence.
+        printf("Could not load %s.\r\n", entry.m_fileName.c_str());
+    }
+    s_memoryUsed += entry.m_wavFile.GetMemorySize();
+    entry.m_lastUsed = s_audioSampleClock.load();
+    entry.m_state.store(EState::e_loaded, std::memory_order_release);
+}
+
+//--------------------------------------------------------------------------------------------------
+void CSampleRegistry::EvictToBudget () {
+
+    // free the samples that the audio thread has finished with.  The audio buffer that was running
+    // when one was marked has ended once the buffer count moves on, and later buffers don't get it.
+    size_t bufferCount = s_audioBufferCount.load(std::memory_order_acquire);
+    size_t memoryEvicting = 0;
+    for (std::unique_ptr<SEntry>& entry : s_entries) {
+        if (entry->m_state.load() != EState::e_evicting)
+            continue;
+
+        EState state = EState::e_evicting;
+        if (bufferCount != entry->m_evictBufferCount && entry->m_state.compare_exchange_strong(state, EState::e_unloaded)) {
+            s_memoryUsed -= entry->m_wavFile.GetMemorySize();
+            entry->m_wavFile.Unload();
+        }
+        else if (state == EState::e_evicting) {
+            memoryEvicting += entry->m_wavFile.GetMemorySize();
+        }
+    }
+
+    // mark the least recently used idle samples for eviction until we'd be under budget
+    TSampleClock idleClock = TSampleClock(c_sampleIdleSeconds * double(s_sampleRate));
+    TSampleClock audioSampleClock = s_audioSampleClock.load();
+    while (s_memoryUsed - memoryEvicting > s_memoryBudget) {
+        SEntry* oldest = nullptr;
+        for (std::unique_ptr<SEntry>& entry : s_entries) {
+            if (entry->m_state.load() != EState::e_loaded || entry->m_lastUsed.load() + idleClock > audioSampleClock)
+                continue;
+            if (!oldest || entry->m_lastUsed.load() < oldest->m_lastUsed.load())
+                oldest = entry.get();
+        }
+
+        // everything else is in use, so go over budget rather than cut off sounds that are playing
+        if (!oldest)
+            break;
+
+        EState state = EState::e_loaded;
+        if (oldest->m_state.compare_exchange_strong(state, EState::e_evicting)) {
+            oldest->m_evictBufferCount = s_audioBufferCount.load(std::memory_order_acquire);
+            memoryEvicting += oldest->m_wavFile.GetMemorySize();
+        }
+    }
+}
@@ -1,14 +1,89 @@
 //--------------------------------------------------------------------------------------------------
 // Samples.h
 //
-// The loaded audio samples
+// The audio samples.  Every wave file in the samples directory is registered at startup, but a
+// sample isn't loaded until a demo prefetches it or first tries to play it.  Samples that haven't
+// been played for a while are unloaded, least recently used first, when the loaded samples go over
+// the memory budget.
+//
+// Loading and unloading happen on the main thread.  When the audio thread asks for a sample that
+// isn't loaded it gets nullptr, and the main thread is woken up to load it.
 //
 //--------------------------------------------------------------------------------------------------
 #pragma once
 
 #include "WavFile.h"
+#include "Timebase.h"
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <string>
+
+typedef size_t TSampleId;
+static const TSampleId c_invalidSampleId = TSampleId(-1);
+
+//--------------------------------------------------------------------------------------------------
+class CSampleRegistry {
+public:
+    // Call before Init()
+    static void SetCompress (bool compress) { s_compress = compress; }
+    static void SetMemoryBudget (size_t bytes) { s_memoryBudget = bytes; }
+
+    // Main thread.  Finds every .wav file in the directory, without loading any of them.
+    static void Init (const char* directory, float sampleRate);
+
+    // Main thread.  The id of a sample by its file name without the .wav, or c_invalidSampleId if
+    // there's no such file.
+    static TSampleId Find (const char* name);
+
+    // Main thread.  Loads a sample now if it isn't loaded, so it's ready before it's played.  Returns
+    // the sample, which is good until the next Update(), or nullptr if there's no such sample.
+    static const SWavFile* Prefetch (TSampleId id);
+
+    // Audio thread.  Marks the sample as used and returns it, or returns nullptr and asks for it to
+    // be loaded if it isn't loaded.  The pointer is only good until the end of the audio buffer.
+    static const SWavFile* Get (TSampleId id);
+
+    // Audio thread.  Call at the end of every audio buffer.
+    static void OnAudioBufferDone (TSampleClock sampleClock);
+
+    // Main thread.  Loads the samples the audio thread asked for and unloads samples to get under the
+    // memory budget.
+    static void Update ();
+
+    // Main thread.  How much memory the loaded samples use, in bytes.
+    static size_t GetMemoryUsed () { return s_memoryUsed; }
+
+private:
+    enum class EState {
+        e_unloaded,
+        e_loadRequested,
+        e_loaded,
+        e_evicting      // still loaded, but not handed out, until the audio thread is done with it
+    };
+
+    struct SEntry {
+        SEntry () : m_state(EState::e_unloaded), m_lastUsed(0), m_evictBufferCount(0) { }
+
+        std::string                 m_name;
+        std::string                 m_fileName;
+        SWavFile                    m_wavFile;
+        std::atomic<EState>         m_state;
+        std::atomic<TSampleClock>   m_lastUsed;
+        size_t                      m_evictBufferCount;
+    };
+
+    static void Load (SEntry& entry);
+    static void EvictToBudget ();
 
-#define SAMPLE(name) extern SWavFile g_sample_##name;
-#include "SampleList.h"
+    static std::vector<std::unique_ptr<SEntry>> s_entries;
+    static bool                                 s_compress;
+    static size_t                               s_memoryBudget;
+    static size_t                               s_memoryUsed;
+    static float                                s_sampleRate;
 
-void LoadSamples();
\ No newline at end of file
+    // where the audio thread is, for knowing how long samples have been idle, and when it has
+    // finished with a sample that is being evicted
+    static std::atomic<TSampleClock>            s_audioSampleClock;
+    static std::atomic<size_t>                  s_audioBufferCount;
+};
@@ -0,0 +1,175 @@
+//--------------------------------------------------------------------------------------------------
+// Sequencer.h
+//
+// A step sequencer.  Tracks are lists of steps that loop, played at a tempo with optional swing.
+// Each buffer, the sequencer works out which steps start in that buffer and hands back an event for
+// each, with the exact frame it starts on, so the cost is per step played rather than per sample.
+//
+//--------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <vector>
+#include <math.h>
+#include "Timebase.h"
+
+// how many parameters each track has, which steps can lock to their own values
+static const size_t c_maxSequencerParams = 4;
+
+//--------------------------------------------------------------------------------------------------
+struct SSequencerStep {
+    SSequencerStep ()
+        : m_on(false)
+        , m_frequency(0.0f)
+        , m_velocity(1.0f)
+        , m_length(0.0f)
+        , m_paramLockMask(0) {
+        for (size_t i = 0; i < c_maxSequencerParams; ++i)
+            m_paramLocks[i] = 0.0f;
+    }
+
+    SSequencerStep (float frequency, float velocity = 1.0f)
+        : SSequencerStep() {
+        m_on = true;
+        m_frequency = frequency;
+        m_velocity = velocity;
+    }
+
+    // overrides the track's value for a parameter, on this step only
+    void LockParam (size_t param, float value) {
+        m_paramLockMask |= 1 << param;
+        m_paramLocks[param] = value;
+    }
+
+    bool            m_on;
+    float           m_frequency;
+    float           m_velocity;
+    float           m_length;           // in steps.  0 means use the track's note length.
+    unsigned int    m_paramLockMask;    // bit N set means m_paramLocks[N] is used
+    float           m_paramLocks[c_maxSequencerParams];
+};
+
+//--------------------------------------------------------------------------------------------------
+struct SSequencerTrack {
+    SSequencerTrack ()
+        : m_noteLength(1.0f) {
+        for (size_t i = 0; i < c_maxSequencerParams; ++i)
+            m_params[i] = 0.0f;
+    }
+
+    std::vector<SSequencerStep> m_steps;    // loops.  Tracks of different lengths loop separately.
+    float                       m_noteLength;   // in steps
+    float                       m_params[c_maxSequencerParams];
+};
+
+//--------------------------------------------------------------------------------------------------
+struct SSequencerEvent {
+    size_t          m_track;
+    size_t          m_step;
+    TSampleClock    m_sampleClock;      // when the note starts
+    size_t          m_frameOffset;      // when the note starts, relative to the start of the buffer
+    size_t          m_lengthSamples;
+    float           m_frequency;
+    float           m_velocity;
+    float           m_params[c_maxSequencerParams]; // the track's parameters, with the step's locks applied
+};
+
+//--------------------------------------------------------------------------------------------------
+class CStepSequencer {
+public:
+    CStepSequencer ()
+        : m_stepSeconds(0.125)
+        , m_swing(0.0f)
+        , m_playing(false)
+        , m_startClock(0) {}
+
+    // set up tracks before playing.  Returns the track index.
+    size_t AddTrack (const SSequencerTrack& track) {
+        m_tracks.push_back(track);
+        return m_tracks.size() - 1;
+    }
+    SSequencerTrack& GetTrack (size_t track) { return m_tracks[track]; }
+
+    void SetTempo (float beatsPerMinute, size_t stepsPerBeat) {
+        m_stepSeconds = 60.0 / (double(beatsPerMinute) * double(stepsPerBeat));
+    }
+
+    // for things that aren't on a musical grid, like looping a sound.  A length of 0 or less stops
+    // any steps from playing.
+    void SetStepLength (double seconds) { m_stepSeconds = seconds; }
+
+    // Swing delays every odd step by this fraction of a step.  0 is straight, 1/3 is a triplet feel.
+    void SetSwing (float swing) { m_swing = swing; }
+
+    // step 0 plays on this sample
+    void Start (TSampleClock sampleClock) {
+        m_startClock = sampleClock;
+        m_playing = true;
+    }
+    void Stop () { m_playing = false; }
+    bool IsPlaying () const { return m_playing; }
+
+    // Calls onEvent(const SSequencerEvent&) for every note that starts in this buffer, in order.
+    template <typename LAMBDA>
+    void ScheduleBlock (TSampleClock sampleClock, size_t framesPerBuffer, float sampleRate, const LAMBDA& onEvent) const {
+        if (!m_playing || m_tracks.empty())
+            return;
+
+        // with no length, every step would start on the same sample and this would never finish
+        double stepSamples = m_stepSeconds * double(sampleRate);
+        if (!(stepSamples > 0.0))
+            return;
+        TSampleClock blockEnd = sampleClock + framesPerBuffer;
+
+        // start a step early, in case swing pushed it into this buffer
+        size_t step = 0;
+        if (sampleClock > m_startClock) {
+            step = size_t(double(sampleClock - m_startClock) / stepSamples);
+            if (step > 0)
+                --step;
+        }
+
+        for (; ; ++step) {
+            TSampleClock stepStart = StepStart(step, stepSamples);
+            if (stepStart >= blockEnd)
+                break;
+            if (stepStart < sampleClock)
+                continue;
+
+            for (size_t trackIndex = 0; trackIndex < m_tracks.size(); ++trackIndex) {
+                const SSequencerTrack& track = m_tracks[trackIndex];
+                if (track.m_steps.empty())
+                    continue;
+
+                const SSequencerStep& trackStep = track.m_steps[step % track.m_steps.size()];
+                if (!trackStep.m_on)
+                    continue;
+
+                SSequencerEvent event;
+                event.m_track = trackIndex;
+                event.m_step = step % track.m_steps.size();
+                event.m_sampleClock = stepStart;
+                event.m_frameOffset = size_t(stepStart - sampleClock);
+                event.m_lengthSamples = size_t(double(trackStep.m_length > 0.0f ? trackStep.m_length : track.m_noteLength) * stepSamples);
+                event.m_frequency = trackStep.m_frequency;
+                event.m_velocity = trackStep.m_velocity;
+                for (size_t param = 0; param < c_maxSequencerParams; ++param)
+                    event.m_params[param] = (trackStep.m_paramLockMask & (1 << param)) ? trackStep.m_paramLocks[param] : track.m_params[param];
+                onEvent(event);
+            }
+        }
+    }
+
+private:
+    TSampleClock StepStart (size_t step, double stepSamples) const {
+        double offset = double(step) * stepSamples;
+        if (step % 2 == 1)
+            offset += double(m_swing) * stepSamples;
+        return m_startClock + TSampleClock(floor(offset));
+    }
+
+    std::vector<SSequencerTrack>    m_tracks;
+    double                          m_stepSeconds;
+    float                           m_swing;
+    bool                            m_playing;
+    TSampleClock                    m_startClock;
+};
@@ -0,0 +1,34 @@
+//--------------------------------------------------------------------------------------------------
+// Timebase.h
+//
+// The sample clock, and turning it into time and oscillator phase.  The clock is 64 bits so it
+// never rolls over.  A float only holds 24 bits, so float(sampleClock) stops being sample accurate
+// after about six minutes at 44.1khz.  Time is worked out in double instead, and phase has whole
+// cycles taken off in double before it's narrowed to float, which stays precise for centuries.
+//
+//--------------------------------------------------------------------------------------------------
+#pragma once
+
+#include <inttypes.h>
+#include <math.h>
+
+typedef uint64_t TSampleClock;
+
+//--------------------------------------------------------------------------------------------------
+inline double SampleClockToSeconds (TSampleClock sampleClock, float sampleRate) {
+    return double(sampleClock) / double(sampleRate);
+}
+
+//--------------------------------------------------------------------------------------------------
+// The phase from 0 to 1 of an oscillator at the given frequency, that was at phase 0 on sample 0.
+// For LFOs and other things that should be in sync with the clock, rather than with a note.
+inline float SampleClockToPhase (TSampleClock sampleClock, double frequency, float sampleRate) {
+    double cycles = double(sampleClock) * frequency / double(sampleRate);
+    return float(cycles - floor(cycles));
+}
+
+//--------------------------------------------------------------------------------------------------
+// Musical time, in beats since startClock.
+inline double SampleClockToBeats (TSampleClock sampleClock, TSampleClock startClock, double beatsPerMinute, float sampleRate) {
+    return double(sampleClock - startClock) * beatsPerMinute / (60.0 * double(sampleRate));
+}
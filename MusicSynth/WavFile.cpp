@@ -7,8 +7,10 @@
 
 #include "WavFile.h"
 #include "AudioUtils.h"
+#include "Platform.h"
 #include <stdio.h>
 #include <memory>
+#include <emmintrin.h>
 
 void NormalizeAudioData(float *pData, int nNumSamples)
 {
@@ -43,45 +45,6 @@ void NormalizeAudioData(float *pData, int nNumSamples)
     }
 }
 
-void ChangeNumChannels(float *&pData, int &nNumSamples, int nSrcChannels, int nDestChannels)
-{
-    //if the number of channels requested is the number of channels already there, or either number of channels is not mono or stereo, return
-    if (nSrcChannels == nDestChannels ||
-        nSrcChannels < 1 || nSrcChannels > 2 ||
-        nDestChannels < 1 || nDestChannels > 2)
-    {
-        return;
-    }
-
-    //if converting to stereo
-    if (nDestChannels == 2)
-    {
-        float *pNewData = new float[nNumSamples * 2];
-        for (int nIndex = 0; nIndex < nNumSamples; ++nIndex)
-        {
-            pNewData[nIndex * 2] = pData[nIndex];
-            pNewData[nIndex * 2 + 1] = pData[nIndex];
-        }
-
-        delete pData;
-        pData = pNewData;
-        nNumSamples *= 2;
-    }
-    //else converting to mono
-    else
-    {
-        float *pNewData = new float[nNumSamples / 2];
-        for (int nIndex = 0; nIndex < nNumSamples / 2; ++nIndex)
-        {
-            pNewData[nIndex] = pData[nIndex * 2] + pData[nIndex * 2 + 1];
-        }
-
-        delete pData;
-        pData = pNewData;
-        nNumSamples /= 2;
-    }
-}
-
 float GetInterpolatedAudioSample(float *pData, int nNumSamples, float fIndex)
 {
     int nIndex1 = (int)fIndex;
@@ -168,10 +131,9 @@ float PCMToFloat(unsigned char *pPCMData, int nNumBytes)
     }
 }
 
-bool ReadWaveFile(const char *fileName, float *&data, size_t &numSamples, size_t numChannels, size_t sampleRate, bool normalizeData) {
+bool ReadWaveFile(const char *fileName, float *&data, size_t &numSamples, size_t &numChannels, size_t sampleRate, bool normalizeData) {
     //open the file if we can
-    FILE *File = nullptr;
-    fopen_s(&File, fileName, "rb");
+    FILE *File = OpenFile(fileName, "rb");
     if (!File)
     {
         return false;
@@ -296,9 +258,6 @@ bool ReadWaveFile(const char *fileName, float *&data, size_t &numSamples, size_t
     //re-sample the sample rate up or down as needed
     ResampleData(pSourceSamples, nNumSourceSamples, waveData.m_nSampleRate, sampleRate);
 
-    //handle switching from mono to stereo or vice versa
-    ChangeNumChannels(pSourceSamples, nNumSourceSamples, waveData.m_nNumChannels, numChannels);
-
     //normalize the data if we should
     if (normalizeData)
         NormalizeAudioData(pSourceSamples, nNumSourceSamples);
@@ -306,6 +265,93 @@ bool ReadWaveFile(const char *fileName, float *&data, size_t &numSamples, size_t
     //return our data
     data = pSourceSamples;
     numSamples = nNumSourceSamples;
+    numChannels = waveData.m_nNumChannels;
 
     return true;
-}
\ No newline at end of file
+}
+
+void SWavFile::Compress()
+{
+    if (!m_samples)
+        return;
+
+    size_t numBlocks = GetNumBlocks();
+    m_compressedSamples = CEngineMemory::Allocate<int16_t>(m_numSamples);
+    m_blockScales = CEngineMemory::Allocate<float>(numBlocks);
+
+    for (size_t block = 0; block < numBlocks; ++block)
+    {
+        size_t begin = block * c_compressedBlockSize;
+        size_t end = begin + c_compressedBlockSize < m_numSamples ? begin + c_compressedBlockSize : m_numSamples;
+
+        //scale the block so the loudest sample uses the whole int16 range
+        float peak = 0.0f;
+        for (size_t index = begin; index < end; ++index)
+        {
+            if (std::fabs(m_samples[index]) > peak)
+                peak = std::fabs(m_samples[index]);
+        }
+        float scale = peak > 0.0f ? peak / 32767.0f : 1.0f;
+        m_blockScales[block] = scale;
+
+        //round each sample to the nearest step
+        for (size_t index = begin; index < end; ++index)
+            m_compressedSamples[index] = (int16_t)std::floor(m_samples[index] / scale + 0.5f);
+    }
+
+    CEngineMemory::Free(m_samples);
+    m_samples = nullptr;
+}
+
+void SWavFile::ReadSamples(size_t frame, size_t channel, float *out, size_t numFrames) const
+{
+    channel %= m_numChannels;
+    size_t index = frame * m_numChannels + channel;
+
+    if (!m_compressedSamples)
+    {
+        for (size_t i = 0; i < numFrames; ++i)
+            out[i] = m_samples[index + i * m_numChannels];
+        return;
+    }
+
+    while (numFrames > 0)
+    {
+        //decode up to the end of the block, where the scale changes
+        size_t block = index / c_compressedBlockSize;
+        size_t blockFramesLeft = ((block + 1) * c_compressedBlockSize - index + m_numChannels - 1) / m_numChannels;
+        size_t count = numFrames < blockFramesLeft ? numFrames : blockFramesLeft;
+        const int16_t *in = &m_compressedSamples[index];
+        float scale = m_blockScales[block];
+        __m128 scale4 = _mm_set1_ps(scale);
+
+        size_t i = 0;
+        if (m_numChannels == 1)
+        {
+            //sign extend 4 int16s to int32s by putting them in the top half and shifting back down
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i packed = _mm_loadl_epi64((const __m128i*)&in[i]);
+                __m128i wide = _mm_srai_epi32(_mm_unpacklo_epi16(packed, packed), 16);
+                _mm_storeu_ps(&out[i], _mm_mul_ps(_mm_cvtepi32_ps(wide), scale4));
+            }
+        }
+        else if (m_numChannels == 2)
+        {
+            //in starts at our channel, so our samples are the bottom half of each 32 bit pair.  The
+            //load reads one sample past the last frame, so stop short of the end of the data.
+            for (; i + 4 <= count && index + i * 2 + 8 <= m_numSamples; i += 4)
+            {
+                __m128i packed = _mm_loadu_si128((const __m128i*)&in[i * 2]);
+                __m128i wide = _mm_srai_epi32(_mm_slli_epi32(packed, 16), 16);
+                _mm_storeu_ps(&out[i], _mm_mul_ps(_mm_cvtepi32_ps(wide), scale4));
+            }
+        }
+        for (; i < count; ++i)
+            out[i] = float(in[i * m_numChannels]) * scale;
+
+        out += count;
+        index += count * m_numChannels;
+        numFrames -= count;
+    }
+}
@@ -8,6 +8,7 @@
 
 #include <inttypes.h>
 #include <memory.h>
+#include "EngineMemory.h"
 
 struct SWaveFileHeader {
 
@@ -69,43 +70,91 @@ inline int16_t ConvertFloatToAudioSample (float in)
 
 // loads in a wave file if it can, allocates memory for the samples and returns that in data.
 // if normalizeData is true, it makes all float data be [-1,1] by dividing all values by the absolute value of the largest absolute value of the data
-// converts the data to the number of channels and sample rate specified
-bool ReadWaveFile (const char *fileName, float *&data, size_t &numSamples, size_t numChannels, size_t sampleRate, bool normalizeData = true);
+// converts the data to the sample rate specified, but keeps the file's own number of channels, which is returned in numChannels
+bool ReadWaveFile (const char *fileName, float *&data, size_t &numSamples, size_t &numChannels, size_t sampleRate, bool normalizeData = true);
 
 //--------------------------------------------------------------------------------------------------
+// Samples are kept in the file's own number of channels, interleaved, so mono files take half the
+// memory they would if they were copied out to stereo.  Upmix them when playing them back.
+//
+// They can also be stored compressed, as int16 with a scale per block of c_compressedBlockSize
+// samples, which is half the size of float.  The scale is set from the loudest sample in the block,
+// so quiet passages keep their precision, unlike plain 16 bit.
 struct SWavFile {
 public:
+    static const size_t c_compressedBlockSize = 256;
 
-    SWavFile () : m_samples(nullptr), m_numSamples(0) { }
+    SWavFile () : m_samples(nullptr), m_compressedSamples(nullptr), m_blockScales(nullptr), m_numSamples(0), m_sampleRate(0), m_numChannels(1), m_lengthSeconds(0.0f) { }
     ~SWavFile () {
-        if (m_samples) {
-            delete[] m_samples;
-            m_samples = nullptr;
-            m_numSamples = 0;
-        }
+        Unload();
     }
 
-    bool IsLoaded () const { return m_samples != nullptr; }
+    bool IsLoaded () const { return m_samples != nullptr || m_compressedSamples != nullptr; }
+    bool IsCompressed () const { return m_compressedSamples != nullptr; }
 
-    bool Load (const char *fileName, size_t numChannels, size_t sampleRate, bool normalizeData = true) {
-        if (m_samples) {
-            delete[] m_samples;
-            m_samples = nullptr;
-            m_numSamples = 0;
-        }
+    bool Load (const char *fileName, size_t sampleRate, bool compress = false, bool normalizeData = true) {
+        Unload();
 
-        if (!ReadWaveFile(fileName, m_samples, m_numSamples, numChannels, sampleRate, normalizeData))
+        float* samples = nullptr;
+        if (!ReadWaveFile(fileName, samples, m_numSamples, m_numChannels, sampleRate, normalizeData))
             return false;
 
+        // copy them into engine memory, which faults in every page before the audio thread can play them
+        m_samples = CEngineMemory::Allocate<float>(m_numSamples);
+        memcpy(m_samples, samples, m_numSamples * sizeof(float));
+        delete[] samples;
+
         m_sampleRate = sampleRate;
-        m_numChannels = numChannels;
-        m_lengthSeconds = float(m_numSamples / m_numChannels) / float(m_sampleRate);
+        m_lengthSeconds = float(GetNumFrames()) / float(m_sampleRate);
+
+        if (compress)
+            Compress();
         return true;
     }
 
-    float*  m_samples;
-    size_t  m_numSamples;
-    size_t  m_sampleRate;
-    size_t  m_numChannels;
-    float   m_lengthSeconds;
-};
\ No newline at end of file
+    void Unload () {
+        CEngineMemory::Free(m_samples);
+        CEngineMemory::Free(m_compressedSamples);
+        CEngineMemory::Free(m_blockScales);
+        m_samples = nullptr;
+        m_compressedSamples = nullptr;
+        m_blockScales = nullptr;
+        m_numSamples = 0;
+        m_sampleRate = 0;
+        m_lengthSeconds = 0.0f;
+    }
+
+    // converts float samples to compressed ones, and frees the float samples
+    void Compress ();
+
+    // how much memory the samples take up, in bytes
+    size_t GetMemorySize () const {
+        if (IsCompressed())
+            return m_numSamples * sizeof(int16_t) + GetNumBlocks() * sizeof(float);
+        return m_numSamples * sizeof(float);
+    }
+
+    size_t GetNumFrames () const { return m_numSamples / m_numChannels; }
+    size_t GetNumBlocks () const { return (m_numSamples + c_compressedBlockSize - 1) / c_compressedBlockSize; }
+
+    // Reads a channel of a frame.  Channels past the ones the file has wrap around, so a mono file
+    // plays the same on every channel.
+    float GetSample (size_t frame, size_t channel) const {
+        size_t index = frame * m_numChannels + channel % m_numChannels;
+        if (m_compressedSamples)
+            return float(m_compressedSamples[index]) * m_blockScales[index / c_compressedBlockSize];
+        return m_samples[index];
+    }
+
+    // Reads numFrames of a channel starting at frame, for playing a run of samples at once.
+    // Compressed samples are decoded with SSE2, four at a time.  Must not read past the end.
+    void ReadSamples (size_t frame, size_t channel, float *out, size_t numFrames) const;
+
+    float*      m_samples;
+    int16_t*    m_compressedSamples;
+    float*      m_blockScales;
+    size_t      m_numSamples;
+    size_t      m_sampleRate;
+    size_t      m_numChannels;
+    float       m_lengthSeconds;
+};